@@ -1,13 +1,15 @@
 /* compute the acoustid of a list of songs */
 
 #include <groovefingerprinter/fingerprinter.h>
+#include <groovefingerprinter/index.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
 
 static int usage(char *arg0) {
-    fprintf(stderr, "Usage: %s [--raw] file1 file2 ...\n", arg0);
+    fprintf(stderr, "Usage: %s [--raw] [--max-duration 120] [--jobs 4] [--unordered] [--duplicates] file1 file2 ...\n", arg0);
     return 1;
 }
 
@@ -22,6 +24,10 @@ int main(int argc, char * argv[]) {
     struct GroovePlaylist *playlist = groove_playlist_create();
 
     int raw = 0;
+    double max_duration = 0.0;
+    int worker_count = 0;
+    int unordered = 0;
+    int duplicates = 0;
 
     for (int i = 1; i < argc; i += 1) {
         char *arg = argv[i];
@@ -29,6 +35,14 @@ int main(int argc, char * argv[]) {
             arg += 2;
             if (strcmp(arg, "raw") == 0) {
                 raw = 1;
+            } else if (strcmp(arg, "max-duration") == 0 && i + 1 < argc) {
+                max_duration = atof(argv[++i]);
+            } else if (strcmp(arg, "jobs") == 0 && i + 1 < argc) {
+                worker_count = atoi(argv[++i]);
+            } else if (strcmp(arg, "unordered") == 0) {
+                unordered = 1;
+            } else if (strcmp(arg, "duplicates") == 0) {
+                duplicates = 1;
             } else {
                 return usage(argv[0]);
             }
@@ -43,6 +57,16 @@ int main(int argc, char * argv[]) {
     }
 
     struct GrooveFingerprinter *printer = groove_fingerprinter_create();
+    printer->max_duration = max_duration;
+    printer->worker_count = worker_count;
+    printer->unordered = unordered;
+    // with --duplicates, each fingerprint is looked up among the ones before
+    // it. the ids are positions in seen_items.
+    struct GrooveFingerprintIndex *fp_index = duplicates ? groove_fingerprint_index_create() : NULL;
+    struct GroovePlaylistItem **seen_items = NULL;
+    int seen_count = 0;
+
+    clock_t start = clock();
     groove_fingerprinter_attach(printer, playlist);
 
     struct GrooveFingerprinterInfo info;
@@ -66,12 +90,41 @@ int main(int argc, char * argv[]) {
                     groove_fingerprinter_dealloc(encoded_fp);
                 }
             }
+            if (fp_index) {
+                struct GrooveFingerprintMatch matches[4];
+                int match_count = groove_fingerprint_index_find(fp_index, info.fingerprint,
+                        info.fingerprint_size, 0.8, matches, 4);
+                for (int i = 0; i < match_count; i += 1) {
+                    printf("duplicate of %s (%.0f%% similar)\n",
+                            seen_items[matches[i].id]->file->filename,
+                            matches[i].similarity * 100.0);
+                }
+                struct GroovePlaylistItem **new_seen = realloc(seen_items,
+                        (seen_count + 1) * sizeof(struct GroovePlaylistItem *));
+                if (new_seen) {
+                    seen_items = new_seen;
+                    seen_items[seen_count] = info.item;
+                    groove_fingerprint_index_add(fp_index, seen_count,
+                            info.fingerprint, info.fingerprint_size);
+                    seen_count += 1;
+                }
+            }
             groove_fingerprinter_free_info(&info);
         } else {
+            // the end of playlist sentinel has the total duration
+            double cpu_seconds = (clock() - start) / (double)CLOCKS_PER_SEC;
+            fprintf(stderr, "\nfingerprinted %.1fs of audio in %.2fs of CPU time",
+                    info.duration, cpu_seconds);
+            if (cpu_seconds > 0.0)
+                fprintf(stderr, " (%.1fx realtime)", info.duration / cpu_seconds);
+            fprintf(stderr, "\n");
             break;
         }
     }
 
+    groove_fingerprint_index_destroy(fp_index);
+    free(seen_items);
+
     struct GroovePlaylistItem *item = playlist->head;
     while (item) {
         struct GrooveFile *file = item->file;
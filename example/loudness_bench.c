@@ -0,0 +1,104 @@
+/* measure how much CPU time each loudness detector mode costs
+ * usage: loudness_bench file1 file2 ...
+ * every file is scanned once per row, so use the same files for runs that
+ * are compared, and run it twice to take the disk cache out of the first row
+ */
+
+#include <grooveloudness/loudness.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+struct BenchMode {
+    const char *name;
+    int modes;
+};
+
+static const struct BenchMode bench_modes[] = {
+    {"decode only", 0},
+    {"integrated", GROOVE_LOUDNESS_INTEGRATED},
+    {"sample peak", GROOVE_LOUDNESS_SAMPLE_PEAK},
+    {"true peak", GROOVE_LOUDNESS_TRUE_PEAK},
+    {"loudness range", GROOVE_LOUDNESS_RANGE},
+    {"momentary + short-term", GROOVE_LOUDNESS_MOMENTARY},
+    {"integrated + true peak", GROOVE_LOUDNESS_INTEGRATED|GROOVE_LOUDNESS_TRUE_PEAK},
+    {"everything", GROOVE_LOUDNESS_INTEGRATED|GROOVE_LOUDNESS_TRUE_PEAK|
+        GROOVE_LOUDNESS_RANGE|GROOVE_LOUDNESS_MOMENTARY},
+};
+
+// scans every file with the given modes. returns the CPU time it took and
+// sets audio_seconds to the duration of the audio scanned.
+static double scan(int file_count, char *filenames[], int modes, double *audio_seconds) {
+    struct GroovePlaylist *playlist = groove_playlist_create();
+    for (int i = 0; i < file_count; i += 1) {
+        struct GrooveFile *file = groove_file_open(filenames[i]);
+        if (!file) {
+            fprintf(stderr, "Unable to open %s\n", filenames[i]);
+            continue;
+        }
+        groove_playlist_insert(playlist, file, 1.0, 1.0, NULL);
+    }
+
+    struct GrooveLoudnessDetector *detector = groove_loudness_detector_create();
+    detector->modes = modes;
+    detector->disable_album = 1;
+
+    clock_t start = clock();
+    groove_loudness_detector_attach(detector, playlist);
+
+    struct GrooveLoudnessDetectorInfo info;
+    *audio_seconds = 0.0;
+    while (groove_loudness_detector_info_get(detector, &info, 1) == 1) {
+        if (!info.item) {
+            *audio_seconds = info.duration;
+            break;
+        }
+    }
+    clock_t end = clock();
+
+    groove_loudness_detector_detach(detector);
+    groove_loudness_detector_destroy(detector);
+
+    struct GroovePlaylistItem *item = playlist->head;
+    while (item) {
+        struct GrooveFile *file = item->file;
+        struct GroovePlaylistItem *next = item->next;
+        groove_playlist_remove(playlist, item);
+        groove_file_close(file);
+        item = next;
+    }
+    groove_playlist_destroy(playlist);
+
+    return (end - start) / (double)CLOCKS_PER_SEC;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file1 file2 ...\n", argv[0]);
+        return 1;
+    }
+
+    groove_init();
+    atexit(groove_finish);
+    groove_set_logging(GROOVE_LOG_ERROR);
+
+    double baseline = 0.0;
+    int mode_count = sizeof(bench_modes) / sizeof(bench_modes[0]);
+    // the first row decodes without measuring anything, so the "over
+    // decode" columns are what each measurement itself costs
+    printf("%-26s %10s %10s %12s %14s\n", "mode", "cpu (s)", "x realtime",
+            "over decode", "per audio hour");
+    for (int i = 0; i < mode_count; i += 1) {
+        double audio_seconds;
+        double cpu_seconds = scan(argc - 1, argv + 1, bench_modes[i].modes, &audio_seconds);
+        if (i == 0)
+            baseline = cpu_seconds;
+        double speed = (cpu_seconds > 0.0) ? (audio_seconds / cpu_seconds) : 0.0;
+        double cost = cpu_seconds - baseline;
+        double hourly = (audio_seconds > 0.0) ? (cost * 3600.0 / audio_seconds) : 0.0;
+        printf("%-26s %10.2f %10.1f %11.2fs %13.2fs\n", bench_modes[i].name,
+                cpu_seconds, speed, cost, hourly);
+    }
+
+    return 0;
+}
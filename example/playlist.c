@@ -6,7 +6,7 @@
 #include <string.h>
 
 static int usage(const char *exe) {
-    fprintf(stderr, "Usage: %s [--volume 1.0] file1 file2 ...\n", exe);
+    fprintf(stderr, "Usage: %s [--volume 1.0] [--dummy] [--speed 1.0] [--null] file1 file2 ...\n", exe);
     return 1;
 }
 
@@ -33,11 +33,16 @@ int main(int argc, char * argv[]) {
             arg += 2;
             if (strcmp(arg, "dummy") == 0) {
                 player->device_index = GROOVE_PLAYER_DUMMY_DEVICE;
+            } else if (strcmp(arg, "null") == 0) {
+                player->device_index = GROOVE_PLAYER_NULL_DEVICE;
             } else if (i + 1 >= argc) {
                 return usage(exe);
             } else if (strcmp(arg, "volume") == 0) {
                 double volume = atof(argv[++i]);
                 groove_playlist_set_gain(playlist, volume);
+            } else if (strcmp(arg, "speed") == 0) {
+                player->device_index = GROOVE_PLAYER_DUMMY_DEVICE;
+                player->dummy_speed = atof(argv[++i]);
             } else {
                 return usage(exe);
             }
@@ -53,11 +58,21 @@ int main(int argc, char * argv[]) {
     groove_player_attach(player, playlist);
 
     union GroovePlayerEvent event;
+    struct GroovePlayerThroughputEvent throughput;
+    struct GroovePlayerUnderrunEvent underrun;
     struct GroovePlaylistItem *item;
     while (groove_player_event_get(player, &event, 1) >= 0) {
         switch (event.type) {
         case GROOVE_EVENT_BUFFERUNDERRUN:
-            fprintf(stderr, "buffer underrun\n");
+            if (groove_player_get_underrun(player, &underrun) < 0)
+                break;
+            fprintf(stderr, "buffer underrun: %.3fs of silence\n", underrun.duration);
+            break;
+        case GROOVE_EVENT_THROUGHPUT:
+            if (groove_player_get_throughput(player, &throughput) < 0)
+                break;
+            printf("%.2fs of audio in %.2fs (%.1fx realtime)\n",
+                    throughput.audio_seconds, throughput.wall_seconds, throughput.speed);
             break;
         case GROOVE_EVENT_NOWPLAYING:
             groove_player_position(player, &item, NULL);
@@ -3,6 +3,7 @@
 #include <grooveloudness/loudness.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static double clamp_rg(double x) {
     if (x < -51.0) return -51.0;
@@ -14,20 +15,43 @@ double loudness_to_replaygain(double loudness) {
     return clamp_rg(-18.0 - loudness);
 }
 
+static int usage(const char *exe) {
+    fprintf(stderr, "Usage: %s [--jobs 4] [--histogram] [--cache dir] [--estimate 8] file1 file2 ...\n", exe);
+    return 1;
+}
+
 int main(int argc, char * argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s file1 file2 ...\n", argv[0]);
-        return 1;
-    }
+    const char *exe = argv[0];
+    if (argc < 2) return usage(exe);
 
     groove_init();
     atexit(groove_finish);
     groove_set_logging(GROOVE_LOG_INFO);
 
     struct GroovePlaylist *playlist = groove_playlist_create();
+    struct GrooveLoudnessDetector *detector = groove_loudness_detector_create();
 
     for (int i = 1; i < argc; i += 1) {
         char * filename = argv[i];
+        if (strcmp(filename, "--jobs") == 0) {
+            if (i + 1 >= argc) return usage(exe);
+            detector->worker_count = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(filename, "--cache") == 0) {
+            if (i + 1 >= argc) return usage(exe);
+            detector->cache_dir = argv[++i];
+            continue;
+        }
+        if (strcmp(filename, "--estimate") == 0) {
+            if (i + 1 >= argc) return usage(exe);
+            detector->estimate_windows = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(filename, "--histogram") == 0) {
+            detector->use_histogram = 1;
+            continue;
+        }
         struct GrooveFile * file = groove_file_open(filename);
         if (!file) {
             fprintf(stderr, "Unable to open %s\n", filename);
@@ -36,7 +60,10 @@ int main(int argc, char * argv[]) {
         groove_playlist_insert(playlist, file, 1.0, 1.0, NULL);
     }
 
-    struct GrooveLoudnessDetector *detector = groove_loudness_detector_create();
+    // estimates need the detector to decode the files itself
+    if (detector->estimate_windows > 0 && detector->worker_count <= 0)
+        detector->worker_count = 1;
+
     groove_loudness_detector_attach(detector, playlist);
 
     struct GrooveLoudnessDetectorInfo info;
@@ -47,6 +74,8 @@ int main(int argc, char * argv[]) {
                     loudness_to_replaygain(info.loudness),
                     info.peak,
                     info.duration);
+            if (info.estimated)
+                fprintf(stderr, "estimated, error: %.2f LU\n", info.estimate_error);
         } else {
             fprintf(stderr, "\nAll files complete.\n");
             fprintf(stderr, "suggested gain: %.2f dB, sample peak: %f, duration: %fs\n",
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "analyzer.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+#include <pthread.h>
+
+// the plugins that share a sink
+struct AnalyzerGroup {
+    struct GrooveAnalyzerPrivate *a;
+    struct GrooveSink *sink;
+    struct GrooveAnalyzerPlugin **plugins;
+    int plugin_count;
+
+    // mutex applies to these. consumed is how many seconds of audio were
+    // taken from the sink since the last end or flush.
+    double consumed;
+    int ended;
+};
+
+struct GrooveAnalyzerPrivate {
+    struct GrooveAnalyzer externals;
+
+    struct GrooveAnalyzerPlugin **plugins;
+    int plugin_count;
+
+    struct AnalyzerGroup *groups;
+    int group_count;
+
+    pthread_mutex_t mutex;
+    char mutex_inited;
+    pthread_t thread_id;
+    char thread_inited;
+
+    int abort_request;
+};
+
+static int plugins_share_sink(const struct GrooveAnalyzerPlugin *a,
+        const struct GrooveAnalyzerPlugin *b)
+{
+    if (a->disable_resample != b->disable_resample || a->disable_gain != b->disable_gain)
+        return 0;
+    if (a->disable_resample)
+        return 1;
+    return a->audio_format.sample_rate == b->audio_format.sample_rate &&
+        a->audio_format.channel_layout == b->audio_format.channel_layout &&
+        a->audio_format.sample_fmt == b->audio_format.sample_fmt;
+}
+
+// the group that is furthest behind, so that no sink fills up while another
+// one is waited on. NULL if every group has reached the end.
+// mutex must be held.
+static struct AnalyzerGroup *next_group(struct GrooveAnalyzerPrivate *a) {
+    struct AnalyzerGroup *next = NULL;
+    for (int i = 0; i < a->group_count; i += 1) {
+        struct AnalyzerGroup *group = &a->groups[i];
+        if (!group->ended && (!next || group->consumed < next->consumed))
+            next = group;
+    }
+    return next;
+}
+
+// takes buffers from the sinks one at a time and gives them to the plugins
+static void *analyze_thread(void *arg) {
+    struct GrooveAnalyzerPrivate *a = arg;
+
+    struct GrooveBuffer *buffer;
+    for (;;) {
+        pthread_mutex_lock(&a->mutex);
+        if (a->abort_request) {
+            pthread_mutex_unlock(&a->mutex);
+            break;
+        }
+        struct AnalyzerGroup *group = next_group(a);
+        if (!group) {
+            // every sink reached the end of the playlist. start over for
+            // whatever is inserted next.
+            for (int i = 0; i < a->group_count; i += 1) {
+                a->groups[i].ended = 0;
+                a->groups[i].consumed = 0.0;
+            }
+            pthread_mutex_unlock(&a->mutex);
+            continue;
+        }
+        pthread_mutex_unlock(&a->mutex);
+
+        int result = groove_sink_buffer_get(group->sink, &buffer, 1);
+
+        if (result == GROOVE_BUFFER_END) {
+            for (int i = 0; i < group->plugin_count; i += 1) {
+                struct GrooveAnalyzerPlugin *plugin = group->plugins[i];
+                if (plugin->end)
+                    plugin->end(plugin);
+            }
+            pthread_mutex_lock(&a->mutex);
+            group->ended = 1;
+            pthread_mutex_unlock(&a->mutex);
+            continue;
+        }
+
+        if (result != GROOVE_BUFFER_YES)
+            break;
+
+        for (int i = 0; i < group->plugin_count; i += 1)
+            group->plugins[i]->buffer(group->plugins[i], buffer);
+
+        pthread_mutex_lock(&a->mutex);
+        group->consumed += buffer->frame_count / (double)buffer->format.sample_rate;
+        pthread_mutex_unlock(&a->mutex);
+        groove_buffer_unref(buffer);
+    }
+
+    return NULL;
+}
+
+static void sink_flush(struct GrooveSink *sink) {
+    struct AnalyzerGroup *group = sink->userdata;
+    struct GrooveAnalyzerPrivate *a = group->a;
+
+    pthread_mutex_lock(&a->mutex);
+    group->consumed = 0.0;
+    group->ended = 0;
+    pthread_mutex_unlock(&a->mutex);
+
+    for (int i = 0; i < group->plugin_count; i += 1) {
+        struct GrooveAnalyzerPlugin *plugin = group->plugins[i];
+        if (plugin->flush)
+            plugin->flush(plugin);
+    }
+}
+
+static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
+    struct AnalyzerGroup *group = sink->userdata;
+
+    for (int i = 0; i < group->plugin_count; i += 1) {
+        struct GrooveAnalyzerPlugin *plugin = group->plugins[i];
+        if (plugin->purge)
+            plugin->purge(plugin, item);
+    }
+}
+
+struct GrooveAnalyzer *groove_analyzer_create(void) {
+    struct GrooveAnalyzerPrivate *a = av_mallocz(sizeof(struct GrooveAnalyzerPrivate));
+    if (!a) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate analyzer\n");
+        return NULL;
+    }
+
+    struct GrooveAnalyzer *analyzer = &a->externals;
+
+    if (pthread_mutex_init(&a->mutex, NULL) != 0) {
+        groove_analyzer_destroy(analyzer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    a->mutex_inited = 1;
+
+    return analyzer;
+}
+
+void groove_analyzer_destroy(struct GrooveAnalyzer *analyzer) {
+    if (!analyzer)
+        return;
+
+    struct GrooveAnalyzerPrivate *a = (struct GrooveAnalyzerPrivate *) analyzer;
+
+    if (a->mutex_inited)
+        pthread_mutex_destroy(&a->mutex);
+
+    av_free(a->plugins);
+    av_free(a);
+}
+
+int groove_analyzer_add_plugin(struct GrooveAnalyzer *analyzer,
+        struct GrooveAnalyzerPlugin *plugin)
+{
+    struct GrooveAnalyzerPrivate *a = (struct GrooveAnalyzerPrivate *) analyzer;
+
+    if (analyzer->playlist) {
+        av_log(NULL, AV_LOG_ERROR, "cannot add a plugin to an attached analyzer\n");
+        return -1;
+    }
+
+    struct GrooveAnalyzerPlugin **plugins = av_realloc(a->plugins,
+            (a->plugin_count + 1) * sizeof(struct GrooveAnalyzerPlugin *));
+    if (!plugins) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate analyzer plugin\n");
+        return -1;
+    }
+    a->plugins = plugins;
+    a->plugins[a->plugin_count] = plugin;
+    a->plugin_count += 1;
+
+    return 0;
+}
+
+void groove_analyzer_remove_plugin(struct GrooveAnalyzer *analyzer,
+        struct GrooveAnalyzerPlugin *plugin)
+{
+    struct GrooveAnalyzerPrivate *a = (struct GrooveAnalyzerPrivate *) analyzer;
+
+    for (int i = 0; i < a->plugin_count; i += 1) {
+        if (a->plugins[i] == plugin) {
+            a->plugins[i] = a->plugins[a->plugin_count - 1];
+            a->plugin_count -= 1;
+            return;
+        }
+    }
+}
+
+// puts the plugins into groups that share a sink
+static int create_groups(struct GrooveAnalyzerPrivate *a) {
+    a->groups = av_mallocz(a->plugin_count * sizeof(struct AnalyzerGroup));
+    if (!a->groups && a->plugin_count > 0)
+        return -1;
+
+    for (int i = 0; i < a->plugin_count; i += 1) {
+        struct GrooveAnalyzerPlugin *plugin = a->plugins[i];
+        struct AnalyzerGroup *group = NULL;
+        for (int j = 0; j < a->group_count; j += 1) {
+            if (plugins_share_sink(a->groups[j].plugins[0], plugin)) {
+                group = &a->groups[j];
+                break;
+            }
+        }
+
+        if (!group) {
+            group = &a->groups[a->group_count];
+            a->group_count += 1;
+            group->a = a;
+            group->plugins = av_mallocz(a->plugin_count * sizeof(struct GrooveAnalyzerPlugin *));
+            group->sink = groove_sink_create();
+            if (!group->plugins || !group->sink)
+                return -1;
+            group->sink->audio_format = plugin->audio_format;
+            group->sink->disable_resample = plugin->disable_resample;
+            group->sink->disable_gain = plugin->disable_gain;
+            group->sink->userdata = group;
+            group->sink->flush = sink_flush;
+            group->sink->purge = sink_purge;
+        }
+
+        group->plugins[group->plugin_count] = plugin;
+        group->plugin_count += 1;
+        if (plugin->compute_levels)
+            group->sink->compute_levels = 1;
+        if (plugin->buffer_size > group->sink->buffer_size)
+            group->sink->buffer_size = plugin->buffer_size;
+    }
+
+    return 0;
+}
+
+int groove_analyzer_attach(struct GrooveAnalyzer *analyzer,
+        struct GroovePlaylist *playlist)
+{
+    struct GrooveAnalyzerPrivate *a = (struct GrooveAnalyzerPrivate *) analyzer;
+
+    analyzer->playlist = playlist;
+
+    for (int i = 0; i < a->plugin_count; i += 1) {
+        struct GrooveAnalyzerPlugin *plugin = a->plugins[i];
+        if (plugin->attach)
+            plugin->attach(plugin, playlist);
+    }
+
+    if (create_groups(a) < 0) {
+        groove_analyzer_detach(analyzer);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate analyzer sinks\n");
+        return -1;
+    }
+
+    for (int i = 0; i < a->group_count; i += 1) {
+        if (groove_sink_attach(a->groups[i].sink, playlist) < 0) {
+            groove_analyzer_detach(analyzer);
+            av_log(NULL, AV_LOG_ERROR, "unable to attach sink\n");
+            return -1;
+        }
+    }
+
+    if (pthread_create(&a->thread_id, NULL, analyze_thread, analyzer) != 0) {
+        groove_analyzer_detach(analyzer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create analyzer thread\n");
+        return -1;
+    }
+    a->thread_inited = 1;
+
+    return 0;
+}
+
+int groove_analyzer_detach(struct GrooveAnalyzer *analyzer) {
+    struct GrooveAnalyzerPrivate *a = (struct GrooveAnalyzerPrivate *) analyzer;
+
+    pthread_mutex_lock(&a->mutex);
+    a->abort_request = 1;
+    pthread_mutex_unlock(&a->mutex);
+    for (int i = 0; i < a->plugin_count; i += 1) {
+        struct GrooveAnalyzerPlugin *plugin = a->plugins[i];
+        if (plugin->detach)
+            plugin->detach(plugin);
+    }
+    for (int i = 0; i < a->group_count; i += 1) {
+        struct GrooveSink *sink = a->groups[i].sink;
+        if (sink && sink->playlist)
+            groove_sink_detach(sink);
+    }
+    if (a->thread_inited) {
+        pthread_join(a->thread_id, NULL);
+        a->thread_inited = 0;
+    }
+
+    for (int i = 0; i < a->group_count; i += 1) {
+        groove_sink_destroy(a->groups[i].sink);
+        av_free(a->groups[i].plugins);
+    }
+    av_free(a->groups);
+    a->groups = NULL;
+    a->group_count = 0;
+
+    analyzer->playlist = NULL;
+    pthread_mutex_lock(&a->mutex);
+    a->abort_request = 0;
+    pthread_mutex_unlock(&a->mutex);
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_ANALYZER_H_INCLUDED
+#define GROOVE_ANALYZER_H_INCLUDED
+
+#include "groove.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* attach a GrooveAnalyzer to a playlist to run several measurements of the
+ * same audio on one thread. each measurement is a plugin. plugins that want
+ * the same audio format share a sink, and so the conversion to it. the
+ * playlist shares whatever the sinks have in common.
+ * for example, GrooveLoudnessDetector and GrooveFingerprinter can run as
+ * plugins with groove_loudness_detector_attach_analyzer and
+ * groove_fingerprinter_attach_analyzer.
+ */
+
+struct GrooveAnalyzerPlugin {
+    /* the audio format this plugin wants, like the fields of GrooveSink with
+     * the same names
+     */
+    struct GrooveAudioFormat audio_format;
+    int disable_resample;
+    int disable_gain;
+    /* like GrooveSink.compute_levels. set by any plugin of a sink, it
+     * applies to all of them.
+     */
+    int compute_levels;
+    /* how big the sink buffer should be, in sample frames. plugins that
+     * share a sink get the biggest. 0 for the GrooveSink default.
+     */
+    int buffer_size;
+
+    /* set to whatever you want */
+    void *userdata;
+
+    /* called by groove_analyzer_attach before any other callback. optional */
+    void (*attach)(struct GrooveAnalyzerPlugin *, struct GroovePlaylist *);
+    /* called by groove_analyzer_detach before it waits for the analyzer
+     * thread. if buffer can block, this must make it return. optional
+     */
+    void (*detach)(struct GrooveAnalyzerPlugin *);
+    /* called from the analyzer thread with each buffer of the playlist in
+     * audio_format, in order. the buffer is only valid during the call;
+     * ref it to keep it.
+     */
+    void (*buffer)(struct GrooveAnalyzerPlugin *, struct GrooveBuffer *);
+    /* called from the analyzer thread at the end of the playlist. optional */
+    void (*end)(struct GrooveAnalyzerPlugin *);
+    /* called from the playlist like GrooveSink.flush and GrooveSink.purge.
+     * optional
+     */
+    void (*flush)(struct GrooveAnalyzerPlugin *);
+    void (*purge)(struct GrooveAnalyzerPlugin *, struct GroovePlaylistItem *);
+};
+
+struct GrooveAnalyzer {
+    /* read-only. set when attached and cleared when detached */
+    struct GroovePlaylist *playlist;
+};
+
+struct GrooveAnalyzer *groove_analyzer_create(void);
+void groove_analyzer_destroy(struct GrooveAnalyzer *analyzer);
+
+/* plugins can only be added and removed while the analyzer is detached.
+ * the plugin is not copied, so it must stay valid until it is removed.
+ * returns 0 on success, < 0 on error
+ */
+int groove_analyzer_add_plugin(struct GrooveAnalyzer *analyzer,
+        struct GrooveAnalyzerPlugin *plugin);
+void groove_analyzer_remove_plugin(struct GrooveAnalyzer *analyzer,
+        struct GrooveAnalyzerPlugin *plugin);
+
+/* once you attach, you must detach before destroying the playlist */
+int groove_analyzer_attach(struct GrooveAnalyzer *analyzer,
+        struct GroovePlaylist *playlist);
+int groove_analyzer_detach(struct GrooveAnalyzer *analyzer);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_ANALYZER_H_INCLUDED */
@@ -8,6 +8,9 @@
 #include "buffer.h"
 
 #include <libavutil/mem.h>
+#include <libavutil/log.h>
+
+#include <math.h>
 
 void groove_buffer_ref(struct GrooveBuffer *buffer) {
     struct GrooveBufferPrivate *b = (struct GrooveBufferPrivate *) buffer;
@@ -35,6 +38,95 @@ void groove_buffer_unref(struct GrooveBuffer *buffer) {
         } else if (b->frame) {
             av_frame_free(&b->frame);
         }
+        av_free(b->levels);
         av_free(b);
     }
 }
+
+// each of these finds the highest absolute value and the sum of squares of
+// count samples step apart. with step 1, which is planar audio, the
+// compiler can vectorize the loop.
+#define DEFINE_SCAN_LEVELS(name, type, center) \
+static void name(const type *samples, int step, int count, double *peak, double *sum) { \
+    double high = 0.0; \
+    double squares = 0.0; \
+    for (int i = 0; i < count; i += 1) { \
+        double x = (double)samples[i * step] - (center); \
+        double y = fabs(x); \
+        high = (y > high) ? y : high; \
+        squares += x * x; \
+    } \
+    *peak = high; \
+    *sum = squares; \
+}
+
+DEFINE_SCAN_LEVELS(scan_levels_u8, uint8_t, 128)
+DEFINE_SCAN_LEVELS(scan_levels_s16, int16_t, 0)
+DEFINE_SCAN_LEVELS(scan_levels_s32, int32_t, 0)
+DEFINE_SCAN_LEVELS(scan_levels_flt, float, 0)
+DEFINE_SCAN_LEVELS(scan_levels_dbl, double, 0)
+
+int groove_buffer_compute_levels(struct GrooveBuffer *buffer) {
+    struct GrooveBufferPrivate *b = (struct GrooveBufferPrivate *) buffer;
+
+    int channel_count = groove_channel_layout_count(buffer->format.channel_layout);
+    if (channel_count < 1)
+        return -1;
+
+    b->levels = av_malloc(2 * channel_count * sizeof(float));
+    if (!b->levels) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate buffer levels\n");
+        return -1;
+    }
+    float *peak = b->levels;
+    float *rms = b->levels + channel_count;
+
+    enum GrooveSampleFormat fmt = buffer->format.sample_fmt;
+    int planar = fmt >= GROOVE_SAMPLE_FMT_U8P;
+    int step = planar ? 1 : channel_count;
+    int count = buffer->frame_count;
+    for (int c = 0; c < channel_count; c += 1) {
+        const uint8_t *data = planar ? buffer->data[c] : buffer->data[0];
+        int offset = planar ? 0 : c;
+        double high = 0.0;
+        double sum = 0.0;
+        double scale;
+        switch (fmt) {
+            case GROOVE_SAMPLE_FMT_U8:
+            case GROOVE_SAMPLE_FMT_U8P:
+                scan_levels_u8((const uint8_t *)data + offset, step, count, &high, &sum);
+                scale = 1.0 / 128.0;
+                break;
+            case GROOVE_SAMPLE_FMT_S16:
+            case GROOVE_SAMPLE_FMT_S16P:
+                scan_levels_s16((const int16_t *)data + offset, step, count, &high, &sum);
+                scale = 1.0 / 32768.0;
+                break;
+            case GROOVE_SAMPLE_FMT_S32:
+            case GROOVE_SAMPLE_FMT_S32P:
+                scan_levels_s32((const int32_t *)data + offset, step, count, &high, &sum);
+                scale = 1.0 / 2147483648.0;
+                break;
+            case GROOVE_SAMPLE_FMT_FLT:
+            case GROOVE_SAMPLE_FMT_FLTP:
+                scan_levels_flt((const float *)data + offset, step, count, &high, &sum);
+                scale = 1.0;
+                break;
+            case GROOVE_SAMPLE_FMT_DBL:
+            case GROOVE_SAMPLE_FMT_DBLP:
+                scan_levels_dbl((const double *)data + offset, step, count, &high, &sum);
+                scale = 1.0;
+                break;
+            default:
+                av_free(b->levels);
+                b->levels = NULL;
+                return -1;
+        }
+        peak[c] = high * scale;
+        rms[c] = (count > 0) ? sqrt(sum / count) * scale : 0.0;
+    }
+
+    buffer->peak = peak;
+    buffer->rms = rms;
+    return 0;
+}
@@ -24,6 +24,11 @@ struct GrooveBufferPrivate {
     // used for when is_packet is true
     // GrooveBuffer::data[0] will point to this
     uint8_t *data;
+    // GrooveBuffer::peak and GrooveBuffer::rms point into this
+    float *levels;
 };
 
+// sets peak and rms of buffer. returns 0 on success, < 0 on error
+int groove_buffer_compute_levels(struct GrooveBuffer *buffer);
+
 #endif /* GROOVE_BUFFER_H_INCLUDED */
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "cache.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// 64-bit FNV-1a
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i += 1) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int groove_cache_key_init(struct GrooveCacheKey *key, const char *filename,
+        const double *params, int param_count)
+{
+    struct stat st;
+    if (param_count > GROOVE_CACHE_MAX_PARAMS || stat(filename, &st) != 0)
+        return -1;
+
+    key->filename = filename;
+    key->size = st.st_size;
+    key->mtime = st.st_mtime;
+    key->param_count = param_count;
+    memcpy(key->params, params, param_count * sizeof(double));
+
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_bytes(hash, filename, strlen(filename));
+    hash = hash_bytes(hash, &key->size, sizeof(key->size));
+    hash = hash_bytes(hash, &key->mtime, sizeof(key->mtime));
+    hash = hash_bytes(hash, key->params, param_count * sizeof(double));
+    key->hash = hash;
+    return 0;
+}
+
+static char *entry_path(const char *cache_dir, const struct GrooveCacheKey *key,
+        const char *suffix, const char *tmp_suffix)
+{
+    size_t size = strlen(cache_dir) + strlen(suffix) + strlen(tmp_suffix) + 24;
+    char *path = av_malloc(size);
+    if (!path) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate cache path\n");
+        return NULL;
+    }
+    snprintf(path, size, "%s/%016" PRIx64 "%s%s", cache_dir, key->hash, suffix, tmp_suffix);
+    return path;
+}
+
+int groove_cache_write(FILE *f, const void *data, size_t size) {
+    return (fwrite(data, size, 1, f) == 1) ? 0 : -1;
+}
+
+int groove_cache_read(FILE *f, void *data, size_t size) {
+    return (fread(data, size, 1, f) == 1) ? 0 : -1;
+}
+
+static int write_key(FILE *f, const struct GrooveCacheKey *key, const char magic[4],
+        uint32_t version)
+{
+    uint32_t filename_size = strlen(key->filename);
+    if (groove_cache_write(f, magic, 4) ||
+        groove_cache_write(f, &version, sizeof(version)) ||
+        groove_cache_write(f, &filename_size, sizeof(filename_size)) ||
+        groove_cache_write(f, key->filename, filename_size) ||
+        groove_cache_write(f, &key->size, sizeof(key->size)) ||
+        groove_cache_write(f, &key->mtime, sizeof(key->mtime)))
+    {
+        return -1;
+    }
+    for (int i = 0; i < key->param_count; i += 1) {
+        if (groove_cache_write(f, &key->params[i], sizeof(double)))
+            return -1;
+    }
+    return 0;
+}
+
+// returns 1 if f starts with key, stored with magic and version
+static int read_key(FILE *f, const struct GrooveCacheKey *key, const char magic[4],
+        uint32_t version)
+{
+    char entry_magic[4];
+    uint32_t entry_version;
+    uint32_t filename_size;
+    if (groove_cache_read(f, entry_magic, sizeof(entry_magic)) ||
+        memcmp(entry_magic, magic, sizeof(entry_magic)) != 0 ||
+        groove_cache_read(f, &entry_version, sizeof(entry_version)) ||
+        entry_version != version ||
+        groove_cache_read(f, &filename_size, sizeof(filename_size)) ||
+        filename_size != strlen(key->filename))
+    {
+        return 0;
+    }
+
+    char *filename = av_malloc(filename_size + 1);
+    if (!filename)
+        return 0;
+    int same_file = !groove_cache_read(f, filename, filename_size) &&
+        memcmp(filename, key->filename, filename_size) == 0;
+    av_free(filename);
+    if (!same_file)
+        return 0;
+
+    int64_t size;
+    int64_t mtime;
+    if (groove_cache_read(f, &size, sizeof(size)) || size != key->size ||
+        groove_cache_read(f, &mtime, sizeof(mtime)) || mtime != key->mtime)
+    {
+        return 0;
+    }
+    for (int i = 0; i < key->param_count; i += 1) {
+        double param;
+        if (groove_cache_read(f, &param, sizeof(param)) || param != key->params[i])
+            return 0;
+    }
+    return 1;
+}
+
+FILE *groove_cache_open(const char *cache_dir, const struct GrooveCacheKey *key,
+        const char *suffix, const char magic[4], uint32_t version)
+{
+    char *path = entry_path(cache_dir, key, suffix, "");
+    if (!path)
+        return NULL;
+    FILE *f = fopen(path, "rb");
+    av_free(path);
+    if (!f)
+        return NULL;
+
+    if (!read_key(f, key, magic, version)) {
+        fclose(f);
+        return NULL;
+    }
+    return f;
+}
+
+int groove_cache_store(const char *cache_dir, const struct GrooveCacheKey *key,
+        const char *suffix, const char magic[4], uint32_t version,
+        int (*write_entry)(FILE *f, void *context), void *context)
+{
+    char *path = entry_path(cache_dir, key, suffix, "");
+    char *tmp_path = entry_path(cache_dir, key, suffix, ".XXXXXX");
+    if (!path || !tmp_path) {
+        av_free(path);
+        av_free(tmp_path);
+        return -1;
+    }
+
+    int fd = mkstemp(tmp_path);
+    FILE *f = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+    if (fd >= 0 && !f)
+        close(fd);
+    int err = !f;
+    if (f) {
+        err = write_key(f, key, magic, version) || write_entry(f, context);
+        if (fclose(f) != 0)
+            err = -1;
+    }
+    if (!err && rename(tmp_path, path) != 0)
+        err = -1;
+    if (err) {
+        av_log(NULL, AV_LOG_WARNING, "unable to write cache entry %s\n", path);
+        if (fd >= 0)
+            remove(tmp_path);
+    }
+
+    av_free(path);
+    av_free(tmp_path);
+    return err ? -1 : 0;
+}
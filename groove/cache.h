@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_CACHE_H_INCLUDED
+#define GROOVE_CACHE_H_INCLUDED
+
+#include <stdint.h>
+#include <stdio.h>
+
+// analyzers that keep their results in a cache directory store one file
+// per entry, named after a hash of the file analyzed and the settings it
+// was analyzed with. each entry starts with the key itself, so that a hash
+// collision or a changed file is noticed when it is read.
+// like queue.h this is installed for the other groove libraries, such as
+// grooveloudness, which build against an installed libgroove.
+
+#define GROOVE_CACHE_MAX_PARAMS 4
+
+// identifies a file and the settings its results depend on
+struct GrooveCacheKey {
+    const char *filename;
+    int64_t size;
+    int64_t mtime;
+    double params[GROOVE_CACHE_MAX_PARAMS];
+    int param_count;
+    uint64_t hash;
+};
+
+// filename is not copied. returns 0 on success, < 0 if the file cannot be
+// found
+int groove_cache_key_init(struct GrooveCacheKey *key, const char *filename,
+        const double *params, int param_count);
+
+// opens the entry of key for reading. the entry is named after the hash
+// followed by suffix, and must have been stored with magic and version.
+// returns the file positioned after the key, or NULL if there is no such
+// entry
+FILE *groove_cache_open(const char *cache_dir, const struct GrooveCacheKey *key,
+        const char *suffix, const char magic[4], uint32_t version);
+
+// stores the entry of key. write_entry is called to write the results after the
+// key and returns 0 on success, < 0 on error. the entry is written to a
+// temporary file from mkstemp and then renamed, so that readers never see
+// half of an entry, even from other processes.
+// returns 0 on success, < 0 on error
+int groove_cache_store(const char *cache_dir, const struct GrooveCacheKey *key,
+        const char *suffix, const char magic[4], uint32_t version,
+        int (*write_entry)(FILE *f, void *context), void *context);
+
+// return 0 on success, < 0 on error or end of file
+int groove_cache_write(FILE *f, const void *data, size_t size);
+int groove_cache_read(FILE *f, void *data, size_t size);
+
+#endif /* GROOVE_CACHE_H_INCLUDED */
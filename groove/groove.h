@@ -35,14 +35,56 @@ void groove_finish(void);
 void groove_set_logging(int level);
 
 
-/* channel layouts
+/* channel layouts. a layout is the channels it has, or'd together. the
+ * channels of a buffer are in the order of these values.
  */
-#define GROOVE_CH_FRONT_LEFT       0x00000001
-#define GROOVE_CH_FRONT_RIGHT      0x00000002
-#define GROOVE_CH_FRONT_CENTER     0x00000004
-
-#define GROOVE_CH_LAYOUT_MONO      (GROOVE_CH_FRONT_CENTER)
-#define GROOVE_CH_LAYOUT_STEREO    (GROOVE_CH_FRONT_LEFT|GROOVE_CH_FRONT_RIGHT)
+#define GROOVE_CH_FRONT_LEFT             0x00000001ULL
+#define GROOVE_CH_FRONT_RIGHT            0x00000002ULL
+#define GROOVE_CH_FRONT_CENTER           0x00000004ULL
+#define GROOVE_CH_LOW_FREQUENCY          0x00000008ULL
+#define GROOVE_CH_BACK_LEFT              0x00000010ULL
+#define GROOVE_CH_BACK_RIGHT             0x00000020ULL
+#define GROOVE_CH_FRONT_LEFT_OF_CENTER   0x00000040ULL
+#define GROOVE_CH_FRONT_RIGHT_OF_CENTER  0x00000080ULL
+#define GROOVE_CH_BACK_CENTER            0x00000100ULL
+#define GROOVE_CH_SIDE_LEFT              0x00000200ULL
+#define GROOVE_CH_SIDE_RIGHT             0x00000400ULL
+#define GROOVE_CH_TOP_CENTER             0x00000800ULL
+#define GROOVE_CH_TOP_FRONT_LEFT         0x00001000ULL
+#define GROOVE_CH_TOP_FRONT_CENTER       0x00002000ULL
+#define GROOVE_CH_TOP_FRONT_RIGHT        0x00004000ULL
+#define GROOVE_CH_TOP_BACK_LEFT          0x00008000ULL
+#define GROOVE_CH_TOP_BACK_CENTER        0x00010000ULL
+#define GROOVE_CH_TOP_BACK_RIGHT         0x00020000ULL
+/* stereo downmixed to be decoded back to surround (Lt/Rt) */
+#define GROOVE_CH_STEREO_LEFT            0x20000000ULL
+#define GROOVE_CH_STEREO_RIGHT           0x40000000ULL
+#define GROOVE_CH_WIDE_LEFT              0x80000000ULL
+#define GROOVE_CH_WIDE_RIGHT             0x100000000ULL
+#define GROOVE_CH_SURROUND_DIRECT_LEFT   0x200000000ULL
+#define GROOVE_CH_SURROUND_DIRECT_RIGHT  0x400000000ULL
+#define GROOVE_CH_LOW_FREQUENCY_2        0x800000000ULL
+
+#define GROOVE_CH_LAYOUT_MONO            (GROOVE_CH_FRONT_CENTER)
+#define GROOVE_CH_LAYOUT_STEREO          (GROOVE_CH_FRONT_LEFT|GROOVE_CH_FRONT_RIGHT)
+#define GROOVE_CH_LAYOUT_2POINT1         (GROOVE_CH_LAYOUT_STEREO|GROOVE_CH_LOW_FREQUENCY)
+#define GROOVE_CH_LAYOUT_2_1             (GROOVE_CH_LAYOUT_STEREO|GROOVE_CH_BACK_CENTER)
+#define GROOVE_CH_LAYOUT_SURROUND        (GROOVE_CH_LAYOUT_STEREO|GROOVE_CH_FRONT_CENTER)
+#define GROOVE_CH_LAYOUT_3POINT1         (GROOVE_CH_LAYOUT_SURROUND|GROOVE_CH_LOW_FREQUENCY)
+#define GROOVE_CH_LAYOUT_4POINT0         (GROOVE_CH_LAYOUT_SURROUND|GROOVE_CH_BACK_CENTER)
+#define GROOVE_CH_LAYOUT_4POINT1         (GROOVE_CH_LAYOUT_4POINT0|GROOVE_CH_LOW_FREQUENCY)
+#define GROOVE_CH_LAYOUT_2_2             (GROOVE_CH_LAYOUT_STEREO|GROOVE_CH_SIDE_LEFT|GROOVE_CH_SIDE_RIGHT)
+#define GROOVE_CH_LAYOUT_QUAD            (GROOVE_CH_LAYOUT_STEREO|GROOVE_CH_BACK_LEFT|GROOVE_CH_BACK_RIGHT)
+#define GROOVE_CH_LAYOUT_5POINT0         (GROOVE_CH_LAYOUT_SURROUND|GROOVE_CH_SIDE_LEFT|GROOVE_CH_SIDE_RIGHT)
+#define GROOVE_CH_LAYOUT_5POINT1         (GROOVE_CH_LAYOUT_5POINT0|GROOVE_CH_LOW_FREQUENCY)
+#define GROOVE_CH_LAYOUT_5POINT0_BACK    (GROOVE_CH_LAYOUT_SURROUND|GROOVE_CH_BACK_LEFT|GROOVE_CH_BACK_RIGHT)
+#define GROOVE_CH_LAYOUT_5POINT1_BACK    (GROOVE_CH_LAYOUT_5POINT0_BACK|GROOVE_CH_LOW_FREQUENCY)
+#define GROOVE_CH_LAYOUT_6POINT0         (GROOVE_CH_LAYOUT_5POINT0|GROOVE_CH_BACK_CENTER)
+#define GROOVE_CH_LAYOUT_6POINT1         (GROOVE_CH_LAYOUT_5POINT1|GROOVE_CH_BACK_CENTER)
+#define GROOVE_CH_LAYOUT_7POINT0         (GROOVE_CH_LAYOUT_5POINT0|GROOVE_CH_BACK_LEFT|GROOVE_CH_BACK_RIGHT)
+#define GROOVE_CH_LAYOUT_7POINT1         (GROOVE_CH_LAYOUT_5POINT1|GROOVE_CH_BACK_LEFT|GROOVE_CH_BACK_RIGHT)
+#define GROOVE_CH_LAYOUT_7POINT1_WIDE    (GROOVE_CH_LAYOUT_5POINT1|GROOVE_CH_FRONT_LEFT_OF_CENTER|GROOVE_CH_FRONT_RIGHT_OF_CENTER)
+#define GROOVE_CH_LAYOUT_STEREO_DOWNMIX  (GROOVE_CH_STEREO_LEFT|GROOVE_CH_STEREO_RIGHT)
 
 /* get the channel count for the channel layout
  */
@@ -165,6 +207,14 @@ struct GroovePlaylistItem {
      */
     struct GroovePlaylistItem *prev;
     struct GroovePlaylistItem *next;
+
+    /* Where in the file playback starts and ends, in seconds. Audio outside
+     * of them is not decoded or sent to any sink. trim_end of 0 means the
+     * end of the file. Both default to 0. Set them with
+     * groove_playlist_set_item_trim.
+     */
+    double trim_start;
+    double trim_end;
 };
 
 struct GroovePlaylist {
@@ -243,6 +293,85 @@ void groove_playlist_set_item_gain(struct GroovePlaylist *playlist,
 void groove_playlist_set_item_peak(struct GroovePlaylist *playlist,
         struct GroovePlaylistItem *item, double peak);
 
+/* plays item from start to end seconds into its file instead of all of it.
+ * pass 0 for end to play to the end of the file. if item is being decoded,
+ * decoding skips ahead to start if it has not reached it yet, and stops at
+ * end if it has not passed it yet.
+ */
+void groove_playlist_set_item_trim(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item, double start, double end);
+
+/* stops decoding item and moves on to the next item as if item had ended,
+ * but only if item is the item being decoded. audio of item that was
+ * already decoded stays in the sinks. this cuts item short for every sink,
+ * so it is meant for playlists that only feed analysis sinks.
+ * item is only compared, not dereferenced, unless it is being decoded, so
+ * you may pass an item that another thread might have removed meanwhile.
+ * returns 1 if item was skipped, 0 if item is not being decoded.
+ */
+int groove_playlist_skip_item(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item);
+
+/* sets both the gain and the peak of item, but only if item is the item
+ * being decoded. this is for adjusting the gain of audio while it is being
+ * decoded, for example from a sink that measures its loudness.
+ * the gain moves to the new value by 6 dB per second without rebuilding the
+ * filter graph, so that the change is not heard as a step. a gain that
+ * could clip given the new peak rebuilds the graph instead, which applies
+ * it at once and limits it like any other gain above 1.0.
+ * item is only compared, not dereferenced, unless it is being decoded, so
+ * you may pass an item that another thread might have removed meanwhile.
+ * returns 1 if the gain was set, 0 if item is not being decoded.
+ */
+int groove_playlist_set_decode_gain(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item, double gain, double peak);
+
+/* like groove_playlist_set_item_trim, but only if item is still in the
+ * playlist, for sinks that find out where to trim the audio they receive.
+ * if the decoder has already moved past item, the trim applies the next
+ * time item is decoded. item is only compared, not dereferenced, unless it
+ * is in the playlist, so you may pass an item that another thread might
+ * have removed meanwhile.
+ * returns 1 if the trim was set, 0 if item is not in the playlist.
+ */
+int groove_playlist_set_decode_trim(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item, double start, double end);
+
+/* when surround audio goes to sinks that all want stereo or mono, the
+ * playlist downmixes it once, before the audio is split up for the sinks.
+ * these are the levels that the center, the surround and the LFE channels
+ * are mixed into the front left and right channels with. a mono downmix is
+ * the average of the stereo one.
+ * the levels of each output channel are then scaled down together when
+ * they add up to more than 1, so that the downmix cannot clip. a 5.1
+ * downmix with the defaults is therefore about 7.7 dB quieter than its
+ * front channels alone.
+ * the defaults follow ITU-R BS.775: 0.7071 (-3 dB) for center and
+ * surround, and 0 for LFE, which leaves it out.
+ */
+void groove_playlist_set_downmix(struct GroovePlaylist *playlist,
+        double center_level, double surround_level, double lfe_level);
+
+/* the outgoing item fades out along a quarter cosine while the incoming one
+ * fades in along a quarter sine, so that the power stays the same */
+#define GROOVE_CROSSFADE_EQUAL_POWER 0
+/* both items fade linearly */
+#define GROOVE_CROSSFADE_LINEAR      1
+
+/* overlap the last seconds of each item, up to its trim_end, with the start
+ * of the next item, using one of the GROOVE_CROSSFADE_* curves.
+ * the playlist decodes both items and mixes them before the audio is split
+ * up for the sinks, so sinks receive a single stream, in which the buffers
+ * of the overlap belong to the outgoing item.
+ * a fade is not done when the next item plays the same file, or while the
+ * outgoing item has a gain of 0. it is dropped when the playlist is
+ * changed, seeked or skipped during it, and the next item then starts over
+ * from its trim_start.
+ * 0 seconds turns crossfading off, which is the default.
+ */
+void groove_playlist_set_crossfade(struct GroovePlaylist *playlist,
+        double seconds, int curve);
+
 /* This is the default behavior. The playlist will decode audio if any sinks
  * are not full. If any sinks do not drain fast enough the data will buffer up
  * in the playlist.
@@ -290,6 +419,14 @@ struct GrooveBuffer {
 
     /* presentation time stamp of the buffer */
     uint64_t pts;
+
+    /* the peak and RMS of each channel in float format, one value per
+     * channel in channel layout order. NULL unless a sink that gets this
+     * buffer has compute_levels set. read these instead of scanning the
+     * samples again.
+     */
+    const float *peak;
+    const float *rms;
 };
 
 void groove_buffer_ref(struct GrooveBuffer *buffer);
@@ -303,7 +440,11 @@ void groove_buffer_unref(struct GrooveBuffer *buffer);
  */
 
 struct GrooveSink {
-    /* set this to the audio format you want the sink to output */
+    /* set this to the audio format you want the sink to output.
+     * set channel_layout to 0 to get the channel layout of each file as it
+     * is, converting only the sample format and rate. buffer_size is then
+     * counted as if the audio was stereo.
+     */
     struct GrooveAudioFormat audio_format;
     /* Set this flag to ignore audio_format. If you set this flag, the
      * buffers you pull from this sink could have any audio format.
@@ -354,6 +495,20 @@ struct GrooveSink {
      * groove_sink_attach
      */
     int bytes_per_sec;
+
+    /* Set this flag to receive audio without the gain of the playlist and
+     * of the playlist item applied. The gain property of this sink still
+     * applies. This is for sinks that measure the audio, so that what they
+     * measure does not change when the gain does.
+     */
+    int disable_gain;
+
+    /* Set this flag to have the decode thread compute the peak and rms of
+     * each buffer. Sinks with the same audio format get the same buffers,
+     * so the levels are computed once for all of them, and sinks without
+     * this flag may get them too.
+     */
+    int compute_levels;
 };
 
 struct GrooveSink *groove_sink_create(void);
@@ -385,6 +540,15 @@ int groove_sink_buffer_peek(struct GrooveSink *sink, int block);
  */
 int groove_sink_set_gain(struct GrooveSink *sink, double gain);
 
+/* makes the sink call wake whenever a buffer or the end of the playlist is
+ * put in its queue, so that a thread which takes buffers without blocking
+ * can sleep until there is one. wake is called from the decode thread with
+ * the queue locked: it must not call other sink functions or take a lock
+ * that is held while calling them. pass NULL to turn it off.
+ * set it before calling groove_sink_attach.
+ */
+void groove_sink_set_wake(struct GrooveSink *sink, void (*wake)(struct GrooveSink *));
+
 
 #ifdef __cplusplus
 }
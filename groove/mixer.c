@@ -0,0 +1,604 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "mixer.h"
+#include "playlist.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+#include <libavutil/frame.h>
+#include <libavutil/channel_layout.h>
+
+#include <string.h>
+#include <pthread.h>
+
+struct MixerInput {
+    struct GrooveMixerPrivate *m;
+    struct GroovePlaylist *playlist;
+    struct GrooveSink *sink;
+
+    // mutex applies to all of the fields below.
+    // buffers taken from the sink and not mixed yet. offset sample frames
+    // of the first one were mixed already, available is what is left.
+    struct GrooveBuffer **pending;
+    int pending_count;
+    int pending_size;
+    int offset;
+    int available;
+    // 1 when the sink reached the end of the playlist, until it has audio
+    // again. the sink is then not waited on.
+    int ended;
+    // whether this input has audio in the mix being made
+    int active;
+    // an item purged while a buffer was taken from the sink
+    struct GroovePlaylistItem *purged_item;
+
+    // gain moves by gain_step per sample frame for gain_frames sample frames
+    double gain;
+    double gain_target;
+    double gain_step;
+    int64_t gain_frames;
+
+    // the duck factor moves between duck_gain and 1.0 while input duck_key
+    // is active, or -1
+    int duck_key;
+    double duck_gain;
+    double duck_attack_step;
+    double duck_release_step;
+    double duck;
+};
+
+struct GrooveMixerPrivate {
+    struct GrooveMixer externals;
+
+    struct MixerInput *inputs;
+    int input_count;
+
+    pthread_mutex_t mutex;
+    char mutex_inited;
+    // mixer_thread waits on this while every input is at its end. woken is
+    // set when an input sink gets audio, and cleared before gathering.
+    pthread_cond_t wake_cond;
+    char wake_cond_inited;
+    int woken;
+    pthread_t thread_id;
+    char thread_inited;
+    int abort_request;
+
+    // copies of the settings taken when attaching
+    int sample_rate;
+    uint64_t channel_layout;
+    int channel_count;
+    int buffer_sample_count;
+
+    // only touched by mixer_thread
+    AVFrame *frame;
+    float *gains;
+    int64_t pts;
+    int sent_end;
+};
+
+// adds frames sample frames of src, weighted by gain per sample frame, to dst
+static void mix_add(float *dst, const float *src, const float *gain,
+        int frames, int channels)
+{
+    for (int i = 0; i < frames; i += 1) {
+        for (int c = 0; c < channels; c += 1)
+            dst[i * channels + c] += src[i * channels + c] * gain[i];
+    }
+}
+
+// mutex must be held
+static void drop_first_pending(struct MixerInput *in) {
+    groove_buffer_unref(in->pending[0]);
+    in->pending_count -= 1;
+    memmove(in->pending, in->pending + 1, in->pending_count * sizeof(struct GrooveBuffer *));
+    in->offset = 0;
+}
+
+// mutex must be held
+static void clear_pending(struct MixerInput *in) {
+    while (in->pending_count > 0)
+        drop_first_pending(in);
+    in->available = 0;
+}
+
+// mutex must be held
+static int append_pending(struct MixerInput *in, struct GrooveBuffer *buffer) {
+    if (in->pending_count >= in->pending_size) {
+        int size = in->pending_size ? 2 * in->pending_size : 4;
+        struct GrooveBuffer **pending = av_realloc(in->pending,
+                size * sizeof(struct GrooveBuffer *));
+        if (!pending)
+            return -1;
+        in->pending = pending;
+        in->pending_size = size;
+    }
+    in->pending[in->pending_count] = buffer;
+    in->pending_count += 1;
+    in->available += buffer->frame_count;
+    return 0;
+}
+
+// takes buffers from the sink of in until it has audio for a whole mix.
+// waits for them unless the input is at its end.
+// returns < 0 when aborted
+static int gather(struct GrooveMixerPrivate *m, struct MixerInput *in) {
+    for (;;) {
+        pthread_mutex_lock(&m->mutex);
+        int enough = (in->available >= m->buffer_sample_count);
+        int block = !in->ended;
+        in->purged_item = NULL;
+        pthread_mutex_unlock(&m->mutex);
+        if (enough)
+            return 0;
+
+        struct GrooveBuffer *buffer;
+        int result = groove_sink_buffer_get(in->sink, &buffer, block);
+        if (result == GROOVE_BUFFER_NO)
+            return block ? -1 : 0;
+
+        pthread_mutex_lock(&m->mutex);
+        if (result == GROOVE_BUFFER_END) {
+            in->ended = 1;
+        } else if (buffer->item == in->purged_item) {
+            groove_buffer_unref(buffer);
+        } else if (append_pending(in, buffer) < 0) {
+            groove_buffer_unref(buffer);
+            av_log(NULL, AV_LOG_ERROR, "unable to queue mixer input: out of memory\n");
+        } else {
+            in->ended = 0;
+        }
+        pthread_mutex_unlock(&m->mutex);
+
+        if (result == GROOVE_BUFFER_END)
+            return 0;
+    }
+}
+
+// works out the gain of in for each sample frame of the next mix into gains
+// mutex must be held
+static void input_gains(struct GrooveMixerPrivate *m, struct MixerInput *in,
+        float *gains, int frames)
+{
+    int ducked = (in->duck_key >= 0 && m->inputs[in->duck_key].active);
+    for (int i = 0; i < frames; i += 1) {
+        if (in->gain_frames > 0) {
+            in->gain_frames -= 1;
+            in->gain = (in->gain_frames > 0) ? in->gain + in->gain_step : in->gain_target;
+        }
+        if (ducked) {
+            in->duck -= in->duck_attack_step;
+            if (in->duck < in->duck_gain)
+                in->duck = in->duck_gain;
+        } else if (in->duck < 1.0) {
+            in->duck += in->duck_release_step;
+            if (in->duck > 1.0)
+                in->duck = 1.0;
+        }
+        gains[i] = in->gain * in->duck;
+    }
+}
+
+// adds the next frames sample frames of in to dst
+// mutex must be held
+static void mix_input(struct GrooveMixerPrivate *m, struct MixerInput *in,
+        float *dst, const float *gains, int frames)
+{
+    int done = 0;
+    while (done < frames && in->pending_count > 0) {
+        struct GrooveBuffer *buffer = in->pending[0];
+        int count = buffer->frame_count - in->offset;
+        if (count > frames - done)
+            count = frames - done;
+        const float *src = (const float *) buffer->data[0] + in->offset * m->channel_count;
+        mix_add(dst + done * m->channel_count, src, gains + done, count, m->channel_count);
+        done += count;
+        in->offset += count;
+        in->available -= count;
+        if (in->offset >= buffer->frame_count)
+            drop_first_pending(in);
+    }
+}
+
+// mixes one buffer_sample_count of every input and sends it to the sinks of
+// the playlist of the mixer.
+// returns 0 if there was nothing to mix, 1 if it was sent, < 0 on error
+static int mix(struct GrooveMixerPrivate *m) {
+    struct GrooveMixer *mixer = &m->externals;
+    int frames = m->buffer_sample_count;
+
+    AVFrame *frame = m->frame;
+    av_frame_unref(frame);
+    frame->format = AV_SAMPLE_FMT_FLT;
+    frame->channel_layout = m->channel_layout;
+    frame->sample_rate = m->sample_rate;
+    frame->nb_samples = frames;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate mix: out of memory\n");
+        return -1;
+    }
+    float *dst = (float *) frame->data[0];
+    memset(dst, 0, frames * m->channel_count * sizeof(float));
+
+    pthread_mutex_lock(&m->mutex);
+
+    // the buffers of the mix belong to the first input that has audio
+    struct GrooveBuffer *label = NULL;
+    double label_pos = 0.0;
+    for (int i = 0; i < m->input_count; i += 1) {
+        struct MixerInput *in = &m->inputs[i];
+        in->active = (in->available > 0);
+        if (in->active && !label) {
+            label = in->pending[0];
+            label_pos = label->pos + in->offset / (double)m->sample_rate;
+        }
+    }
+    if (!label) {
+        pthread_mutex_unlock(&m->mutex);
+        return 0;
+    }
+
+    for (int i = 0; i < m->input_count; i += 1) {
+        struct MixerInput *in = &m->inputs[i];
+        input_gains(m, in, m->gains, frames);
+        mix_input(m, in, dst, m->gains, frames);
+    }
+
+    frame->pts = m->pts;
+    m->pts += frames;
+    AVRational time_base = {1, m->sample_rate};
+    // sent with the mutex held, so that a purge of the item of label
+    // happens either before the mix or after these buffers are in the sinks
+    int err = groove_playlist_send_frame(mixer->playlist, frame, time_base,
+            label->item, label_pos);
+
+    pthread_mutex_unlock(&m->mutex);
+
+    return (err < 0) ? err : 1;
+}
+
+static void *mixer_thread(void *arg) {
+    struct GrooveMixerPrivate *m = arg;
+    struct GrooveMixer *mixer = &m->externals;
+
+    while (!m->abort_request) {
+        if (groove_playlist_wait_sinks(mixer->playlist) < 0)
+            break;
+
+        pthread_mutex_lock(&m->mutex);
+        m->woken = 0;
+        pthread_mutex_unlock(&m->mutex);
+
+        int aborted = 0;
+        for (int i = 0; i < m->input_count && !aborted; i += 1)
+            aborted = (gather(m, &m->inputs[i]) < 0);
+        if (aborted)
+            break;
+
+        int result = mix(m);
+        if (result < 0)
+            break;
+        if (result > 0) {
+            m->sent_end = 0;
+            continue;
+        }
+
+        // every input is at its end
+        if (!m->sent_end) {
+            groove_playlist_send_end(mixer->playlist);
+            m->sent_end = 1;
+        }
+        pthread_mutex_lock(&m->mutex);
+        while (!m->woken && !m->abort_request)
+            pthread_cond_wait(&m->wake_cond, &m->mutex);
+        pthread_mutex_unlock(&m->mutex);
+    }
+
+    return NULL;
+}
+
+// called by the queue of an input sink when it gets audio
+static void sink_wake(struct GrooveSink *sink) {
+    struct MixerInput *in = sink->userdata;
+    struct GrooveMixerPrivate *m = in->m;
+
+    pthread_mutex_lock(&m->mutex);
+    m->woken = 1;
+    pthread_cond_signal(&m->wake_cond);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+static void sink_flush(struct GrooveSink *sink) {
+    struct MixerInput *in = sink->userdata;
+    struct GrooveMixerPrivate *m = in->m;
+
+    pthread_mutex_lock(&m->mutex);
+    clear_pending(in);
+    in->ended = 0;
+    pthread_mutex_unlock(&m->mutex);
+
+    // what was mixed already would delay the seek until it is played
+    groove_playlist_send_flush(m->externals.playlist);
+}
+
+static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
+    struct MixerInput *in = sink->userdata;
+    struct GrooveMixerPrivate *m = in->m;
+
+    pthread_mutex_lock(&m->mutex);
+    int kept = 0;
+    for (int i = 0; i < in->pending_count; i += 1) {
+        struct GrooveBuffer *buffer = in->pending[i];
+        if (buffer->item == item) {
+            if (i == 0)
+                in->offset = 0;
+            groove_buffer_unref(buffer);
+        } else {
+            in->pending[kept] = buffer;
+            kept += 1;
+        }
+    }
+    in->pending_count = kept;
+    in->available = -in->offset;
+    for (int i = 0; i < in->pending_count; i += 1)
+        in->available += in->pending[i]->frame_count;
+    in->purged_item = item;
+    pthread_mutex_unlock(&m->mutex);
+
+    groove_playlist_send_purge(m->externals.playlist, item);
+}
+
+struct GrooveMixer *groove_mixer_create(void) {
+    struct GrooveMixerPrivate *m = av_mallocz(sizeof(struct GrooveMixerPrivate));
+    if (!m) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate mixer\n");
+        return NULL;
+    }
+
+    struct GrooveMixer *mixer = &m->externals;
+
+    if (pthread_mutex_init(&m->mutex, NULL) != 0) {
+        groove_mixer_destroy(mixer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    m->mutex_inited = 1;
+
+    if (pthread_cond_init(&m->wake_cond, NULL) != 0) {
+        groove_mixer_destroy(mixer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mixer condition\n");
+        return NULL;
+    }
+    m->wake_cond_inited = 1;
+
+    mixer->playlist = groove_playlist_create();
+    if (!mixer->playlist) {
+        groove_mixer_destroy(mixer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mixer playlist\n");
+        return NULL;
+    }
+
+    // set some defaults
+    mixer->sample_rate = 44100;
+    mixer->channel_layout = GROOVE_CH_LAYOUT_STEREO;
+    mixer->buffer_sample_count = 1024;
+    mixer->sink_buffer_size = 8192;
+
+    return mixer;
+}
+
+void groove_mixer_destroy(struct GrooveMixer *mixer) {
+    if (!mixer)
+        return;
+
+    struct GrooveMixerPrivate *m = (struct GrooveMixerPrivate *) mixer;
+
+    if (mixer->playlist)
+        groove_playlist_destroy(mixer->playlist);
+
+    av_free(m->inputs);
+
+    if (m->mutex_inited)
+        pthread_mutex_destroy(&m->mutex);
+
+    if (m->wake_cond_inited)
+        pthread_cond_destroy(&m->wake_cond);
+
+    av_free(m);
+}
+
+int groove_mixer_add_input(struct GrooveMixer *mixer, struct GroovePlaylist *input) {
+    struct GrooveMixerPrivate *m = (struct GrooveMixerPrivate *) mixer;
+
+    if (m->thread_inited) {
+        av_log(NULL, AV_LOG_ERROR, "cannot add mixer input while attached\n");
+        return -1;
+    }
+
+    struct MixerInput *inputs = av_realloc(m->inputs,
+            (m->input_count + 1) * sizeof(struct MixerInput));
+    if (!inputs) {
+        av_log(NULL, AV_LOG_ERROR, "unable to add mixer input: out of memory\n");
+        return -1;
+    }
+    m->inputs = inputs;
+
+    struct MixerInput *in = &m->inputs[m->input_count];
+    memset(in, 0, sizeof(struct MixerInput));
+    in->m = m;
+    in->playlist = input;
+    in->gain = 1.0;
+    in->gain_target = 1.0;
+    in->duck_key = -1;
+    in->duck_gain = 1.0;
+    in->duck = 1.0;
+
+    m->input_count += 1;
+    return m->input_count - 1;
+}
+
+int groove_mixer_attach(struct GrooveMixer *mixer) {
+    struct GrooveMixerPrivate *m = (struct GrooveMixerPrivate *) mixer;
+
+    m->channel_count = av_get_channel_layout_nb_channels(mixer->channel_layout);
+    if (m->input_count == 0 || mixer->sample_rate <= 0 || m->channel_count <= 0 ||
+        mixer->buffer_sample_count <= 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "invalid mixer settings\n");
+        return -1;
+    }
+    m->sample_rate = mixer->sample_rate;
+    m->channel_layout = mixer->channel_layout;
+    m->buffer_sample_count = mixer->buffer_sample_count;
+    m->pts = 0;
+    m->sent_end = 0;
+    m->abort_request = 0;
+
+    m->frame = av_frame_alloc();
+    m->gains = av_malloc(m->buffer_sample_count * sizeof(float));
+    if (!m->frame || !m->gains) {
+        groove_mixer_detach(mixer);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate mixer\n");
+        return -1;
+    }
+
+    for (int i = 0; i < m->input_count; i += 1) {
+        struct MixerInput *in = &m->inputs[i];
+        // an input is waited on once it has audio. its playlist may be
+        // empty, and then it does not say so until something has played.
+        in->ended = 1;
+        in->active = 0;
+
+        in->sink = groove_sink_create();
+        if (!in->sink) {
+            groove_mixer_detach(mixer);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate sink\n");
+            return -1;
+        }
+        in->sink->audio_format.sample_rate = m->sample_rate;
+        in->sink->audio_format.channel_layout = m->channel_layout;
+        in->sink->audio_format.sample_fmt = GROOVE_SAMPLE_FMT_FLT;
+        in->sink->buffer_size = mixer->sink_buffer_size;
+        in->sink->userdata = in;
+        in->sink->flush = sink_flush;
+        in->sink->purge = sink_purge;
+        groove_sink_set_wake(in->sink, sink_wake);
+
+        if (groove_sink_attach(in->sink, in->playlist) < 0) {
+            groove_mixer_detach(mixer);
+            av_log(NULL, AV_LOG_ERROR, "unable to attach sink\n");
+            return -1;
+        }
+    }
+
+    groove_playlist_abort_wait(mixer->playlist, 0);
+
+    if (pthread_create(&m->thread_id, NULL, mixer_thread, m) != 0) {
+        groove_mixer_detach(mixer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mixer thread\n");
+        return -1;
+    }
+    m->thread_inited = 1;
+
+    return 0;
+}
+
+int groove_mixer_detach(struct GrooveMixer *mixer) {
+    struct GrooveMixerPrivate *m = (struct GrooveMixerPrivate *) mixer;
+
+    pthread_mutex_lock(&m->mutex);
+    m->abort_request = 1;
+    pthread_cond_signal(&m->wake_cond);
+    pthread_mutex_unlock(&m->mutex);
+    groove_playlist_abort_wait(mixer->playlist, 1);
+    for (int i = 0; i < m->input_count; i += 1) {
+        struct MixerInput *in = &m->inputs[i];
+        if (in->sink && in->sink->playlist)
+            groove_sink_detach(in->sink);
+    }
+    if (m->thread_inited) {
+        pthread_join(m->thread_id, NULL);
+        m->thread_inited = 0;
+    }
+
+    for (int i = 0; i < m->input_count; i += 1) {
+        struct MixerInput *in = &m->inputs[i];
+        clear_pending(in);
+        av_freep(&in->pending);
+        in->pending_size = 0;
+        if (in->sink) {
+            groove_sink_destroy(in->sink);
+            in->sink = NULL;
+        }
+    }
+
+    av_frame_free(&m->frame);
+    av_freep(&m->gains);
+    m->abort_request = 0;
+
+    return 0;
+}
+
+// the rate the inputs are mixed at: the copy taken when attaching, or the
+// setting until the mixer is first attached
+// mutex must be held
+static int ramp_sample_rate(struct GrooveMixerPrivate *m) {
+    return m->sample_rate ? m->sample_rate : m->externals.sample_rate;
+}
+
+int groove_mixer_set_gain(struct GrooveMixer *mixer, int index, double gain,
+        double seconds)
+{
+    struct GrooveMixerPrivate *m = (struct GrooveMixerPrivate *) mixer;
+
+    if (index < 0 || index >= m->input_count)
+        return -1;
+
+    struct MixerInput *in = &m->inputs[index];
+
+    pthread_mutex_lock(&m->mutex);
+    int64_t frames = seconds * ramp_sample_rate(m);
+    in->gain_target = gain;
+    if (frames < 1) {
+        in->gain = gain;
+        in->gain_frames = 0;
+    } else {
+        in->gain_step = (gain - in->gain) / frames;
+        in->gain_frames = frames;
+    }
+    pthread_mutex_unlock(&m->mutex);
+
+    return 0;
+}
+
+int groove_mixer_set_ducking(struct GrooveMixer *mixer, int index, int key,
+        double duck_gain, double attack, double release)
+{
+    struct GrooveMixerPrivate *m = (struct GrooveMixerPrivate *) mixer;
+
+    if (index < 0 || index >= m->input_count || key < -1 || key >= m->input_count)
+        return -1;
+
+    struct MixerInput *in = &m->inputs[index];
+    if (duck_gain < 0.0) duck_gain = 0.0;
+    if (duck_gain > 1.0) duck_gain = 1.0;
+    // with nothing to duck, the steps still bring back a previous duck
+    double depth = (duck_gain < 1.0) ? 1.0 - duck_gain : 1.0;
+
+    pthread_mutex_lock(&m->mutex);
+    double attack_frames = attack * ramp_sample_rate(m);
+    double release_frames = release * ramp_sample_rate(m);
+    in->duck_key = key;
+    in->duck_gain = duck_gain;
+    // steps of at least depth move the whole way at once
+    in->duck_attack_step = (attack_frames >= 1.0) ? depth / attack_frames : 1.0;
+    in->duck_release_step = (release_frames >= 1.0) ? depth / release_frames : 1.0;
+    pthread_mutex_unlock(&m->mutex);
+
+    return 0;
+}
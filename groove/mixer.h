@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_MIXER_H_INCLUDED
+#define GROOVE_MIXER_H_INCLUDED
+
+#include "groove.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* use a GrooveMixer to mix several playlists into one stream, for example
+ * music with jingles or voice-overs on top of it. sinks and encoders attach
+ * to the playlist of the mixer like to any other playlist.
+ * every input playlist converts its audio once, straight to the format of
+ * the mix, which is float samples at sample_rate in channel_layout. each
+ * mix takes the same number of sample frames from every input that has
+ * audio, so that the inputs stay aligned to the sample, and gain changes
+ * are ramped per sample frame.
+ * an input that reaches the end of its playlist is silent until it has
+ * audio again. while every input is at its end, nothing is mixed.
+ */
+
+struct GrooveMixer {
+    /* the format of the mix. defaults to 44100 Hz stereo */
+    int sample_rate;
+    uint64_t channel_layout;
+
+    /* how many sample frames to mix at a time. defaults to 1024 */
+    int buffer_sample_count;
+
+    /* how big the sink buffer of each input should be, in sample frames.
+     * defaults to 8192
+     */
+    int sink_buffer_size;
+
+    /* read-only. attach sinks and encoders to this playlist to receive the
+     * mix. its gain applies to the whole mix. it is created and destroyed
+     * along with the mixer, and must not be given any items: each buffer
+     * belongs to the item playing on the first input, by index, that has
+     * audio.
+     */
+    struct GroovePlaylist *playlist;
+};
+
+struct GrooveMixer *groove_mixer_create(void);
+/* detach the mixer first. this destroys the playlist of the mixer, which
+ * detaches every sink still attached to it.
+ */
+void groove_mixer_destroy(struct GrooveMixer *mixer);
+
+/* inputs can only be added while the mixer is detached. an input starts at
+ * a gain of 1.0 and without ducking.
+ * returns the index of the input, or < 0 on error
+ */
+int groove_mixer_add_input(struct GrooveMixer *mixer, struct GroovePlaylist *input);
+
+/* attaches a sink to every input and starts mixing. the settings are read
+ * when attaching. once you attach, you must detach before destroying any
+ * of the inputs.
+ * returns 0 on success, < 0 on error
+ */
+int groove_mixer_attach(struct GrooveMixer *mixer);
+int groove_mixer_detach(struct GrooveMixer *mixer);
+
+/* changes the gain of input index to gain, linearly over seconds of mixed
+ * audio. 0 seconds changes it at once.
+ * returns 0 on success, < 0 if there is no such input
+ */
+int groove_mixer_set_gain(struct GrooveMixer *mixer, int index, double gain,
+        double seconds);
+
+/* while input key has audio, turns input index down to duck_gain, from 0.0
+ * to 1.0, over attack seconds. once input key has no more audio, it comes
+ * back up over release seconds. this is on top of the gain of input index.
+ * key -1 turns ducking off.
+ * returns 0 on success, < 0 if there is no such input
+ */
+int groove_mixer_set_ducking(struct GrooveMixer *mixer, int index, int key,
+        double duck_gain, double attack, double release);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_MIXER_H_INCLUDED */
@@ -5,12 +5,14 @@
  * See http://opensource.org/licenses/MIT
  */
 
+#include "playlist.h"
 #include "file.h"
 #include "queue.h"
 #include "buffer.h"
 
 #include <libavutil/opt.h>
 #include <libavutil/channel_layout.h>
+#include <libavutil/audio_fifo.h>
 #include <libavformat/avformat.h>
 #include <libavfilter/avfilter.h>
 #include <libavfilter/buffersink.h>
@@ -23,6 +25,8 @@ struct GrooveSinkPrivate {
     struct GrooveQueue *audioq;
     int audioq_size; // in bytes
     int min_audioq_size; // in bytes
+    // see groove_sink_set_wake
+    void (*wake)(struct GrooveSink *);
 };
 
 struct SinkStack {
@@ -33,9 +37,17 @@ struct SinkStack {
 struct SinkMap {
     struct SinkStack *stack_head;
     AVFilterContext *abuffersink_ctx;
+    // the part of the gain ramp this group has reached, see ramp_item
+    double ramp_gain;
     struct SinkMap *next;
 };
 
+// a channel layout has at most this many channels
+#define DOWNMIX_MAX_CHANNELS 64
+
+// groove_playlist_set_decode_gain moves the gain by this many dB per second
+#define DECODE_GAIN_RAMP 6.0
+
 struct GroovePlaylistPrivate {
     struct GroovePlaylist externals;
     pthread_t thread_id;
@@ -63,6 +75,9 @@ struct GroovePlaylistPrivate {
 
     pthread_mutex_t drain_cond_mutex;
     int drain_cond_mutex_inited;
+    // set to make groove_playlist_wait_sinks return. drain_cond_mutex
+    // applies to it
+    int wait_abort;
 
     // this mutex applies to the variables in this block
     pthread_mutex_t decode_head_mutex;
@@ -80,6 +95,15 @@ struct GroovePlaylistPrivate {
     double volume;
     // known true peak value
     double peak;
+    // while groove_playlist_set_decode_gain changes the gain of ramp_item,
+    // the filter graph keeps ramp_volume and ramp_peak, the values it had
+    // before, and every sink group that gets the playlist gain moves its
+    // ramp_gain toward ramp_target, the rest of the gain. this way the gain
+    // changes smoothly and the graph is not rebuilt. NULL if none.
+    struct GroovePlaylistItem *ramp_item;
+    double ramp_volume;
+    double ramp_peak;
+    double ramp_target;
     // set to 1 to trigger a rebuild
     int rebuild_filter_graph_flag;
     // map audio format to list of sinks
@@ -92,6 +116,56 @@ struct GroovePlaylistPrivate {
     double filter_volume;
     double filter_peak;
 
+    // crossfade settings. duration 0 means off
+    double crossfade_duration;
+    int crossfade_curve;
+    // the item fading in while decode_head fades out, NULL if none
+    struct GroovePlaylistItem *xfade_item;
+    // whether a fade was started or ruled out for decode_head
+    int xfade_tried;
+    // converts the audio of xfade_item to the input format of filter_graph
+    AVFilterGraph *xfade_graph;
+    AVFilterContext *xfade_abuffer_ctx;
+    AVFilterContext *xfade_abuffersink_ctx;
+    int xfade_sample_rate;
+    uint64_t xfade_channel_layout;
+    enum AVSampleFormat xfade_sample_fmt;
+    // converted audio of xfade_item waiting to be mixed in
+    AVAudioFifo *xfade_fifo;
+    // whether all of xfade_fifo reached the sinks at the end of decode_head,
+    // so that xfade_item can go on from where its fade got to
+    char xfade_drained;
+    // sample frames the fade lasts and how many of them were mixed
+    int64_t xfade_length;
+    int64_t xfade_pos;
+    // per sample frame gains of both items, mix_gain_size each. the gain
+    // ramp uses them as well.
+    float *mix_gain;
+    int mix_gain_size;
+    AVFrame *xfade_in_frame;
+    AVFrame *xfade_out_frame;
+    AVFrame *mix_frame;
+
+    // downmix levels, see groove_playlist_set_downmix. set downmix_dirty to
+    // recompute the matrices with them
+    double downmix_center;
+    double downmix_surround;
+    double downmix_lfe;
+    int downmix_dirty;
+    // the layout that every sink group can be fed, GROOVE_CH_LAYOUT_STEREO
+    // or GROOVE_CH_LAYOUT_MONO, or 0 to leave the audio as it is. sources
+    // with more channels than this are downmixed before the filter graph.
+    uint64_t downmix_layout;
+    // the source layout of decode_head that downmix_matrix was made for, or
+    // 0 if decode_head is not downmixed
+    uint64_t downmix_source;
+    float downmix_matrix[2 * DOWNMIX_MAX_CHANNELS];
+    AVFrame *downmix_frame;
+    // the same for xfade_item
+    uint64_t xfade_downmix_source;
+    float xfade_downmix_matrix[2 * DOWNMIX_MAX_CHANNELS];
+    AVFrame *xfade_downmix_frame;
+
     // only touched by decode_thread, tells whether we have sent the end_of_q_sentinel
     int sent_end_of_q;
 
@@ -104,14 +178,49 @@ struct GroovePlaylistPrivate {
 // and the end of the playlist.
 static struct GrooveBuffer *end_of_q_sentinel = NULL;
 
+static const double dB_scale = 0.1151292546497023; // log(10) * 0.05
+
 static int frame_size(const AVFrame *frame) {
     return av_get_channel_layout_nb_channels(frame->channel_layout) *
         av_get_bytes_per_sample(frame->format) *
         frame->nb_samples;
 }
 
-static struct GrooveBuffer * frame_to_groove_buffer(struct GroovePlaylist *playlist,
-        struct GrooveSink *sink, AVFrame *frame)
+// drops the samples of frame, which starts at clock seconds, that come
+// before start seconds. only the data pointers move; nothing is copied.
+// returns how many seconds were dropped.
+static double frame_trim_start(AVFrame *frame, double clock, double start) {
+    int skip = (int)((start - clock) * frame->sample_rate + 0.5);
+    if (skip <= 0)
+        return 0.0;
+    if (skip >= frame->nb_samples)
+        skip = frame->nb_samples - 1;
+
+    int channels = av_get_channel_layout_nb_channels(frame->channel_layout);
+    int planar = av_sample_fmt_is_planar(frame->format);
+    int planes = planar ? channels : 1;
+    int offset = skip * av_get_bytes_per_sample(frame->format) * (planar ? 1 : channels);
+    for (int i = 0; i < planes; i += 1) {
+        // extended_data is usually data itself
+        frame->extended_data[i] += offset;
+        if (i < AV_NUM_DATA_POINTERS)
+            frame->data[i] = frame->extended_data[i];
+    }
+    frame->nb_samples -= skip;
+    return skip / (double)frame->sample_rate;
+}
+
+// whether any sink of stack wants the levels of its buffers
+static int stack_computes_levels(struct SinkStack *stack) {
+    for (; stack; stack = stack->next) {
+        if (stack->sink->compute_levels)
+            return 1;
+    }
+    return 0;
+}
+
+static struct GrooveBuffer * frame_to_groove_buffer(struct SinkStack *stack, AVFrame *frame,
+        struct GroovePlaylistItem *item, double pos)
 {
     struct GrooveBufferPrivate *b = av_mallocz(sizeof(struct GrooveBufferPrivate));
 
@@ -128,13 +237,8 @@ static struct GrooveBuffer * frame_to_groove_buffer(struct GroovePlaylist *playl
         return NULL;
     }
 
-    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
-    struct GrooveFile *file = p->decode_head->file;
-
-    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
-
-    buffer->item = p->decode_head;
-    buffer->pos = f->audio_clock;
+    buffer->item = item;
+    buffer->pos = pos;
 
     buffer->data = frame->extended_data;
     buffer->frame_count = frame->nb_samples;
@@ -146,9 +250,759 @@ static struct GrooveBuffer * frame_to_groove_buffer(struct GroovePlaylist *playl
 
     b->frame = frame;
 
+    // the sinks of stack share this buffer, so its levels are computed once
+    // for all of them. without them the buffer is still usable.
+    if (stack_computes_levels(stack))
+        groove_buffer_compute_levels(buffer);
+
     return buffer;
 }
 
+// mixes frames sample frames of a and b into out, weighting sample frame i by
+// gain_a[i] and gain_b[i]. stride is the number of interleaved channels, or 1
+// for a plane of a planar format. integer samples are clipped.
+#define DEFINE_MIX_INT(name, type, bias, lo, hi) \
+static void name(uint8_t *out, const uint8_t *a, const uint8_t *b, int frames, \
+        int stride, const float *gain_a, const float *gain_b) \
+{ \
+    type *o = (type *) out; \
+    const type *x = (const type *) a; \
+    const type *y = (const type *) b; \
+    for (int i = 0; i < frames; i += 1) { \
+        for (int c = 0; c < stride; c += 1) { \
+            int s = i * stride + c; \
+            double v = (x[s] - bias) * gain_a[i] + (y[s] - bias) * gain_b[i]; \
+            v = (v < lo) ? lo : ((v > hi) ? hi : v); \
+            o[s] = (type) (lrint(v) + bias); \
+        } \
+    } \
+}
+
+#define DEFINE_MIX_FLOAT(name, type) \
+static void name(uint8_t *out, const uint8_t *a, const uint8_t *b, int frames, \
+        int stride, const float *gain_a, const float *gain_b) \
+{ \
+    type *o = (type *) out; \
+    const type *x = (const type *) a; \
+    const type *y = (const type *) b; \
+    for (int i = 0; i < frames; i += 1) { \
+        for (int c = 0; c < stride; c += 1) { \
+            int s = i * stride + c; \
+            o[s] = x[s] * gain_a[i] + y[s] * gain_b[i]; \
+        } \
+    } \
+}
+
+DEFINE_MIX_INT(mix_u8, uint8_t, 128, -128.0, 127.0)
+DEFINE_MIX_INT(mix_s16, int16_t, 0, -32768.0, 32767.0)
+DEFINE_MIX_INT(mix_s32, int32_t, 0, -2147483648.0, 2147483647.0)
+DEFINE_MIX_FLOAT(mix_flt, float)
+DEFINE_MIX_FLOAT(mix_dbl, double)
+
+// mixes a and b into out with gain_a and gain_b. all three have format fmt
+// and channels channels
+static void mix_frames(AVFrame *out, const AVFrame *a, const AVFrame *b,
+        enum AVSampleFormat fmt, int channels, const float *gain_a, const float *gain_b)
+{
+    void (*mix)(uint8_t *, const uint8_t *, const uint8_t *, int, int,
+            const float *, const float *);
+    switch (av_get_packed_sample_fmt(fmt)) {
+        case AV_SAMPLE_FMT_U8:  mix = mix_u8;  break;
+        case AV_SAMPLE_FMT_S16: mix = mix_s16; break;
+        case AV_SAMPLE_FMT_S32: mix = mix_s32; break;
+        case AV_SAMPLE_FMT_FLT: mix = mix_flt; break;
+        default:                mix = mix_dbl; break;
+    }
+    int planar = av_sample_fmt_is_planar(fmt);
+    int planes = planar ? channels : 1;
+    int stride = planar ? 1 : channels;
+    for (int i = 0; i < planes; i += 1) {
+        mix(out->extended_data[i], a->extended_data[i], b->extended_data[i],
+                out->nb_samples, stride, gain_a, gain_b);
+    }
+}
+
+// makes room for frames gains of each item in mix_gain
+static int reserve_mix_gain(struct GroovePlaylistPrivate *p, int frames) {
+    if (frames <= p->mix_gain_size)
+        return 0;
+    float *gain = av_realloc(p->mix_gain, 2 * frames * sizeof(float));
+    if (!gain) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate crossfade gains: out of memory\n");
+        return -1;
+    }
+    p->mix_gain = gain;
+    p->mix_gain_size = frames;
+    return 0;
+}
+
+// stops the gain ramp. the graph is rebuilt with the gain of decode_head
+// the next time the volume is updated.
+// decode_head_mutex must be held.
+static void ramp_end(struct GroovePlaylistPrivate *p) {
+    p->ramp_item = NULL;
+    p->ramp_target = 1.0;
+    for (struct SinkMap *map_item = p->sink_map; map_item; map_item = map_item->next)
+        map_item->ramp_gain = 1.0;
+}
+
+// applies the gain ramp of map_item to frame, a frame it pulled from the
+// filter graph, moving toward ramp_target by DECODE_GAIN_RAMP dB per second
+static int ramp_frame(struct GroovePlaylistPrivate *p, struct SinkMap *map_item,
+        AVFrame *frame)
+{
+    int frames = frame->nb_samples;
+    if (av_frame_make_writable(frame) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to apply gain ramp: out of memory\n");
+        return -1;
+    }
+    if (reserve_mix_gain(p, frames) < 0)
+        return -1;
+
+    double gain = map_item->ramp_gain;
+    double target = p->ramp_target;
+    double step = exp(dB_scale * DECODE_GAIN_RAMP / frame->sample_rate);
+    if (target < gain)
+        step = 1.0 / step;
+    float *gain_a = p->mix_gain;
+    float *gain_b = p->mix_gain + p->mix_gain_size;
+    for (int i = 0; i < frames; i += 1) {
+        if (gain != target) {
+            gain *= step;
+            if ((step > 1.0) ? (gain > target) : (gain < target))
+                gain = target;
+        }
+        gain_a[i] = gain;
+        gain_b[i] = 0.0f;
+    }
+    map_item->ramp_gain = gain;
+
+    int channels = av_get_channel_layout_nb_channels(frame->channel_layout);
+    mix_frames(frame, frame, frame, frame->format, channels, gain_a, gain_b);
+    return 0;
+}
+
+// push frame into the filtergraph, then put the filtered audio in the sinks
+// as audio of item at pos seconds.
+// returns the largest amount of data any sink received, or -1 on error
+static int push_frame(struct GroovePlaylist *playlist, AVFrame *frame,
+        struct GroovePlaylistItem *item, double pos, double *clock_adjustment)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    int err = av_buffersrc_write_frame(p->abuffer_ctx, frame);
+    if (err < 0) {
+        av_strerror(err, p->strbuf, sizeof(p->strbuf));
+        av_log(NULL, AV_LOG_ERROR, "error writing frame to buffersrc: %s\n",
+                p->strbuf);
+        return -1;
+    }
+
+    int max_data_size = 0;
+    // for each data format in the sink map, pull filtered audio from its
+    // buffersink, turn it into a GrooveBuffer and then increment the ref
+    // count for each sink in that stack.
+    struct SinkMap *map_item = p->sink_map;
+    *clock_adjustment = 0;
+    while (map_item) {
+        struct GrooveSink *example_sink = map_item->stack_head->sink;
+        int data_size = 0;
+        // the format of a group can follow the source, so the duration is
+        // counted in sample frames rather than derived from bytes_per_sec
+        double duration = 0;
+        for (;;) {
+            AVFrame *oframe = av_frame_alloc();
+            int err = example_sink->buffer_sample_count == 0 ?
+                av_buffersink_get_frame(map_item->abuffersink_ctx, oframe) :
+                av_buffersink_get_samples(map_item->abuffersink_ctx, oframe, example_sink->buffer_sample_count);
+            if (err == AVERROR_EOF || err == AVERROR(EAGAIN)) {
+                av_frame_free(&oframe);
+                break;
+            }
+            if (err < 0) {
+                av_frame_free(&oframe);
+                av_log(NULL, AV_LOG_ERROR, "error reading buffer from buffersink\n");
+                return -1;
+            }
+            if (!example_sink->disable_gain &&
+                (map_item->ramp_gain != 1.0 || p->ramp_target != 1.0) &&
+                ramp_frame(p, map_item, oframe) < 0)
+            {
+                av_frame_free(&oframe);
+                return -1;
+            }
+            struct GrooveBuffer *buffer = frame_to_groove_buffer(map_item->stack_head, oframe, item, pos);
+            if (!buffer) {
+                av_frame_free(&oframe);
+                return -1;
+            }
+            data_size += buffer->size;
+            duration += buffer->frame_count / (double)buffer->format.sample_rate;
+            struct SinkStack *stack_item = map_item->stack_head;
+            // we hold this reference to avoid cleanups until at least this loop
+            // is done and we call unref after it.
+            groove_buffer_ref(buffer);
+            while (stack_item) {
+                struct GrooveSink *sink = stack_item->sink;
+                struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
+                // as soon as we call groove_queue_put, this buffer could be unref'd.
+                // so we ref before putting it in the queue, and unref if it failed.
+                groove_buffer_ref(buffer);
+                if (groove_queue_put(s->audioq, buffer) < 0) {
+                    av_log(NULL, AV_LOG_ERROR, "unable to put buffer in queue\n");
+                    groove_buffer_unref(buffer);
+                }
+                stack_item = stack_item->next;
+            }
+            groove_buffer_unref(buffer);
+        }
+        if (data_size > max_data_size) {
+            max_data_size = data_size;
+            *clock_adjustment = duration;
+        }
+        map_item = map_item->next;
+    }
+
+    return max_data_size;
+}
+
+static const double sqrt1_2 = 0.7071067811865476;
+
+// the layout to downmix to so that one downmix feeds every sink group, see
+// downmix_layout
+static uint64_t downmix_target(struct GroovePlaylistPrivate *p) {
+    uint64_t wanted = 0;
+    for (struct SinkMap *map_item = p->sink_map; map_item; map_item = map_item->next) {
+        struct GrooveSink *example_sink = map_item->stack_head->sink;
+        // these groups get the channels of the source
+        if (example_sink->disable_resample || !example_sink->audio_format.channel_layout)
+            return 0;
+        wanted |= example_sink->audio_format.channel_layout;
+    }
+    if (!wanted || (wanted & ~(GROOVE_CH_LAYOUT_STEREO|GROOVE_CH_LAYOUT_MONO)))
+        return 0;
+    return (wanted & GROOVE_CH_LAYOUT_STEREO) ? GROOVE_CH_LAYOUT_STEREO : GROOVE_CH_LAYOUT_MONO;
+}
+
+// whether audio in the layout source is downmixed to downmix_layout
+static int downmix_applies(struct GroovePlaylistPrivate *p, uint64_t source) {
+    return p->downmix_layout && source &&
+        av_get_channel_layout_nb_channels(source) >
+        av_get_channel_layout_nb_channels(p->downmix_layout);
+}
+
+// fills matrix with the weight of each channel of source in each channel of
+// downmix_layout, one row of DOWNMIX_MAX_CHANNELS per output channel. a row
+// whose weights add up to more than 1 is scaled down to 1, so that the
+// downmix of full scale input cannot clip.
+static void downmix_build_matrix(struct GroovePlaylistPrivate *p, uint64_t source,
+        float *matrix)
+{
+    const uint64_t left = GROOVE_CH_FRONT_LEFT | GROOVE_CH_FRONT_LEFT_OF_CENTER |
+        GROOVE_CH_WIDE_LEFT | GROOVE_CH_STEREO_LEFT | GROOVE_CH_TOP_FRONT_LEFT;
+    const uint64_t right = GROOVE_CH_FRONT_RIGHT | GROOVE_CH_FRONT_RIGHT_OF_CENTER |
+        GROOVE_CH_WIDE_RIGHT | GROOVE_CH_STEREO_RIGHT | GROOVE_CH_TOP_FRONT_RIGHT;
+    const uint64_t surround_left = GROOVE_CH_SIDE_LEFT | GROOVE_CH_BACK_LEFT |
+        GROOVE_CH_SURROUND_DIRECT_LEFT | GROOVE_CH_TOP_BACK_LEFT;
+    const uint64_t surround_right = GROOVE_CH_SIDE_RIGHT | GROOVE_CH_BACK_RIGHT |
+        GROOVE_CH_SURROUND_DIRECT_RIGHT | GROOVE_CH_TOP_BACK_RIGHT;
+    const uint64_t back_center = GROOVE_CH_BACK_CENTER | GROOVE_CH_TOP_BACK_CENTER;
+    const uint64_t lfe = GROOVE_CH_LOW_FREQUENCY | GROOVE_CH_LOW_FREQUENCY_2;
+
+    int channels = av_get_channel_layout_nb_channels(source);
+    for (int i = 0; i < channels; i += 1) {
+        uint64_t ch = av_channel_layout_extract_channel(source, i);
+        double l, r;
+        if (ch & left) {
+            l = 1.0;
+            r = 0.0;
+        } else if (ch & right) {
+            l = 0.0;
+            r = 1.0;
+        } else if (ch & surround_left) {
+            l = p->downmix_surround;
+            r = 0.0;
+        } else if (ch & surround_right) {
+            l = 0.0;
+            r = p->downmix_surround;
+        } else if (ch & back_center) {
+            l = r = p->downmix_surround * sqrt1_2;
+        } else if (ch & lfe) {
+            l = r = p->downmix_lfe;
+        } else {
+            // the center channels, and any channel without a side
+            l = r = p->downmix_center;
+        }
+        if (p->downmix_layout == GROOVE_CH_LAYOUT_MONO) {
+            matrix[i] = 0.5 * (l + r);
+        } else {
+            matrix[i] = l;
+            matrix[DOWNMIX_MAX_CHANNELS + i] = r;
+        }
+    }
+
+    int rows = (p->downmix_layout == GROOVE_CH_LAYOUT_MONO) ? 1 : 2;
+    for (int o = 0; o < rows; o += 1) {
+        float *row = matrix + o * DOWNMIX_MAX_CHANNELS;
+        double sum = 0.0;
+        for (int i = 0; i < channels; i += 1)
+            sum += fabs(row[i]);
+        if (sum <= 1.0)
+            continue;
+        for (int i = 0; i < channels; i += 1)
+            row[i] /= sum;
+    }
+}
+
+// adds frames sample frames of the channels of in, weighted by row and
+// scaled to floats, to out. planar formats have a plane per channel.
+#define DEFINE_DOWNMIX(name, type, bias, scale) \
+static void name(float *out, uint8_t **in, int channels, int planar, int frames, \
+        const float *row) \
+{ \
+    int stride = planar ? 1 : channels; \
+    for (int c = 0; c < channels; c += 1) { \
+        float weight = row[c] * (float) (scale); \
+        if (weight == 0.0f) \
+            continue; \
+        const type *src = planar ? (const type *) in[c] : (const type *) in[0] + c; \
+        for (int i = 0; i < frames; i += 1) \
+            out[i] += (src[i * stride] - bias) * weight; \
+    } \
+}
+
+DEFINE_DOWNMIX(downmix_u8, uint8_t, 128, 1.0 / 128.0)
+DEFINE_DOWNMIX(downmix_s16, int16_t, 0, 1.0 / 32768.0)
+DEFINE_DOWNMIX(downmix_s32, int32_t, 0, 1.0 / 2147483648.0)
+DEFINE_DOWNMIX(downmix_flt, float, 0, 1.0)
+DEFINE_DOWNMIX(downmix_dbl, double, 0, 1.0)
+
+// downmixes in, whose layout is source, to float planes in downmix_layout
+// in out, with matrix from downmix_build_matrix.
+// returns out, or NULL on error
+static AVFrame *downmix(struct GroovePlaylistPrivate *p, AVFrame *out, const AVFrame *in,
+        uint64_t source, const float *matrix)
+{
+    av_frame_unref(out);
+    out->format = AV_SAMPLE_FMT_FLTP;
+    out->channel_layout = p->downmix_layout;
+    out->sample_rate = in->sample_rate;
+    out->nb_samples = in->nb_samples;
+    if (av_frame_get_buffer(out, 0) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate downmix frame: out of memory\n");
+        return NULL;
+    }
+    av_frame_copy_props(out, in);
+
+    void (*add)(float *, uint8_t **, int, int, int, const float *);
+    switch (av_get_packed_sample_fmt((enum AVSampleFormat)in->format)) {
+        case AV_SAMPLE_FMT_U8:  add = downmix_u8;  break;
+        case AV_SAMPLE_FMT_S16: add = downmix_s16; break;
+        case AV_SAMPLE_FMT_S32: add = downmix_s32; break;
+        case AV_SAMPLE_FMT_FLT: add = downmix_flt; break;
+        default:                add = downmix_dbl; break;
+    }
+    int channels = av_get_channel_layout_nb_channels(source);
+    int planar = av_sample_fmt_is_planar((enum AVSampleFormat)in->format);
+    int out_channels = av_get_channel_layout_nb_channels(p->downmix_layout);
+    for (int o = 0; o < out_channels; o += 1) {
+        float *dst = (float *) out->extended_data[o];
+        memset(dst, 0, in->nb_samples * sizeof(float));
+        add(dst, in->extended_data, channels, planar, in->nb_samples,
+                matrix + o * DOWNMIX_MAX_CHANNELS);
+    }
+    return out;
+}
+
+// converts seconds in the audio stream of f into a timestamp to seek to
+static int64_t seconds_to_ts(struct GrooveFilePrivate *f, double seconds) {
+    int64_t ts = seconds * f->audio_st->time_base.den / f->audio_st->time_base.num;
+    if (f->ic->start_time != AV_NOPTS_VALUE)
+        ts += f->ic->start_time;
+    return ts;
+}
+
+static const double half_pi = 1.5707963267948966;
+
+// frees the state of the fade in progress, if any
+static void xfade_cancel(struct GroovePlaylistPrivate *p) {
+    avfilter_graph_free(&p->xfade_graph);
+    p->xfade_abuffer_ctx = NULL;
+    p->xfade_abuffersink_ctx = NULL;
+    if (p->xfade_fifo) {
+        av_audio_fifo_free(p->xfade_fifo);
+        p->xfade_fifo = NULL;
+    }
+    p->xfade_downmix_source = 0;
+    p->xfade_item = NULL;
+    p->xfade_drained = 0;
+}
+
+// abuffer -> aformat -> abuffersink
+// converts the audio of file to the input format of filter_graph. audio that
+// decode_head would downmix is downmixed the same way before abuffer.
+static int xfade_init_graph(struct GroovePlaylistPrivate *p, struct GrooveFilePrivate *f) {
+    p->xfade_graph = avfilter_graph_alloc();
+    if (!p->xfade_graph) {
+        av_log(NULL, AV_LOG_ERROR, "unable to create crossfade filter graph: out of memory\n");
+        return -1;
+    }
+
+    int err;
+    AVCodecContext *avctx = f->audio_st->codec;
+    AVRational time_base = f->audio_st->time_base;
+    uint64_t channel_layout = avctx->channel_layout;
+    enum AVSampleFormat sample_fmt = avctx->sample_fmt;
+    if (downmix_applies(p, channel_layout)) {
+        p->xfade_downmix_source = channel_layout;
+        downmix_build_matrix(p, channel_layout, p->xfade_downmix_matrix);
+        channel_layout = p->downmix_layout;
+        sample_fmt = AV_SAMPLE_FMT_FLTP;
+    }
+    snprintf(p->strbuf, sizeof(p->strbuf),
+            "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64,
+            time_base.num, time_base.den, avctx->sample_rate,
+            av_get_sample_fmt_name(sample_fmt), channel_layout);
+    av_log(NULL, AV_LOG_INFO, "crossfade abuffer: %s\n", p->strbuf);
+    err = avfilter_graph_create_filter(&p->xfade_abuffer_ctx, p->abuffer_filter,
+            NULL, p->strbuf, NULL, p->xfade_graph);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "error initializing crossfade abuffer filter\n");
+        return err;
+    }
+
+    p->xfade_sample_rate = p->in_sample_rate;
+    p->xfade_channel_layout = p->in_channel_layout;
+    p->xfade_sample_fmt = p->in_sample_fmt;
+    AVFilterContext *aformat_ctx;
+    snprintf(p->strbuf, sizeof(p->strbuf),
+            "sample_fmts=%s:sample_rates=%d:channel_layouts=0x%"PRIx64,
+            av_get_sample_fmt_name(p->xfade_sample_fmt),
+            p->xfade_sample_rate, p->xfade_channel_layout);
+    av_log(NULL, AV_LOG_INFO, "crossfade aformat: %s\n", p->strbuf);
+    err = avfilter_graph_create_filter(&aformat_ctx, p->aformat_filter,
+            NULL, p->strbuf, NULL, p->xfade_graph);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to create crossfade aformat filter\n");
+        return err;
+    }
+    err = avfilter_link(p->xfade_abuffer_ctx, 0, aformat_ctx, 0);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to link crossfade aformat filter\n");
+        return err;
+    }
+
+    err = avfilter_graph_create_filter(&p->xfade_abuffersink_ctx, p->abuffersink_filter,
+            NULL, NULL, NULL, p->xfade_graph);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to create crossfade abuffersink filter\n");
+        return err;
+    }
+    err = avfilter_link(aformat_ctx, 0, p->xfade_abuffersink_ctx, 0);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to link crossfade abuffersink filter\n");
+        return err;
+    }
+
+    err = avfilter_graph_config(p->xfade_graph, NULL);
+    if (err < 0) {
+        av_strerror(err, p->strbuf, sizeof(p->strbuf));
+        av_log(NULL, AV_LOG_ERROR, "error configuring the crossfade filter graph: %s\n",
+                p->strbuf);
+        return err;
+    }
+
+    return 0;
+}
+
+// starts fading in the item after item once the end of item is near.
+// the next item is seeked to its start and from then on decoded along with
+// item.
+static void xfade_maybe_start(struct GroovePlaylistPrivate *p, struct GroovePlaylistItem *item) {
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) item->file;
+    struct GroovePlaylistItem *next = item->next;
+
+    // at a gain of 0 the mix could not be heard, see xfade_gain_ratio
+    if (!next || item->gain <= 0)
+        return;
+    // one file cannot be decoded at two positions
+    double end = (item->trim_end > 0) ? item->trim_end : groove_file_duration(item->file);
+    if (next->file == item->file || end <= 0) {
+        p->xfade_tried = 1;
+        return;
+    }
+    if (f->audio_clock < end - p->crossfade_duration)
+        return;
+    p->xfade_tried = 1;
+
+    struct GrooveFilePrivate *next_f = (struct GrooveFilePrivate *) next->file;
+    if (next_f->abort_request)
+        return;
+
+    pthread_mutex_lock(&next_f->seek_mutex);
+    int64_t ts = (next->trim_start > 0) ? seconds_to_ts(next_f, next->trim_start) : 0;
+    int err = av_seek_frame(next_f->ic, next_f->audio_stream_index, ts, 0);
+    avcodec_flush_buffers(next_f->audio_st->codec);
+    next_f->seek_pos = -1;
+    next_f->eof = 0;
+    next_f->audio_clock = next->trim_start;
+    pthread_mutex_unlock(&next_f->seek_mutex);
+    if (err < 0) {
+        av_log(NULL, AV_LOG_ERROR, "%s: error while seeking\n", next_f->ic->filename);
+        return;
+    }
+
+    if (xfade_init_graph(p, next_f) < 0) {
+        xfade_cancel(p);
+        return;
+    }
+    int channels = av_get_channel_layout_nb_channels(p->xfade_channel_layout);
+    p->xfade_fifo = av_audio_fifo_alloc(p->xfade_sample_fmt, channels, 1);
+    if (!p->xfade_fifo) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate crossfade fifo\n");
+        xfade_cancel(p);
+        return;
+    }
+
+    p->xfade_length = (end - f->audio_clock) * p->xfade_sample_rate;
+    if (p->xfade_length < 1)
+        p->xfade_length = 1;
+    p->xfade_pos = 0;
+    p->xfade_item = next;
+}
+
+// decodes one packet of xfade_item into xfade_fifo.
+// returns < 0 once there is no more audio to decode
+static int xfade_fill(struct GroovePlaylistPrivate *p) {
+    struct GroovePlaylistItem *item = p->xfade_item;
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) item->file;
+    AVCodecContext *dec = f->audio_st->codec;
+    AVPacket *pkt = &f->audio_pkt;
+
+    if (f->abort_request || (item->trim_end > 0 && f->audio_clock >= item->trim_end))
+        return -1;
+
+    int flushing = f->eof;
+    if (flushing) {
+        if (!(dec->codec->capabilities & CODEC_CAP_DELAY))
+            return -1;
+        av_init_packet(pkt);
+        pkt->data = NULL;
+        pkt->size = 0;
+        pkt->stream_index = f->audio_stream_index;
+    } else {
+        pthread_mutex_lock(&f->seek_mutex);
+        int err = av_read_frame(f->ic, pkt);
+        pthread_mutex_unlock(&f->seek_mutex);
+        if (err < 0) {
+            if (err != AVERROR_EOF)
+                av_log(NULL, AV_LOG_WARNING, "error reading frames\n");
+            f->eof = 1;
+            return 0;
+        }
+        if (pkt->stream_index != f->audio_stream_index) {
+            av_free_packet(pkt);
+            return 0;
+        }
+        if (pkt->pts != AV_NOPTS_VALUE)
+            f->audio_clock = av_q2d(f->audio_st->time_base) * pkt->pts;
+    }
+
+    int ret = 0;
+    AVPacket pkt_temp = *pkt;
+    AVFrame *in_frame = p->xfade_in_frame;
+    AVFrame *oframe = p->xfade_out_frame;
+    while (pkt_temp.size > 0 || flushing) {
+        int got_frame;
+        int len = avcodec_decode_audio4(dec, in_frame, &got_frame, &pkt_temp);
+        if (len < 0)
+            break;
+        pkt_temp.data += len;
+        pkt_temp.size -= len;
+
+        if (!got_frame) {
+            // the decoder is finished
+            if (flushing)
+                ret = -1;
+            break;
+        }
+
+        double frame_start = f->audio_clock;
+        double frame_duration = in_frame->nb_samples / (double)in_frame->sample_rate;
+        int before_start = (frame_start + frame_duration <= item->trim_start);
+        if (pkt->pts == AV_NOPTS_VALUE)
+            f->audio_clock += frame_duration;
+
+        if (!before_start) {
+            frame_trim_start(in_frame, frame_start, item->trim_start);
+            AVFrame *frame = in_frame;
+            if (p->xfade_downmix_source) {
+                frame = downmix(p, p->xfade_downmix_frame, in_frame,
+                        p->xfade_downmix_source, p->xfade_downmix_matrix);
+                if (!frame) {
+                    ret = -1;
+                    break;
+                }
+            }
+            int err = av_buffersrc_write_frame(p->xfade_abuffer_ctx, frame);
+            if (err < 0) {
+                av_log(NULL, AV_LOG_ERROR, "error writing frame to crossfade buffersrc\n");
+                ret = -1;
+                break;
+            }
+            while (av_buffersink_get_frame(p->xfade_abuffersink_ctx, oframe) >= 0) {
+                int written = av_audio_fifo_write(p->xfade_fifo,
+                        (void **) oframe->extended_data, oframe->nb_samples);
+                av_frame_unref(oframe);
+                if (written < 0) {
+                    av_log(NULL, AV_LOG_ERROR, "unable to write to crossfade fifo\n");
+                    ret = -1;
+                    break;
+                }
+            }
+        }
+
+        // flush one frame at a time
+        if (flushing || ret < 0)
+            break;
+    }
+
+    if (!flushing)
+        av_free_packet(pkt);
+    return ret;
+}
+
+// gives frame a buffer for frames sample frames in the format of xfade_fifo
+static int xfade_alloc_frame(struct GroovePlaylistPrivate *p, AVFrame *frame, int frames) {
+    av_frame_unref(frame);
+    frame->format = p->xfade_sample_fmt;
+    frame->channel_layout = p->xfade_channel_layout;
+    frame->sample_rate = p->xfade_sample_rate;
+    frame->nb_samples = frames;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate crossfade frame: out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+// the gain of xfade_item relative to that of decode_head. the filter graph
+// applies the gain of decode_head to the mix, so when that gain is 0 there
+// is no ratio that lets xfade_item be heard, and the fade is cancelled.
+static double xfade_gain_ratio(struct GroovePlaylistPrivate *p) {
+    return p->xfade_item->gain / p->decode_head->gain;
+}
+
+// mixes a and b into out with the gains in mix_gain, once for all sinks
+static void xfade_mix_frames(struct GroovePlaylistPrivate *p, AVFrame *out,
+        const AVFrame *a, const AVFrame *b)
+{
+    int channels = av_get_channel_layout_nb_channels(p->xfade_channel_layout);
+    mix_frames(out, a, b, p->xfade_sample_fmt, channels, p->mix_gain,
+            p->mix_gain + p->mix_gain_size);
+}
+
+// mixes the next part of xfade_item into frame, a frame of decode_head.
+// returns the mix, or frame itself if the fade had to be dropped
+static AVFrame *xfade_mix(struct GroovePlaylist *playlist, AVFrame *frame) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    int frames = frame->nb_samples;
+
+    // the filter graph was rebuilt for another format, or mutes the mix
+    if (p->in_sample_fmt != p->xfade_sample_fmt ||
+        p->in_sample_rate != p->xfade_sample_rate ||
+        p->in_channel_layout != p->xfade_channel_layout ||
+        p->decode_head->gain <= 0)
+    {
+        xfade_cancel(p);
+        return frame;
+    }
+
+    while (av_audio_fifo_size(p->xfade_fifo) < frames) {
+        if (xfade_fill(p) < 0)
+            break;
+    }
+
+    AVFrame *b = p->xfade_out_frame;
+    if (xfade_alloc_frame(p, b, frames) < 0 ||
+        xfade_alloc_frame(p, p->mix_frame, frames) < 0 ||
+        reserve_mix_gain(p, frames) < 0)
+    {
+        xfade_cancel(p);
+        return frame;
+    }
+    int channels = av_get_channel_layout_nb_channels(p->xfade_channel_layout);
+    int got = av_audio_fifo_read(p->xfade_fifo, (void **) b->extended_data, frames);
+    if (got < 0)
+        got = 0;
+    // the next item ended during the fade
+    if (got < frames) {
+        av_samples_set_silence(b->extended_data, got, frames - got, channels,
+                p->xfade_sample_fmt);
+    }
+
+    double ratio = xfade_gain_ratio(p);
+    float *gain_a = p->mix_gain;
+    float *gain_b = p->mix_gain + p->mix_gain_size;
+    for (int i = 0; i < frames; i += 1) {
+        double t = (p->xfade_pos + i) / (double)p->xfade_length;
+        if (t > 1.0)
+            t = 1.0;
+        if (p->crossfade_curve == GROOVE_CROSSFADE_LINEAR) {
+            gain_a[i] = 1.0 - t;
+            gain_b[i] = t * ratio;
+        } else {
+            gain_a[i] = cos(t * half_pi);
+            gain_b[i] = sin(t * half_pi) * ratio;
+        }
+    }
+    p->xfade_pos += frames;
+
+    xfade_mix_frames(p, p->mix_frame, frame, b);
+    av_frame_copy_props(p->mix_frame, frame);
+    return p->mix_frame;
+}
+
+// at the end of decode_head, sends what is left of the converted audio of
+// xfade_item to the sinks at the full gain of xfade_item
+static void xfade_drain(struct GroovePlaylist *playlist) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+    if (!p->xfade_item)
+        return;
+    if (p->decode_head->gain <= 0) {
+        xfade_cancel(p);
+        return;
+    }
+
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) p->decode_head->file;
+    AVFrame *b = p->xfade_out_frame;
+    int frames;
+    while ((frames = av_audio_fifo_size(p->xfade_fifo)) > 0) {
+        if (frames > 4096)
+            frames = 4096;
+        if (xfade_alloc_frame(p, b, frames) < 0 || reserve_mix_gain(p, frames) < 0)
+            break;
+        frames = av_audio_fifo_read(p->xfade_fifo, (void **) b->extended_data, frames);
+        if (frames <= 0)
+            break;
+        b->nb_samples = frames;
+        b->pts = AV_NOPTS_VALUE;
+
+        double ratio = xfade_gain_ratio(p);
+        float *gain_a = p->mix_gain;
+        float *gain_b = p->mix_gain + p->mix_gain_size;
+        for (int i = 0; i < frames; i += 1) {
+            gain_a[i] = 0.0f;
+            gain_b[i] = ratio;
+        }
+        xfade_mix_frames(p, b, b, b);
+
+        double clock_adjustment;
+        if (push_frame(playlist, b, p->decode_head, f->audio_clock, &clock_adjustment) < 0)
+            break;
+    }
+    p->xfade_drained = (av_audio_fifo_size(p->xfade_fifo) == 0);
+}
 
 // decode one audio packet and return its uncompressed size
 static int audio_decode_frame(struct GroovePlaylist *playlist, struct GrooveFile *file) {
@@ -191,67 +1045,35 @@ static int audio_decode_frame(struct GroovePlaylist *playlist, struct GrooveFile
             continue;
         }
 
-        // push the audio data from decoded frame into the filtergraph
-        int err = av_buffersrc_write_frame(p->abuffer_ctx, in_frame);
-        if (err < 0) {
-            av_strerror(err, p->strbuf, sizeof(p->strbuf));
-            av_log(NULL, AV_LOG_ERROR, "error writing frame to buffersrc: %s\n",
-                    p->strbuf);
-            return -1;
+        // seeking lands on a key frame, which can be before the start of a
+        // trimmed item
+        double frame_duration = in_frame->nb_samples / (double)in_frame->sample_rate;
+        if (f->audio_clock + frame_duration <= p->decode_head->trim_start) {
+            if (pkt->pts == AV_NOPTS_VALUE)
+                f->audio_clock += frame_duration;
+            continue;
         }
-
-        // for each data format in the sink map, pull filtered audio from its
-        // buffersink, turn it into a GrooveBuffer and then increment the ref
-        // count for each sink in that stack.
-        struct SinkMap *map_item = p->sink_map;
-        double clock_adjustment = 0;
-        while (map_item) {
-            struct GrooveSink *example_sink = map_item->stack_head->sink;
-            int data_size = 0;
-            for (;;) {
-                AVFrame *oframe = av_frame_alloc();
-                int err = example_sink->buffer_sample_count == 0 ?
-                    av_buffersink_get_frame(map_item->abuffersink_ctx, oframe) :
-                    av_buffersink_get_samples(map_item->abuffersink_ctx, oframe, example_sink->buffer_sample_count);
-                if (err == AVERROR_EOF || err == AVERROR(EAGAIN)) {
-                    av_frame_free(&oframe);
-                    break;
-                }
-                if (err < 0) {
-                    av_frame_free(&oframe);
-                    av_log(NULL, AV_LOG_ERROR, "error reading buffer from buffersink\n");
-                    return -1;
-                }
-                struct GrooveBuffer *buffer = frame_to_groove_buffer(playlist, example_sink, oframe);
-                if (!buffer) {
-                    av_frame_free(&oframe);
-                    return -1;
-                }
-                data_size += buffer->size;
-                struct SinkStack *stack_item = map_item->stack_head;
-                // we hold this reference to avoid cleanups until at least this loop
-                // is done and we call unref after it.
-                groove_buffer_ref(buffer);
-                while (stack_item) {
-                    struct GrooveSink *sink = stack_item->sink;
-                    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
-                    // as soon as we call groove_queue_put, this buffer could be unref'd.
-                    // so we ref before putting it in the queue, and unref if it failed.
-                    groove_buffer_ref(buffer);
-                    if (groove_queue_put(s->audioq, buffer) < 0) {
-                        av_log(NULL, AV_LOG_ERROR, "unable to put buffer in queue\n");
-                        groove_buffer_unref(buffer);
-                    }
-                    stack_item = stack_item->next;
-                }
-                groove_buffer_unref(buffer);
-            }
-            if (data_size > max_data_size) {
-                max_data_size = data_size;
-                clock_adjustment = data_size / (double)example_sink->bytes_per_sec;
-            }
-            map_item = map_item->next;
+        f->audio_clock += frame_trim_start(in_frame, f->audio_clock,
+                p->decode_head->trim_start);
+
+        // downmix once for every sink, then mix in the item that is fading
+        // in, if any
+        AVFrame *out_frame = in_frame;
+        if (p->downmix_source) {
+            out_frame = downmix(p, p->downmix_frame, in_frame, p->downmix_source,
+                    p->downmix_matrix);
+            if (!out_frame)
+                return -1;
         }
+        if (p->xfade_item)
+            out_frame = xfade_mix(playlist, out_frame);
+
+        // push the audio data from decoded frame into the filtergraph
+        double clock_adjustment;
+        max_data_size = push_frame(playlist, out_frame, p->decode_head, f->audio_clock,
+                &clock_adjustment);
+        if (max_data_size < 0)
+            return -1;
 
         // if no pts, then estimate it
         if (pkt->pts == AV_NOPTS_VALUE)
@@ -261,14 +1083,14 @@ static int audio_decode_frame(struct GroovePlaylist *playlist, struct GrooveFile
     return max_data_size;
 }
 
-static const double dB_scale = 0.1151292546497023; // log(10) * 0.05
-
 static double gain_to_dB(double gain) {
     return log(gain) / dB_scale;
 }
 
+// links a volume or compand filter to output src_pad of *audio_src_ctx, if
+// one is needed, and updates both to point at its output
 static int create_volume_filter(struct GroovePlaylistPrivate *p, AVFilterContext **audio_src_ctx,
-        double vol, double amp_vol)
+        int *src_pad, double vol, double amp_vol)
 {
     int err;
 
@@ -283,13 +1105,14 @@ static int create_volume_filter(struct GroovePlaylistPrivate *p, AVFilterContext
             av_log(NULL, AV_LOG_ERROR, "error initializing volume filter\n");
             return err;
         }
-        err = avfilter_link(*audio_src_ctx, 0, volume_ctx, 0);
+        err = avfilter_link(*audio_src_ctx, *src_pad, volume_ctx, 0);
         if (err < 0) {
             av_strerror(err, p->strbuf, sizeof(p->strbuf));
             av_log(NULL, AV_LOG_ERROR, "unable to link volume filter: %s\n", p->strbuf);
             return err;
         }
         *audio_src_ctx = volume_ctx;
+        *src_pad = 0;
     } else if (amp_vol > 1.0) {
         double attack = 0.1;
         double decay = 0.2;
@@ -308,13 +1131,14 @@ static int create_volume_filter(struct GroovePlaylistPrivate *p, AVFilterContext
             av_log(NULL, AV_LOG_ERROR, "error initializing compand filter\n");
             return err;
         }
-        err = avfilter_link(*audio_src_ctx, 0, compand_ctx, 0);
+        err = avfilter_link(*audio_src_ctx, *src_pad, compand_ctx, 0);
         if (err < 0) {
             av_strerror(err, p->strbuf, sizeof(p->strbuf));
             av_log(NULL, AV_LOG_ERROR, "unable to link compand filter: %s\n", p->strbuf);
             return err;
         }
         *audio_src_ctx = compand_ctx;
+        *src_pad = 0;
     }
     return 0;
 }
@@ -323,9 +1147,14 @@ static int create_volume_filter(struct GroovePlaylistPrivate *p, AVFilterContext
 //                     -> volume -> aformat -> abuffersink
 // if the volume gain is > 1.0, we use a compand filter instead
 // for soft limiting.
-static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile *file) {
+// if any sink has disable_gain set, the playlist volume moves after asplit
+// so that it only applies to the groups that want it:
+// abuffer -> asplit for each audio format
+//                   -> volume -> volume -> aformat -> abuffersink
+static int init_filter_graph(struct GroovePlaylist *playlist, int sample_rate,
+        uint64_t channel_layout, enum AVSampleFormat sample_fmt, AVRational time_base)
+{
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
-    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
 
     // destruct old graph
     avfilter_graph_free(&p->filter_graph);
@@ -339,19 +1168,17 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
 
     int err;
     // create abuffer filter
-    AVCodecContext *avctx = f->audio_st->codec;
-    AVRational time_base = f->audio_st->time_base;
     snprintf(p->strbuf, sizeof(p->strbuf),
             "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%"PRIx64, 
-            time_base.num, time_base.den, avctx->sample_rate,
-            av_get_sample_fmt_name(avctx->sample_fmt),
-            avctx->channel_layout);
+            time_base.num, time_base.den, sample_rate,
+            av_get_sample_fmt_name(sample_fmt),
+            channel_layout);
     av_log(NULL, AV_LOG_INFO, "abuffer: %s\n", p->strbuf);
     // save these values so we can compare later and check
     // whether we have to reconstruct the graph
-    p->in_sample_rate = avctx->sample_rate;
-    p->in_channel_layout = avctx->channel_layout;
-    p->in_sample_fmt = avctx->sample_fmt;
+    p->in_sample_rate = sample_rate;
+    p->in_channel_layout = channel_layout;
+    p->in_sample_fmt = sample_fmt;
     p->in_time_base = time_base;
     err = avfilter_graph_create_filter(&p->abuffer_ctx, p->abuffer_filter,
             NULL, p->strbuf, NULL, p->filter_graph);
@@ -375,9 +1202,18 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
     // comes out to 0.96 so we know that we can safely amplify by 1.2 even
     // though it's greater than 1.0.
     double amp_vol = vol * (p->peak > 1.0 ? 1.0 : p->peak);
-    err = create_volume_filter(p, &audio_src_ctx, vol, amp_vol);
-    if (err < 0)
-        return err;
+
+    int per_group_volume = 0;
+    for (struct SinkMap *map_item = p->sink_map; map_item; map_item = map_item->next) {
+        if (map_item->stack_head->sink->disable_gain)
+            per_group_volume = 1;
+    }
+    if (!per_group_volume) {
+        int src_pad = 0;
+        err = create_volume_filter(p, &audio_src_ctx, &src_pad, vol, amp_vol);
+        if (err < 0)
+            return err;
+    }
 
     // if only one sink, no need for asplit
     if (p->sink_map_count >= 2) {
@@ -406,19 +1242,32 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
         struct GrooveAudioFormat *audio_format = &example_sink->audio_format;
 
         AVFilterContext *inner_audio_src_ctx = audio_src_ctx;
+        // the output of asplit for this group, or 0 once a filter follows it
+        int inner_pad = pad_index;
+
+        if (per_group_volume && !example_sink->disable_gain) {
+            err = create_volume_filter(p, &inner_audio_src_ctx, &inner_pad, vol, amp_vol);
+            if (err < 0)
+                return err;
+        }
 
         // create volume filter
-        err = create_volume_filter(p, &inner_audio_src_ctx, example_sink->gain, example_sink->gain);
+        err = create_volume_filter(p, &inner_audio_src_ctx, &inner_pad,
+                example_sink->gain, example_sink->gain);
         if (err < 0)
             return err;
 
         if (!example_sink->disable_resample) {
             AVFilterContext *aformat_ctx;
-            // create aformat filter
-            snprintf(p->strbuf, sizeof(p->strbuf),
-                    "sample_fmts=%s:sample_rates=%d:channel_layouts=0x%"PRIx64,
+            // create aformat filter. channel layout 0 keeps the channels of
+            // the source
+            int len = snprintf(p->strbuf, sizeof(p->strbuf), "sample_fmts=%s:sample_rates=%d",
                     av_get_sample_fmt_name((enum AVSampleFormat)audio_format->sample_fmt),
-                    audio_format->sample_rate, audio_format->channel_layout);
+                    audio_format->sample_rate);
+            if (audio_format->channel_layout) {
+                snprintf(p->strbuf + len, sizeof(p->strbuf) - len, ":channel_layouts=0x%"PRIx64,
+                        audio_format->channel_layout);
+            }
             av_log(NULL, AV_LOG_INFO, "aformat: %s\n", p->strbuf);
             err = avfilter_graph_create_filter(&aformat_ctx, p->aformat_filter,
                     NULL, p->strbuf, NULL, p->filter_graph);
@@ -428,13 +1277,14 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
                         p->strbuf);
                 return err;
             }
-            err = avfilter_link(inner_audio_src_ctx, pad_index, aformat_ctx, 0);
+            err = avfilter_link(inner_audio_src_ctx, inner_pad, aformat_ctx, 0);
             if (err < 0) {
                 av_strerror(err, p->strbuf, sizeof(p->strbuf));
                 av_log(NULL, AV_LOG_ERROR, "unable to link aformat filter: %s\n", p->strbuf);
                 return err;
             }
             inner_audio_src_ctx = aformat_ctx;
+            inner_pad = 0;
         }
 
         // create abuffersink filter
@@ -444,7 +1294,7 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
             av_log(NULL, AV_LOG_ERROR, "unable to create abuffersink filter\n");
             return err;
         }
-        err = avfilter_link(inner_audio_src_ctx, 0, map_item->abuffersink_ctx, 0);
+        err = avfilter_link(inner_audio_src_ctx, inner_pad, map_item->abuffersink_ctx, 0);
         if (err < 0) {
             av_strerror(err, p->strbuf, sizeof(p->strbuf));
             av_log(NULL, AV_LOG_ERROR, "unable to link abuffersink filter: %s\n", p->strbuf);
@@ -468,23 +1318,22 @@ static int init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile
     return 0;
 }
 
-static int maybe_init_filter_graph(struct GroovePlaylist *playlist, struct GrooveFile *file) {
+static int maybe_init_filter_graph(struct GroovePlaylist *playlist, int sample_rate,
+        uint64_t channel_layout, enum AVSampleFormat sample_fmt, AVRational time_base)
+{
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
-    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
-    AVCodecContext *avctx = f->audio_st->codec;
-    AVRational time_base = f->audio_st->time_base;
 
     // if the input format stuff has changed, then we need to re-build the graph
     if (!p->filter_graph || p->rebuild_filter_graph_flag ||
-        p->in_sample_rate != avctx->sample_rate ||
-        p->in_channel_layout != avctx->channel_layout ||
-        p->in_sample_fmt != avctx->sample_fmt ||
+        p->in_sample_rate != sample_rate ||
+        p->in_channel_layout != channel_layout ||
+        p->in_sample_fmt != sample_fmt ||
         p->in_time_base.num != time_base.num ||
         p->in_time_base.den != time_base.den ||
         p->volume != p->filter_volume ||
         p->peak != p->filter_peak)
     {
-        return init_filter_graph(playlist, file);
+        return init_filter_graph(playlist, sample_rate, channel_layout, sample_fmt, time_base);
     }
 
     return 0;
@@ -545,6 +1394,7 @@ static void every_sink_flush(struct GroovePlaylist *playlist) {
 }
 
 static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *file) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
     AVPacket *pkt = &f->audio_pkt;
 
@@ -552,9 +1402,35 @@ static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *
     if (f->abort_request)
         return -1;
 
+    // the sinks decide whether to downmix, and the source what from
+    AVCodecContext *avctx = f->audio_st->codec;
+    uint64_t downmix_layout = downmix_target(p);
+    if (downmix_layout != p->downmix_layout) {
+        // the item fading in was converted for the old layout
+        if (p->xfade_downmix_source)
+            xfade_cancel(p);
+        p->downmix_layout = downmix_layout;
+        p->downmix_dirty = 1;
+    }
+    uint64_t downmix_source = downmix_applies(p, avctx->channel_layout) ?
+        avctx->channel_layout : 0;
+    if (p->downmix_dirty || downmix_source != p->downmix_source) {
+        p->downmix_source = downmix_source;
+        if (downmix_source)
+            downmix_build_matrix(p, downmix_source, p->downmix_matrix);
+        if (p->xfade_downmix_source)
+            downmix_build_matrix(p, p->xfade_downmix_source, p->xfade_downmix_matrix);
+        p->downmix_dirty = 0;
+    }
+
     // might need to rebuild the filter graph if certain things changed
-    if (maybe_init_filter_graph(playlist, file) < 0)
+    if (maybe_init_filter_graph(playlist, avctx->sample_rate,
+                downmix_source ? p->downmix_layout : avctx->channel_layout,
+                downmix_source ? AV_SAMPLE_FMT_FLTP : avctx->sample_fmt,
+                f->audio_st->time_base) < 0)
+    {
         return -1;
+    }
 
     // handle seek requests
     pthread_mutex_lock(&f->seek_mutex);
@@ -570,6 +1446,19 @@ static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *
     }
     pthread_mutex_unlock(&f->seek_mutex);
 
+    // start fading in the next item, or stop if it is not next anymore
+    struct GroovePlaylistItem *item = p->decode_head;
+    if (p->xfade_item && item->next != p->xfade_item)
+        xfade_cancel(p);
+    else if (!p->xfade_item && !p->xfade_tried && p->crossfade_duration > 0)
+        xfade_maybe_start(p, item);
+
+    // a trimmed item ends early
+    if (item->trim_end > 0 && f->audio_clock >= item->trim_end) {
+        xfade_drain(playlist);
+        return -1;
+    }
+
     if (f->eof) {
         if (f->audio_st->codec->codec->capabilities & CODEC_CAP_DELAY) {
             av_init_packet(pkt);
@@ -582,6 +1471,7 @@ static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *
             }
         }
         // this file is complete. move on
+        xfade_drain(playlist);
         return -1;
     }
     int err = av_read_frame(f->ic, pkt);
@@ -605,9 +1495,11 @@ static int decode_one_frame(struct GroovePlaylist *playlist, struct GrooveFile *
 
 static void audioq_put(struct GrooveQueue *queue, void *obj) {
     struct GrooveBuffer *buffer = obj;
+    struct GrooveSinkPrivate *s = queue->context;
+    if (s->wake)
+        s->wake(&s->externals);
     if (buffer == end_of_q_sentinel)
         return;
-    struct GrooveSinkPrivate *s = queue->context;
     s->audioq_size += buffer->size;
 }
 
@@ -652,10 +1544,46 @@ static int audioq_purge(struct GrooveQueue *queue, void *obj) {
 static void update_playlist_volume(struct GroovePlaylist *playlist) {
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
     struct GroovePlaylistItem *item = p->decode_head;
+    if (item == p->ramp_item) {
+        p->volume = p->ramp_volume;
+        p->peak = p->ramp_peak;
+        return;
+    }
     p->volume = playlist->gain * item->gain;
     p->peak = item->peak;
 }
 
+// has the decode thread seek item to its trim_start before decoding it
+static void seek_to_trim_start(struct GroovePlaylistItem *item) {
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) item->file;
+    pthread_mutex_lock(&f->seek_mutex);
+    f->seek_pos = (item->trim_start > 0) ? seconds_to_ts(f, item->trim_start) : 0;
+    f->seek_flush = 0;
+    pthread_mutex_unlock(&f->seek_mutex);
+}
+
+// moves decode_head to the next item and seeks it to the beginning, unless
+// it was faded in already. a fade cut short by a skip starts over.
+// decode_head_mutex must be held.
+static void advance_decode_head(struct GroovePlaylistPrivate *p) {
+    // groove_playlist_skip_item can move on while the sinks are full and
+    // the file is paused. the decode thread only resumes the file at the
+    // decode head, so resume it here.
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) p->decode_head->file;
+    if (f->paused) {
+        av_read_play(f->ic);
+        f->paused = 0;
+    }
+
+    struct GroovePlaylistItem *faded_in = p->xfade_drained ? p->xfade_item : NULL;
+    xfade_cancel(p);
+    ramp_end(p);
+    p->xfade_tried = 0;
+    p->decode_head = p->decode_head->next;
+    if (p->decode_head && p->decode_head != faded_in)
+        seek_to_trim_start(p->decode_head);
+}
+
 // this thread is responsible for decoding and inserting buffers of decoded
 // audio into each sink
 static void *decode_thread(void *arg) {
@@ -700,18 +1628,8 @@ static void *decode_thread(void *arg) {
 
         update_playlist_volume(playlist);
 
-        if (decode_one_frame(playlist, file) < 0) {
-            p->decode_head = p->decode_head->next;
-            // seek to beginning of next song
-            if (p->decode_head) {
-                struct GrooveFile *next_file = p->decode_head->file;
-                struct GrooveFilePrivate *next_f = (struct GrooveFilePrivate *) next_file;
-                pthread_mutex_lock(&next_f->seek_mutex);
-                next_f->seek_pos = 0;
-                next_f->seek_flush = 0;
-                pthread_mutex_unlock(&next_f->seek_mutex);
-            }
-        }
+        if (decode_one_frame(playlist, file) < 0)
+            advance_decode_head(p);
 
         pthread_mutex_unlock(&p->decode_head_mutex);
     }
@@ -730,6 +1648,12 @@ static int sink_formats_compatible(const struct GrooveSink *example_sink,
     }
     if (example_sink->gain != test_sink->gain)
         return 0;
+    if (example_sink->disable_gain != test_sink->disable_gain)
+        return 0;
+    // a group whose first sink disabled resampling outputs whatever format
+    // the decoder produces
+    if (example_sink->disable_resample && !test_sink->disable_resample)
+        return 0;
     if (!test_sink->disable_resample &&
         (example_sink->audio_format.sample_rate != test_sink->audio_format.sample_rate ||
         example_sink->audio_format.channel_layout != test_sink->audio_format.channel_layout ||
@@ -814,11 +1738,12 @@ static int add_sink_to_map(struct GroovePlaylist *playlist, struct GrooveSink *s
     }
     // we did not find somewhere to put it, so push it onto the stack.
     struct SinkMap *map_entry = av_mallocz(sizeof(struct SinkMap));
-    map_entry->stack_head = stack_entry;
     if (!map_entry) {
         av_free(stack_entry);
         return -1;
     }
+    map_entry->stack_head = stack_entry;
+    map_entry->ramp_gain = p->ramp_target;
     if (p->sink_map) {
         map_entry->next = p->sink_map;
         p->sink_map = map_entry;
@@ -871,8 +1796,10 @@ int groove_sink_detach(struct GrooveSink *sink) {
 int groove_sink_attach(struct GrooveSink *sink, struct GroovePlaylist *playlist) {
     struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
 
-    // cache computed audio format stuff
-    int channel_count = av_get_channel_layout_nb_channels(sink->audio_format.channel_layout);
+    // cache computed audio format stuff. without a channel layout the
+    // channels follow the source, so count them as stereo
+    int channel_count = sink->audio_format.channel_layout ?
+        av_get_channel_layout_nb_channels(sink->audio_format.channel_layout) : 2;
     int bytes_per_frame = channel_count *
         av_get_bytes_per_sample((enum AVSampleFormat)sink->audio_format.sample_fmt);
     sink->bytes_per_sec = bytes_per_frame * sink->audio_format.sample_rate;
@@ -938,6 +1865,7 @@ struct GroovePlaylist * groove_playlist_create(void) {
     playlist->gain = 1.0;
     // the other volume multiplied by the playlist item's gain
     p->volume = 1.0;
+    p->ramp_target = 1.0;
 
     // set this flag to true so that a race condition does not send the end of
     // queue sentinel early.
@@ -945,6 +1873,10 @@ struct GroovePlaylist * groove_playlist_create(void) {
 
     p->detect_full_sinks = every_sink_full;
 
+    p->downmix_center = sqrt1_2;
+    p->downmix_surround = sqrt1_2;
+    p->downmix_lfe = 0.0;
+
     if (pthread_mutex_init(&p->decode_head_mutex, NULL) != 0) {
         groove_playlist_destroy(playlist);
         av_log(NULL, AV_LOG_ERROR, "unable to allocate decode head mutex\n");
@@ -974,8 +1906,15 @@ struct GroovePlaylist * groove_playlist_create(void) {
     p->sink_drain_cond_inited = 1;
 
     p->in_frame = av_frame_alloc();
-
-    if (!p->in_frame) {
+    p->xfade_in_frame = av_frame_alloc();
+    p->xfade_out_frame = av_frame_alloc();
+    p->mix_frame = av_frame_alloc();
+    p->downmix_frame = av_frame_alloc();
+    p->xfade_downmix_frame = av_frame_alloc();
+
+    if (!p->in_frame || !p->xfade_in_frame || !p->xfade_out_frame || !p->mix_frame ||
+        !p->downmix_frame || !p->xfade_downmix_frame)
+    {
         groove_playlist_destroy(playlist);
         av_log(NULL, AV_LOG_ERROR, "unable to allocate frame\n");
         return NULL;
@@ -1047,6 +1986,13 @@ void groove_playlist_destroy(struct GroovePlaylist *playlist) {
 
     avfilter_graph_free(&p->filter_graph);
     av_frame_free(&p->in_frame);
+    xfade_cancel(p);
+    av_frame_free(&p->xfade_in_frame);
+    av_frame_free(&p->xfade_out_frame);
+    av_frame_free(&p->mix_frame);
+    av_frame_free(&p->downmix_frame);
+    av_frame_free(&p->xfade_downmix_frame);
+    av_free(p->mix_gain);
 
     if (p->decode_head_mutex_inited)
         pthread_mutex_destroy(&p->decode_head_mutex);
@@ -1085,9 +2031,7 @@ void groove_playlist_seek(struct GroovePlaylist *playlist, struct GroovePlaylist
     struct GrooveFile * file = item->file;
     struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) file;
 
-    int64_t ts = seconds * f->audio_st->time_base.den / f->audio_st->time_base.num;
-    if (f->ic->start_time != AV_NOPTS_VALUE)
-        ts += f->ic->start_time;
+    int64_t ts = seconds_to_ts(f, seconds);
 
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
 
@@ -1099,6 +2043,9 @@ void groove_playlist_seek(struct GroovePlaylist *playlist, struct GroovePlaylist
 
     pthread_mutex_unlock(&f->seek_mutex);
 
+    xfade_cancel(p);
+    ramp_end(p);
+    p->xfade_tried = 0;
     p->decode_head = item;
     pthread_cond_signal(&p->decode_head_cond);
     pthread_mutex_unlock(&p->decode_head_mutex);
@@ -1140,7 +2087,9 @@ struct GroovePlaylistItem *groove_playlist_insert(struct GroovePlaylist *playlis
         f->seek_flush = 0;
         pthread_mutex_unlock(&f->seek_mutex);
 
+        ramp_end(p);
         p->decode_head = playlist->head;
+        p->xfade_tried = 0;
         pthread_cond_signal(&p->decode_head_cond);
     } else {
         item->prev = playlist->tail;
@@ -1172,9 +2121,19 @@ void groove_playlist_remove(struct GroovePlaylist *playlist, struct GroovePlayli
 
     pthread_mutex_lock(&p->decode_head_mutex);
 
-    // if it's currently being played, seek to the next item
+    // a fade from or to item is dropped, along with the audio of the next
+    // item that was not mixed in yet
+    if (item == p->decode_head || item == p->xfade_item)
+        xfade_cancel(p);
+
+    // if it's currently being played, seek to the next item. it starts
+    // over, even if it was fading in.
     if (item == p->decode_head) {
+        ramp_end(p);
         p->decode_head = item->next;
+        p->xfade_tried = 0;
+        if (p->decode_head)
+            seek_to_trim_start(p->decode_head);
     }
 
     if (item->prev) {
@@ -1231,6 +2190,7 @@ void groove_playlist_set_item_gain(struct GroovePlaylist *playlist, struct Groov
     pthread_mutex_lock(&p->decode_head_mutex);
     item->gain = gain;
     if (item == p->decode_head) {
+        ramp_end(p);
         update_playlist_volume(playlist);
     }
     pthread_mutex_unlock(&p->decode_head_mutex);
@@ -1244,11 +2204,118 @@ void groove_playlist_set_item_peak(struct GroovePlaylist *playlist, struct Groov
     pthread_mutex_lock(&p->decode_head_mutex);
     item->peak = peak;
     if (item == p->decode_head) {
+        ramp_end(p);
         update_playlist_volume(playlist);
     }
     pthread_mutex_unlock(&p->decode_head_mutex);
 }
 
+// decode_head_mutex must be held
+static void set_item_trim(struct GroovePlaylistPrivate *p, struct GroovePlaylistItem *item,
+        double start, double end)
+{
+    struct GrooveFilePrivate *f = (struct GrooveFilePrivate *) item->file;
+
+    item->trim_start = (start > 0) ? start : 0;
+    item->trim_end = (end > 0) ? end : 0;
+    // rather than decode up to the new start, seek to it. sinks are not
+    // flushed, since nothing from after start was sent yet. a seek to the
+    // start of the item that is still pending is replaced.
+    if (item == p->decode_head) {
+        pthread_mutex_lock(&f->seek_mutex);
+        int start_pending = (f->seek_pos >= 0 && !f->seek_flush);
+        if (start_pending || (f->seek_pos < 0 && item->trim_start > f->audio_clock)) {
+            f->seek_pos = (item->trim_start > 0) ? seconds_to_ts(f, item->trim_start) : 0;
+            f->seek_flush = 0;
+        }
+        pthread_mutex_unlock(&f->seek_mutex);
+    }
+}
+
+void groove_playlist_set_item_trim(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item, double start, double end)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    set_item_trim(p, item, start, end);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
+
+int groove_playlist_set_decode_trim(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item, double start, double end)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    // the decoder may have moved past item by the time a sink finds out
+    // where to trim it. the trim is then kept for the next time item is
+    // decoded, as long as item is still in the playlist.
+    pthread_mutex_lock(&p->decode_head_mutex);
+    struct GroovePlaylistItem *node = playlist->head;
+    while (node && node != item)
+        node = node->next;
+    if (node)
+        set_item_trim(p, item, start, end);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+
+    return node != NULL;
+}
+
+int groove_playlist_skip_item(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    // compare before touching item, which may have been removed already
+    int is_decode_head = (item == p->decode_head);
+    if (is_decode_head)
+        advance_decode_head(p);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+
+    return is_decode_head;
+}
+
+int groove_playlist_set_decode_gain(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item, double gain, double peak)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    // compare before touching item, which may have been removed already
+    int is_decode_head = (item == p->decode_head);
+    if (is_decode_head) {
+        // ramp from the gain the filter graph has now
+        if (item != p->ramp_item) {
+            ramp_end(p);
+            p->ramp_item = item;
+            p->ramp_volume = p->volume;
+            p->ramp_peak = p->peak;
+        }
+        item->gain = gain;
+        item->peak = peak;
+
+        // turning the gain down after the graph is always safe, and so is
+        // turning it up as long as the known peak stays below full scale.
+        // otherwise the graph is rebuilt, so that compand limits the new
+        // gain.
+        double volume = playlist->gain * gain;
+        double amp_vol = volume * (peak > 1.0 ? 1.0 : peak);
+        double ramp_amp_vol = p->ramp_volume * (p->ramp_peak > 1.0 ? 1.0 : p->ramp_peak);
+        if (p->ramp_volume > 0.0 &&
+            (volume <= p->ramp_volume || (amp_vol < 1.0 && ramp_amp_vol < 1.0)))
+        {
+            p->ramp_target = volume / p->ramp_volume;
+        } else {
+            ramp_end(p);
+            update_playlist_volume(playlist);
+        }
+    }
+    pthread_mutex_unlock(&p->decode_head_mutex);
+
+    return is_decode_head;
+}
+
 void groove_playlist_position(struct GroovePlaylist *playlist, struct GroovePlaylistItem **item,
         double *seconds)
 {
@@ -1275,8 +2342,10 @@ void groove_playlist_set_gain(struct GroovePlaylist *playlist, double gain) {
 
     pthread_mutex_lock(&p->decode_head_mutex);
     playlist->gain = gain;
-    if (p->decode_head)
+    if (p->decode_head) {
+        ramp_end(p);
         update_playlist_volume(playlist);
+    }
     pthread_mutex_unlock(&p->decode_head_mutex);
 }
 
@@ -1352,6 +2421,11 @@ int groove_sink_set_gain(struct GrooveSink *sink, double gain) {
     return 0;
 }
 
+void groove_sink_set_wake(struct GrooveSink *sink, void (*wake)(struct GrooveSink *)) {
+    struct GrooveSinkPrivate *s = (struct GrooveSinkPrivate *) sink;
+    s->wake = wake;
+}
+
 void groove_playlist_set_fill_mode(struct GroovePlaylist *playlist, int mode) {
     struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
 
@@ -1365,3 +2439,114 @@ void groove_playlist_set_fill_mode(struct GroovePlaylist *playlist, int mode) {
 
     pthread_mutex_unlock(&p->decode_head_mutex);
 }
+
+void groove_playlist_set_crossfade(struct GroovePlaylist *playlist,
+        double seconds, int curve)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    p->crossfade_duration = (seconds > 0) ? seconds : 0;
+    p->crossfade_curve = curve;
+    // a fade in progress keeps its length, but the item being decoded may
+    // now be close enough to its end to start one
+    p->xfade_tried = 0;
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
+
+void groove_playlist_set_downmix(struct GroovePlaylist *playlist,
+        double center_level, double surround_level, double lfe_level)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    p->downmix_center = center_level;
+    p->downmix_surround = surround_level;
+    p->downmix_lfe = lfe_level;
+    p->downmix_dirty = 1;
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
+
+int groove_playlist_wait_sinks(struct GroovePlaylist *playlist) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    pthread_mutex_lock(&p->drain_cond_mutex);
+    while (!p->wait_abort && p->detect_full_sinks(playlist)) {
+        pthread_mutex_unlock(&p->decode_head_mutex);
+        pthread_cond_wait(&p->sink_drain_cond, &p->drain_cond_mutex);
+        pthread_mutex_unlock(&p->drain_cond_mutex);
+        pthread_mutex_lock(&p->decode_head_mutex);
+        pthread_mutex_lock(&p->drain_cond_mutex);
+    }
+    int aborted = p->wait_abort;
+    pthread_mutex_unlock(&p->drain_cond_mutex);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+
+    return aborted ? -1 : 0;
+}
+
+void groove_playlist_abort_wait(struct GroovePlaylist *playlist, int abort) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->drain_cond_mutex);
+    p->wait_abort = abort;
+    pthread_cond_broadcast(&p->sink_drain_cond);
+    pthread_mutex_unlock(&p->drain_cond_mutex);
+}
+
+int groove_playlist_send_frame(struct GroovePlaylist *playlist, AVFrame *frame,
+        AVRational time_base, struct GroovePlaylistItem *item, double pos)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    // nobody to send it to
+    if (!p->sink_map) {
+        pthread_mutex_unlock(&p->decode_head_mutex);
+        return 0;
+    }
+    p->volume = playlist->gain;
+    p->peak = 1.0;
+    int err = maybe_init_filter_graph(playlist, frame->sample_rate, frame->channel_layout,
+            (enum AVSampleFormat)frame->format, time_base);
+    if (err >= 0) {
+        double clock_adjustment;
+        err = push_frame(playlist, frame, item, pos, &clock_adjustment);
+    }
+    pthread_mutex_unlock(&p->decode_head_mutex);
+
+    return (err < 0) ? err : 0;
+}
+
+void groove_playlist_send_end(struct GroovePlaylist *playlist) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    every_sink_signal_end(playlist);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
+
+void groove_playlist_send_flush(struct GroovePlaylist *playlist) {
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    every_sink_flush(playlist);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
+
+void groove_playlist_send_purge(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item)
+{
+    struct GroovePlaylistPrivate *p = (struct GroovePlaylistPrivate *) playlist;
+
+    pthread_mutex_lock(&p->decode_head_mutex);
+    p->purge_item = item;
+    every_sink(playlist, purge_sink, 0);
+    p->purge_item = NULL;
+
+    pthread_mutex_lock(&p->drain_cond_mutex);
+    pthread_cond_signal(&p->sink_drain_cond);
+    pthread_mutex_unlock(&p->drain_cond_mutex);
+    pthread_mutex_unlock(&p->decode_head_mutex);
+}
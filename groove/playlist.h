@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_PLAYLIST_H_INCLUDED
+#define GROOVE_PLAYLIST_H_INCLUDED
+
+#include "groove.h"
+
+#include <libavutil/frame.h>
+
+// these feed the sinks of a playlist with audio that does not come from its
+// own items, as GrooveMixer does. such a playlist must not have items.
+
+// blocks until the sinks of playlist want more audio.
+// returns < 0 if waiting was aborted
+int groove_playlist_wait_sinks(struct GroovePlaylist *playlist);
+
+// set abort to 1 to make groove_playlist_wait_sinks return at once, and
+// to 0 to let it wait again
+void groove_playlist_abort_wait(struct GroovePlaylist *playlist, int abort);
+
+// sends frame, with timestamps in time_base, through the filter graph to the
+// sinks, as audio of item at pos seconds. the playlist gain applies to it.
+// returns 0 on success, < 0 on error
+int groove_playlist_send_frame(struct GroovePlaylist *playlist, AVFrame *frame,
+        AVRational time_base, struct GroovePlaylistItem *item, double pos);
+
+// tells every sink that the audio ended, like the end of a playlist
+void groove_playlist_send_end(struct GroovePlaylist *playlist);
+
+// flushes every sink, like a seek
+void groove_playlist_send_flush(struct GroovePlaylist *playlist);
+
+// removes the buffers of item from every sink, like removing item
+void groove_playlist_send_purge(struct GroovePlaylist *playlist,
+        struct GroovePlaylistItem *item);
+
+#endif /* GROOVE_PLAYLIST_H_INCLUDED */
@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "silence.h"
+#include "queue.h"
+#include "cache.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#define CACHE_VERSION 1
+#define CACHE_SUFFIX ".silence"
+
+static const char cache_magic[4] = {'G', 'R', 'S', 'L'};
+
+// the item being analyzed. only touched while holding info_head_mutex.
+struct SilenceTrack {
+    int sample_rate;
+    uint64_t frame_count;
+    // the first loud frame, -1 until there is one, and the frame after the
+    // last loud frame
+    int64_t first_loud;
+    uint64_t loud_end;
+
+    // set if the cache had the item, which is then not analyzed
+    char cached;
+    double cached_values[3];
+    struct GrooveCacheKey key;
+    char key_valid;
+    char from_start;
+};
+
+struct GrooveSilenceDetectorPrivate {
+    struct GrooveSilenceDetector externals;
+
+    struct GrooveQueue *info_queue;
+
+    // info_head_mutex applies to variables inside this block.
+    pthread_mutex_t info_head_mutex;
+    char info_head_mutex_inited;
+    // current playlist item pointer
+    struct GroovePlaylistItem *info_head;
+    double info_pos;
+    // the analyzer thread waits on this when the info queue is full
+    pthread_cond_t drain_cond;
+    char drain_cond_inited;
+    // how many items are in the queue
+    int info_queue_count;
+    double album_duration;
+    struct SilenceTrack track;
+    // copies of the settings taken when attaching. threshold is in float
+    // format.
+    float threshold;
+    double min_duration;
+    char *cache_dir;
+    int auto_trim;
+    // a trim for set_decode_trim. plugin_buffer sets it while holding
+    // info_head_mutex and applies it after unlocking, because the playlist
+    // calls the purge callback with its own mutex held.
+    struct GroovePlaylistItem *trim_item;
+    double trim_start;
+    double trim_end;
+
+    // the analyzer the plugin was added to. with
+    // groove_silence_detector_attach it is own_analyzer.
+    struct GrooveAnalyzer *analyzer;
+    struct GrooveAnalyzer *own_analyzer;
+    struct GrooveAnalyzerPlugin plugin;
+
+    // set temporarily
+    struct GroovePlaylistItem *purge_item;
+
+    int abort_request;
+};
+
+// values are the duration, leading and trailing silence
+static int write_values(FILE *f, void *context) {
+    return groove_cache_write(f, context, 3 * sizeof(double));
+}
+
+// returns 0 on success, < 0 if the file cannot be found
+static int cache_key_init(struct GrooveCacheKey *key, const char *filename,
+        double threshold, double min_duration)
+{
+    double params[] = {threshold, min_duration};
+    return groove_cache_key_init(key, filename, params, 2);
+}
+
+// returns 1 and fills in values if the cache has the silence of key,
+// 0 otherwise
+static int cache_load(const char *cache_dir, const struct GrooveCacheKey *key,
+        double *values)
+{
+    FILE *f = groove_cache_open(cache_dir, key, CACHE_SUFFIX, cache_magic, CACHE_VERSION);
+    if (!f)
+        return 0;
+    int found = !groove_cache_read(f, values, 3 * sizeof(double));
+    fclose(f);
+    return found;
+}
+
+static void cache_store(const char *cache_dir, const struct GrooveCacheKey *key,
+        double *values)
+{
+    groove_cache_store(cache_dir, key, CACHE_SUFFIX, cache_magic, CACHE_VERSION,
+            write_values, values);
+}
+
+// where to trim a song given its duration, leading and trailing silence.
+// returns 0 if there is nothing to trim
+static int trim_from_values(const double *values, double *start, double *end) {
+    double duration = values[0];
+    double leading = values[1];
+    double trailing = values[2];
+    // leave songs that are silent throughout alone
+    if (leading >= duration || (leading <= 0.0 && trailing <= 0.0))
+        return 0;
+    *start = leading;
+    *end = (trailing > 0.0) ? duration - trailing : 0.0;
+    return 1;
+}
+
+// the index of the first sample of count that is not quieter than
+// threshold, or count. in a buffer with sound this stops right away.
+static int first_loud_index(const float *samples, int count, float threshold) {
+    for (int i = 0; i < count; i += 1) {
+        if (fabsf(samples[i]) >= threshold)
+            return i;
+    }
+    return count;
+}
+
+// the index of the last sample of count that is not quieter than
+// threshold, or -1
+static int last_loud_index(const float *samples, int count, float threshold) {
+    for (int i = count - 1; i >= 0; i -= 1) {
+        if (fabsf(samples[i]) >= threshold)
+            return i;
+    }
+    return -1;
+}
+
+static void track_add_buffer(struct GrooveSilenceDetectorPrivate *p, struct GrooveBuffer *buffer) {
+    struct SilenceTrack *track = &p->track;
+    int count = buffer->frame_count;
+    int channel_count = groove_channel_layout_count(buffer->format.channel_layout);
+
+    // the decode thread found the peak already. most buffers are either
+    // silent throughout or have sound at both ends.
+    int maybe_loud = 1;
+    if (buffer->peak) {
+        maybe_loud = 0;
+        for (int c = 0; c < channel_count; c += 1) {
+            if (buffer->peak[c] >= p->threshold)
+                maybe_loud = 1;
+        }
+    }
+
+    if (maybe_loud) {
+        int first = count;
+        int last = -1;
+        for (int c = 0; c < channel_count; c += 1) {
+            const float *samples = (const float *)buffer->data[c];
+            if (track->first_loud < 0) {
+                int index = first_loud_index(samples, count, p->threshold);
+                if (index < first) first = index;
+            }
+            int index = last_loud_index(samples, count, p->threshold);
+            if (index > last) last = index;
+        }
+        if (last >= 0) {
+            if (track->first_loud < 0)
+                track->first_loud = track->frame_count + first;
+            track->loud_end = track->frame_count + last + 1;
+        }
+    }
+
+    track->frame_count += count;
+}
+
+static void begin_track(struct GrooveSilenceDetectorPrivate *p, struct GrooveBuffer *buffer) {
+    struct SilenceTrack *track = &p->track;
+    track->sample_rate = buffer->format.sample_rate;
+    track->frame_count = 0;
+    track->first_loud = -1;
+    track->loud_end = 0;
+    track->cached = 0;
+    track->key_valid = 0;
+    // allow for files whose first timestamp is not quite 0. a trimmed item
+    // does not give the silence of the whole file.
+    struct GroovePlaylistItem *item = buffer->item;
+    track->from_start = (buffer->pos < 0.1 && item->trim_end <= 0.0);
+
+    if (!p->cache_dir)
+        return;
+    if (cache_key_init(&track->key, item->file->filename, p->threshold, p->min_duration) < 0)
+        return;
+    track->key_valid = 1;
+    track->cached = cache_load(p->cache_dir, &track->key, track->cached_values);
+
+    if (p->auto_trim && track->cached &&
+        trim_from_values(track->cached_values, &p->trim_start, &p->trim_end))
+    {
+        p->trim_item = item;
+    }
+}
+
+static void emit_track_info(struct GrooveSilenceDetectorPrivate *p) {
+    struct SilenceTrack *track = &p->track;
+
+    struct GrooveSilenceInfo *info = av_mallocz(sizeof(struct GrooveSilenceInfo));
+    if (!info) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate silence info\n");
+        return;
+    }
+    info->item = p->info_head;
+
+    if (track->cached) {
+        info->duration = track->cached_values[0];
+        info->leading = track->cached_values[1];
+        info->trailing = track->cached_values[2];
+        info->cached = 1;
+    } else {
+        double rate = track->sample_rate;
+        info->duration = track->frame_count / rate;
+        if (track->first_loud < 0) {
+            info->leading = info->duration;
+        } else {
+            info->leading = track->first_loud / rate;
+            info->trailing = (track->frame_count - track->loud_end) / rate;
+        }
+        if (info->leading < p->min_duration)
+            info->leading = 0.0;
+        if (info->trailing < p->min_duration)
+            info->trailing = 0.0;
+
+        if (p->cache_dir && track->key_valid && track->from_start) {
+            double values[3] = {info->duration, info->leading, info->trailing};
+            cache_store(p->cache_dir, &track->key, values);
+        }
+    }
+
+    p->album_duration += info->duration;
+    groove_queue_put(p->info_queue, info);
+}
+
+// sends the last track info and the sentinel. info_head_mutex must be held.
+static void detect_end(struct GrooveSilenceDetectorPrivate *p) {
+    if (p->info_head)
+        emit_track_info(p);
+
+    struct GrooveSilenceInfo *info = av_mallocz(sizeof(struct GrooveSilenceInfo));
+    if (info) {
+        info->duration = p->album_duration;
+        groove_queue_put(p->info_queue, info);
+    } else {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate album silence info\n");
+    }
+
+    p->album_duration = 0.0;
+    p->info_head = NULL;
+    p->info_pos = -1.0;
+}
+
+static void info_queue_cleanup(struct GrooveQueue* queue, void *obj) {
+    struct GrooveSilenceInfo *info = obj;
+    struct GrooveSilenceDetectorPrivate *p = queue->context;
+    p->info_queue_count -= 1;
+    av_free(info);
+}
+
+static void info_queue_put(struct GrooveQueue *queue, void *obj) {
+    struct GrooveSilenceDetectorPrivate *p = queue->context;
+    p->info_queue_count += 1;
+}
+
+static void info_queue_get(struct GrooveQueue *queue, void *obj) {
+    struct GrooveSilenceDetectorPrivate *p = queue->context;
+    struct GrooveSilenceDetector *detector = &p->externals;
+
+    p->info_queue_count -= 1;
+
+    if (p->info_queue_count < detector->info_queue_size)
+        pthread_cond_signal(&p->drain_cond);
+}
+
+static int info_queue_purge(struct GrooveQueue* queue, void *obj) {
+    struct GrooveSilenceInfo *info = obj;
+    struct GrooveSilenceDetectorPrivate *p = queue->context;
+
+    return info->item == p->purge_item;
+}
+
+static void plugin_attach(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylist *playlist) {
+    struct GrooveSilenceDetectorPrivate *p = plugin->userdata;
+    p->externals.playlist = playlist;
+    p->abort_request = 0;
+}
+
+static void plugin_detach(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveSilenceDetectorPrivate *p = plugin->userdata;
+    pthread_mutex_lock(&p->info_head_mutex);
+    p->abort_request = 1;
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_buffer(struct GrooveAnalyzerPlugin *plugin, struct GrooveBuffer *buffer) {
+    struct GrooveSilenceDetectorPrivate *p = plugin->userdata;
+    struct GrooveSilenceDetector *detector = &p->externals;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    while (!p->abort_request && p->info_queue_count >= detector->info_queue_size)
+        pthread_cond_wait(&p->drain_cond, &p->info_head_mutex);
+    if (p->abort_request) {
+        pthread_mutex_unlock(&p->info_head_mutex);
+        return;
+    }
+
+    if (buffer->item != p->info_head) {
+        if (p->info_head)
+            emit_track_info(p);
+        begin_track(p, buffer);
+        p->info_head = buffer->item;
+    }
+    if (!p->track.cached)
+        track_add_buffer(p, buffer);
+    p->info_pos = buffer->pos;
+
+    struct GroovePlaylistItem *trim_item = p->trim_item;
+    double trim_start = p->trim_start;
+    double trim_end = p->trim_end;
+    p->trim_item = NULL;
+    pthread_mutex_unlock(&p->info_head_mutex);
+
+    if (trim_item)
+        groove_playlist_set_decode_trim(detector->playlist, trim_item, trim_start, trim_end);
+}
+
+static void plugin_end(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveSilenceDetectorPrivate *p = plugin->userdata;
+    pthread_mutex_lock(&p->info_head_mutex);
+    detect_end(p);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_flush(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveSilenceDetectorPrivate *p = plugin->userdata;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    groove_queue_flush(p->info_queue);
+    p->info_head = NULL;
+    p->info_pos = -1.0;
+    p->trim_item = NULL;
+
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_purge(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylistItem *item) {
+    struct GrooveSilenceDetectorPrivate *p = plugin->userdata;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    p->purge_item = item;
+    groove_queue_purge(p->info_queue);
+    p->purge_item = NULL;
+
+    if (p->info_head == item) {
+        p->info_head = NULL;
+        p->info_pos = -1.0;
+    }
+    if (p->trim_item == item)
+        p->trim_item = NULL;
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+struct GrooveSilenceDetector *groove_silence_detector_create(void) {
+    struct GrooveSilenceDetectorPrivate *p = av_mallocz(sizeof(struct GrooveSilenceDetectorPrivate));
+    if (!p) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate silence detector\n");
+        return NULL;
+    }
+
+    struct GrooveSilenceDetector *detector = &p->externals;
+
+    if (pthread_mutex_init(&p->info_head_mutex, NULL) != 0) {
+        groove_silence_detector_destroy(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    p->info_head_mutex_inited = 1;
+
+    if (pthread_cond_init(&p->drain_cond, NULL) != 0) {
+        groove_silence_detector_destroy(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
+        return NULL;
+    }
+    p->drain_cond_inited = 1;
+
+    p->info_queue = groove_queue_create();
+    if (!p->info_queue) {
+        groove_silence_detector_destroy(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate queue\n");
+        return NULL;
+    }
+    p->info_queue->context = detector;
+    p->info_queue->cleanup = info_queue_cleanup;
+    p->info_queue->put = info_queue_put;
+    p->info_queue->get = info_queue_get;
+    p->info_queue->purge = info_queue_purge;
+
+    // planar float, so that each channel is one run of samples to scan.
+    // silence does not depend on the gain.
+    p->plugin.audio_format.sample_rate = 44100;
+    p->plugin.audio_format.channel_layout = GROOVE_CH_LAYOUT_STEREO;
+    p->plugin.audio_format.sample_fmt = GROOVE_SAMPLE_FMT_FLTP;
+    p->plugin.disable_gain = 1;
+    p->plugin.compute_levels = 1;
+    p->plugin.userdata = p;
+    p->plugin.attach = plugin_attach;
+    p->plugin.detach = plugin_detach;
+    p->plugin.buffer = plugin_buffer;
+    p->plugin.end = plugin_end;
+    p->plugin.flush = plugin_flush;
+    p->plugin.purge = plugin_purge;
+
+    // set some defaults
+    detector->info_queue_size = INT_MAX;
+    detector->sink_buffer_size = 8192;
+    detector->channel_layout = GROOVE_CH_LAYOUT_STEREO;
+    detector->threshold = -60.0;
+    detector->min_duration = 0.5;
+
+    return detector;
+}
+
+void groove_silence_detector_destroy(struct GrooveSilenceDetector *detector) {
+    if (!detector)
+        return;
+
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+
+    if (p->info_queue)
+        groove_queue_destroy(p->info_queue);
+
+    if (p->info_head_mutex_inited)
+        pthread_mutex_destroy(&p->info_head_mutex);
+
+    if (p->drain_cond_inited)
+        pthread_cond_destroy(&p->drain_cond);
+
+    av_free(p->cache_dir);
+    av_free(p);
+}
+
+int groove_silence_detector_attach_analyzer(struct GrooveSilenceDetector *detector,
+        struct GrooveAnalyzer *analyzer)
+{
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+
+    groove_queue_reset(p->info_queue);
+
+    p->threshold = pow(10.0, detector->threshold / 20.0);
+    p->min_duration = detector->min_duration;
+    p->auto_trim = detector->auto_trim;
+    p->trim_item = NULL;
+    p->album_duration = 0.0;
+    if (detector->cache_dir) {
+        p->cache_dir = av_strdup(detector->cache_dir);
+        if (!p->cache_dir) {
+            groove_silence_detector_detach(detector);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate silence cache path\n");
+            return -1;
+        }
+    }
+
+    p->plugin.audio_format.channel_layout = detector->channel_layout;
+    p->plugin.buffer_size = detector->sink_buffer_size;
+    if (groove_analyzer_add_plugin(analyzer, &p->plugin) < 0) {
+        groove_silence_detector_detach(detector);
+        return -1;
+    }
+    p->analyzer = analyzer;
+
+    return 0;
+}
+
+int groove_silence_detector_attach(struct GrooveSilenceDetector *detector,
+        struct GroovePlaylist *playlist)
+{
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+
+    p->own_analyzer = groove_analyzer_create();
+    if (!p->own_analyzer)
+        return -1;
+
+    if (groove_silence_detector_attach_analyzer(detector, p->own_analyzer) < 0)
+        return -1;
+
+    if (groove_analyzer_attach(p->own_analyzer, playlist) < 0) {
+        groove_silence_detector_detach(detector);
+        return -1;
+    }
+
+    return 0;
+}
+
+int groove_silence_detector_detach(struct GrooveSilenceDetector *detector) {
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+
+    if (p->own_analyzer)
+        groove_analyzer_detach(p->own_analyzer);
+
+    groove_queue_flush(p->info_queue);
+    groove_queue_abort(p->info_queue);
+
+    if (p->analyzer) {
+        groove_analyzer_remove_plugin(p->analyzer, &p->plugin);
+        p->analyzer = NULL;
+    }
+    groove_analyzer_destroy(p->own_analyzer);
+    p->own_analyzer = NULL;
+
+    detector->playlist = NULL;
+
+    av_free(p->cache_dir);
+    p->cache_dir = NULL;
+
+    p->abort_request = 0;
+    p->info_head = NULL;
+    p->info_pos = 0;
+    p->trim_item = NULL;
+
+    return 0;
+}
+
+int groove_silence_detector_info_get(struct GrooveSilenceDetector *detector,
+        struct GrooveSilenceInfo *info, int block)
+{
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+
+    struct GrooveSilenceInfo *info_ptr;
+    if (groove_queue_get(p->info_queue, (void**)&info_ptr, block) == 1) {
+        *info = *info_ptr;
+        av_free(info_ptr);
+        return 1;
+    }
+
+    return 0;
+}
+
+int groove_silence_detector_info_peek(struct GrooveSilenceDetector *detector,
+        int block)
+{
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+    return groove_queue_peek(p->info_queue, block);
+}
+
+void groove_silence_detector_position(struct GrooveSilenceDetector *detector,
+        struct GroovePlaylistItem **item, double *seconds)
+{
+    struct GrooveSilenceDetectorPrivate *p = (struct GrooveSilenceDetectorPrivate *) detector;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+
+    if (item)
+        *item = p->info_head;
+
+    if (seconds)
+        *seconds = p->info_pos;
+
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+int groove_silence_detector_trim_item(struct GrooveSilenceDetector *detector,
+        struct GroovePlaylist *playlist, struct GroovePlaylistItem *item)
+{
+    if (!detector->cache_dir)
+        return 0;
+
+    // the threshold is stored in float format, like when attached
+    float threshold = pow(10.0, detector->threshold / 20.0);
+    struct GrooveCacheKey key;
+    if (cache_key_init(&key, item->file->filename, threshold, detector->min_duration) < 0)
+        return 0;
+
+    double values[3];
+    double start;
+    double end;
+    if (!cache_load(detector->cache_dir, &key, values) ||
+        !trim_from_values(values, &start, &end))
+    {
+        return 0;
+    }
+
+    groove_playlist_set_item_trim(playlist, item, start, end);
+    return 1;
+}
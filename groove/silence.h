@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_SILENCE_H_INCLUDED
+#define GROOVE_SILENCE_H_INCLUDED
+
+#include "groove.h"
+#include "analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* use this to find the silence at the start and end of each playlist item,
+ * and to trim it with groove_playlist_set_item_trim.
+ * the audio is analyzed at 44100 Hz, in channel_layout. buffers that are silent
+ * throughout are recognized from their peak, which the decode thread
+ * computes, so the samples of a buffer are only looked at around where
+ * the sound starts and stops.
+ */
+
+struct GrooveSilenceInfo {
+    /* the playlist item that this info applies to.
+     * When this is NULL this is the end-of-playlist sentinel. Its duration
+     * is the total of all songs and other properties are undefined.
+     */
+    struct GroovePlaylistItem *item;
+
+    /* how many seconds long this song is */
+    double duration;
+
+    /* seconds of silence at the start and at the end, 0 if there is less
+     * than min_duration. if the song is silent throughout, leading is its
+     * duration and trailing is 0.
+     */
+    double leading;
+    double trailing;
+
+    /* 1 if this info came from cache_dir. it then describes the whole file,
+     * even if only part of it was played.
+     */
+    int cached;
+};
+
+struct GrooveSilenceDetector {
+    /* maximum number of GrooveSilenceInfo items to store in this
+     * detector's queue. this defaults to MAX_INT, meaning that
+     * the detector will cause the decoder to decode the entire
+     * playlist. if you want to instead, for example, find silence
+     * at the same time as playback, you might set this value to 1.
+     */
+    int info_queue_size;
+
+    /* how big the sink buffer should be, in sample frames.
+     * groove_silence_detector_create defaults this to 8192
+     */
+    int sink_buffer_size;
+
+    /* the channel layout to analyze the audio in. set this to 0 to analyze
+     * every file in its own channel layout, without downmixing it.
+     * defaults to GROOVE_CH_LAYOUT_STEREO
+     */
+    uint64_t channel_layout;
+
+    /* samples quieter than this, in dBFS, count as silence.
+     * defaults to -60.0
+     */
+    double threshold;
+
+    /* silence shorter than this many seconds is not reported.
+     * defaults to 0.5
+     */
+    double min_duration;
+
+    /* set to a directory to keep the silence of each file there, keyed by
+     * file name, size and modification time, and with the threshold and
+     * min_duration it was found with. songs found in the cache are not
+     * analyzed again. only songs decoded from start to end are stored.
+     * the directory must exist. the string is copied when attaching.
+     * defaults to NULL.
+     */
+    const char *cache_dir;
+
+    /* set to 1 to trim the silence of each song found in cache_dir as soon
+     * as its first audio arrives. the rest of its leading silence and all
+     * of its trailing silence is then not decoded or sent to any sink.
+     * a song that was decoded to the end before its first audio got here
+     * keeps the trim for the next time it is decoded.
+     * songs that are silent throughout are left alone.
+     * defaults to 0.
+     */
+    int auto_trim;
+
+    /* read-only. set when attached and cleared when detached */
+    struct GroovePlaylist *playlist;
+};
+
+struct GrooveSilenceDetector *groove_silence_detector_create(void);
+void groove_silence_detector_destroy(struct GrooveSilenceDetector *detector);
+
+/* once you attach, you must detach before destroying the playlist */
+int groove_silence_detector_attach(struct GrooveSilenceDetector *detector,
+        struct GroovePlaylist *playlist);
+int groove_silence_detector_detach(struct GrooveSilenceDetector *detector);
+
+/* instead of attaching to a playlist, analyze the audio of analyzer as one
+ * of its plugins. call this while analyzer is detached, and detach
+ * analyzer before detaching detector.
+ * returns 0 on success, < 0 on error
+ */
+int groove_silence_detector_attach_analyzer(struct GrooveSilenceDetector *detector,
+        struct GrooveAnalyzer *analyzer);
+
+/* returns < 0 on error, 0 on aborted (block=1) or no info ready (block=0),
+ * 1 on info returned
+ */
+int groove_silence_detector_info_get(struct GrooveSilenceDetector *detector,
+        struct GrooveSilenceInfo *info, int block);
+
+/* returns < 0 on error, 0 on no info ready, 1 on info ready
+ * if block is 1, block until info is ready
+ */
+int groove_silence_detector_info_peek(struct GrooveSilenceDetector *detector,
+        int block);
+
+/* get the position of the detect head
+ * both the current playlist item and the position in seconds in the playlist
+ * item are given. item will be set to NULL if the playlist is empty
+ * you may pass NULL for item or seconds
+ */
+void groove_silence_detector_position(struct GrooveSilenceDetector *detector,
+        struct GroovePlaylistItem **item, double *seconds);
+
+/* looks up the silence of item in cache_dir and trims item to leave it
+ * out. call this after inserting item into playlist to trim it before any
+ * of it is decoded. settings are read as they are; the detector need not
+ * be attached.
+ * returns 1 if item was trimmed, 0 if it is not in the cache or has no
+ * silence to trim
+ */
+int groove_silence_detector_trim_item(struct GrooveSilenceDetector *detector,
+        struct GroovePlaylist *playlist, struct GroovePlaylistItem *item);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_SILENCE_H_INCLUDED */
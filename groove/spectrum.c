@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "spectrum.h"
+
+#include <libavcodec/avfft.h>
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#define SPECTRUM_SAMPLE_RATE 44100
+#define SPECTRUM_FLOOR_DB -120.0
+#define SPECTRUM_TWO_PI 6.28318530717958647692
+
+struct GrooveSpectrumPrivate {
+    struct GrooveSpectrum externals;
+
+    struct GrooveSink *sink;
+    pthread_t thread_id;
+    char thread_inited;
+    int abort_request;
+
+    // copies of the settings taken when attaching
+    int fft_size;
+    int bin_count;
+    double min_frequency;
+    double max_frequency;
+    // how many frames to let through between transforms
+    int hop;
+
+    // only touched by spectrum_thread. ring holds the latest fft_size
+    // frames, the oldest at ring_pos.
+    RDFTContext *rdft;
+    float *window;
+    double window_scale;
+    float *ring;
+    int ring_pos;
+    int frames_since;
+    FFTSample *fft;
+    float *power;
+    float *levels;
+    // the range of transform bins each band covers
+    int *band_first;
+    int *band_last;
+    // set by the sink flush callback. spectrum_thread clears the ring.
+    int flush_request;
+
+    // readers copy latest and bins without a lock. seq is odd while a
+    // reading is being published, and readers retry if it changed while
+    // they copied. write_mutex only keeps the two writers, spectrum_thread
+    // and the sink purge callback, apart.
+    pthread_mutex_t write_mutex;
+    char write_mutex_inited;
+    uint32_t seq;
+    struct GrooveSpectrumReading latest;
+    float *bins;
+    // an item purged while spectrum_thread may still hold a buffer of it.
+    // write_mutex applies.
+    struct GroovePlaylistItem *purged_item;
+};
+
+static void publish_begin(struct GrooveSpectrumPrivate *p) {
+    pthread_mutex_lock(&p->write_mutex);
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void publish_end(struct GrooveSpectrumPrivate *p) {
+    __atomic_store_n(&p->seq, p->seq + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&p->write_mutex);
+}
+
+static double window_value(int window, int i, int size) {
+    double x = SPECTRUM_TWO_PI * i / size;
+    switch (window) {
+        case GROOVE_SPECTRUM_WINDOW_HAMMING:
+            return 0.54 - 0.46 * cos(x);
+        case GROOVE_SPECTRUM_WINDOW_BLACKMAN:
+            return 0.42 - 0.5 * cos(x) + 0.08 * cos(2.0 * x);
+        case GROOVE_SPECTRUM_WINDOW_RECTANGULAR:
+            return 1.0;
+        default:
+            return 0.5 - 0.5 * cos(x);
+    }
+}
+
+static double band_edge(struct GrooveSpectrumPrivate *p, double index) {
+    return p->min_frequency * pow(p->max_frequency / p->min_frequency, index / p->bin_count);
+}
+
+static int frequency_to_bin(struct GrooveSpectrumPrivate *p, double frequency) {
+    int bin = lrint(frequency * p->fft_size / SPECTRUM_SAMPLE_RATE);
+    if (bin < 0) return 0;
+    if (bin > p->fft_size / 2) return p->fft_size / 2;
+    return bin;
+}
+
+// works out which transform bins make up each band. a band narrower than
+// a bin takes the bin nearest to its center.
+static void init_bands(struct GrooveSpectrumPrivate *p) {
+    double bin_width = SPECTRUM_SAMPLE_RATE / (double)p->fft_size;
+    for (int b = 0; b < p->bin_count; b += 1) {
+        double low = band_edge(p, b);
+        double high = band_edge(p, b + 1);
+        int first = frequency_to_bin(p, ceil(low / bin_width) * bin_width);
+        int last = frequency_to_bin(p, floor(high / bin_width) * bin_width);
+        if (last < first) {
+            first = frequency_to_bin(p, sqrt(low * high));
+            last = first;
+        }
+        p->band_first[b] = first;
+        p->band_last[b] = last;
+    }
+}
+
+static void ring_reset(struct GrooveSpectrumPrivate *p) {
+    memset(p->ring, 0, p->fft_size * sizeof(float));
+    p->ring_pos = 0;
+    p->frames_since = 0;
+}
+
+// transforms the frames in the ring and publishes the band levels
+static void analyze(struct GrooveSpectrumPrivate *p, struct GroovePlaylistItem *item,
+        double pos)
+{
+    int size = p->fft_size;
+    int tail = size - p->ring_pos;
+    for (int i = 0; i < tail; i += 1)
+        p->fft[i] = p->ring[p->ring_pos + i] * p->window[i];
+    for (int i = tail; i < size; i += 1)
+        p->fft[i] = p->ring[i - tail] * p->window[i];
+
+    av_rdft_calc(p->rdft, p->fft);
+
+    // the real parts of the first and last bin are packed into fft[0] and
+    // fft[1], followed by the other bins as real and imaginary pairs
+    int half = size / 2;
+    p->power[0] = p->fft[0] * p->fft[0];
+    p->power[half] = p->fft[1] * p->fft[1];
+    for (int k = 1; k < half; k += 1)
+        p->power[k] = p->fft[2 * k] * p->fft[2 * k] + p->fft[2 * k + 1] * p->fft[2 * k + 1];
+
+    for (int b = 0; b < p->bin_count; b += 1) {
+        float peak = 0.0f;
+        for (int k = p->band_first[b]; k <= p->band_last[b]; k += 1)
+            peak = (p->power[k] > peak) ? p->power[k] : peak;
+        double db = (peak > 0.0f) ? 10.0 * log10(peak * p->window_scale) : SPECTRUM_FLOOR_DB;
+        p->levels[b] = (db > SPECTRUM_FLOOR_DB) ? db : SPECTRUM_FLOOR_DB;
+    }
+
+    publish_begin(p);
+    memcpy(p->bins, p->levels, p->bin_count * sizeof(float));
+    p->latest.item = (item == p->purged_item) ? NULL : item;
+    p->latest.pos = pos;
+    p->latest.count += 1;
+    publish_end(p);
+}
+
+// only the latest window matters, so at most one transform is done per
+// buffer no matter how many hops it spans
+static void add_buffer(struct GrooveSpectrumPrivate *p, struct GrooveBuffer *buffer) {
+    const float *samples = (const float *)buffer->data[0];
+    int size = p->fft_size;
+    int count = buffer->frame_count;
+    int skip = (count > size) ? count - size : 0;
+
+    for (int i = skip; i < count;) {
+        int chunk = size - p->ring_pos;
+        if (chunk > count - i)
+            chunk = count - i;
+        memcpy(p->ring + p->ring_pos, samples + i, chunk * sizeof(float));
+        p->ring_pos = (p->ring_pos + chunk) % size;
+        i += chunk;
+    }
+
+    p->frames_since += count;
+    if (p->frames_since < p->hop)
+        return;
+    p->frames_since %= p->hop;
+
+    analyze(p, buffer->item, buffer->pos + count / (double)SPECTRUM_SAMPLE_RATE);
+}
+
+static void *spectrum_thread(void *arg) {
+    struct GrooveSpectrumPrivate *p = arg;
+
+    struct GrooveBuffer *buffer;
+    while (!p->abort_request) {
+        pthread_mutex_lock(&p->write_mutex);
+        p->purged_item = NULL;
+        pthread_mutex_unlock(&p->write_mutex);
+
+        int result = groove_sink_buffer_get(p->sink, &buffer, 1);
+
+        if (result == GROOVE_BUFFER_END)
+            continue;
+
+        if (result != GROOVE_BUFFER_YES)
+            break;
+
+        if (__atomic_exchange_n(&p->flush_request, 0, __ATOMIC_ACQ_REL))
+            ring_reset(p);
+
+        add_buffer(p, buffer);
+        groove_buffer_unref(buffer);
+    }
+
+    return NULL;
+}
+
+static void sink_flush(struct GrooveSink *sink) {
+    struct GrooveSpectrumPrivate *p = sink->userdata;
+    __atomic_store_n(&p->flush_request, 1, __ATOMIC_RELEASE);
+}
+
+static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
+    struct GrooveSpectrumPrivate *p = sink->userdata;
+
+    publish_begin(p);
+    p->purged_item = item;
+    if (p->latest.item == item)
+        p->latest.item = NULL;
+    publish_end(p);
+}
+
+struct GrooveSpectrum *groove_spectrum_create(void) {
+    struct GrooveSpectrumPrivate *p = av_mallocz(sizeof(struct GrooveSpectrumPrivate));
+    if (!p) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate spectrum\n");
+        return NULL;
+    }
+
+    struct GrooveSpectrum *spectrum = &p->externals;
+
+    if (pthread_mutex_init(&p->write_mutex, NULL) != 0) {
+        groove_spectrum_destroy(spectrum);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    p->write_mutex_inited = 1;
+
+    p->sink = groove_sink_create();
+    if (!p->sink) {
+        groove_spectrum_destroy(spectrum);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate sink\n");
+        return NULL;
+    }
+    p->sink->audio_format.sample_rate = SPECTRUM_SAMPLE_RATE;
+    p->sink->audio_format.channel_layout = GROOVE_CH_LAYOUT_MONO;
+    p->sink->audio_format.sample_fmt = GROOVE_SAMPLE_FMT_FLT;
+    p->sink->userdata = p;
+    p->sink->flush = sink_flush;
+    p->sink->purge = sink_purge;
+
+    // set some defaults
+    spectrum->fft_size = 2048;
+    spectrum->window = GROOVE_SPECTRUM_WINDOW_HANN;
+    spectrum->overlap = 0.5;
+    spectrum->max_rate = 60.0;
+    spectrum->bin_count = 64;
+    spectrum->min_frequency = 20.0;
+    spectrum->max_frequency = 20000.0;
+    spectrum->sink_buffer_size = 1024;
+
+    return spectrum;
+}
+
+void groove_spectrum_destroy(struct GrooveSpectrum *spectrum) {
+    if (!spectrum)
+        return;
+
+    struct GrooveSpectrumPrivate *p = (struct GrooveSpectrumPrivate *) spectrum;
+
+    if (p->sink)
+        groove_sink_destroy(p->sink);
+
+    if (p->write_mutex_inited)
+        pthread_mutex_destroy(&p->write_mutex);
+
+    av_free(p);
+}
+
+static int check_settings(struct GrooveSpectrum *spectrum) {
+    int size = spectrum->fft_size;
+    if (size < 32 || size > 65536 || (size & (size - 1)) != 0) {
+        av_log(NULL, AV_LOG_ERROR, "invalid spectrum fft_size\n");
+        return -1;
+    }
+    if (!(spectrum->overlap >= 0.0 && spectrum->overlap < 1.0) ||
+        !(spectrum->max_rate > 0.0))
+    {
+        av_log(NULL, AV_LOG_ERROR, "invalid spectrum overlap or max_rate\n");
+        return -1;
+    }
+    if (spectrum->bin_count < 1 || !(spectrum->min_frequency > 0.0) ||
+        !(spectrum->max_frequency > spectrum->min_frequency))
+    {
+        av_log(NULL, AV_LOG_ERROR, "invalid spectrum bands\n");
+        return -1;
+    }
+    return 0;
+}
+
+int groove_spectrum_attach(struct GrooveSpectrum *spectrum,
+        struct GroovePlaylist *playlist)
+{
+    struct GrooveSpectrumPrivate *p = (struct GrooveSpectrumPrivate *) spectrum;
+
+    if (check_settings(spectrum) < 0)
+        return -1;
+
+    spectrum->playlist = playlist;
+
+    p->fft_size = spectrum->fft_size;
+    p->bin_count = spectrum->bin_count;
+    p->min_frequency = spectrum->min_frequency;
+    p->max_frequency = spectrum->max_frequency;
+    int overlap_hop = lrint(p->fft_size * (1.0 - spectrum->overlap));
+    int rate_hop = lrint(SPECTRUM_SAMPLE_RATE / spectrum->max_rate);
+    p->hop = (overlap_hop > rate_hop) ? overlap_hop : rate_hop;
+    if (p->hop < 1)
+        p->hop = 1;
+
+    int nbits = 0;
+    while ((1 << nbits) < p->fft_size)
+        nbits += 1;
+    p->rdft = av_rdft_init(nbits, DFT_R2C);
+    p->window = av_malloc(p->fft_size * sizeof(float));
+    p->ring = av_malloc(p->fft_size * sizeof(float));
+    p->fft = av_malloc(p->fft_size * sizeof(FFTSample));
+    p->power = av_malloc((p->fft_size / 2 + 1) * sizeof(float));
+    p->levels = av_malloc(p->bin_count * sizeof(float));
+    p->band_first = av_malloc(p->bin_count * sizeof(int));
+    p->band_last = av_malloc(p->bin_count * sizeof(int));
+    float *bins = av_malloc(p->bin_count * sizeof(float));
+    if (!p->rdft || !p->window || !p->ring || !p->fft || !p->power || !p->levels ||
+        !p->band_first || !p->band_last || !bins)
+    {
+        av_free(bins);
+        groove_spectrum_detach(spectrum);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate spectrum\n");
+        return -1;
+    }
+
+    // scale the power so that a full scale sine wave reads 0 dB whatever
+    // the window
+    double window_sum = 0.0;
+    for (int i = 0; i < p->fft_size; i += 1) {
+        p->window[i] = window_value(spectrum->window, i, p->fft_size);
+        window_sum += p->window[i];
+    }
+    p->window_scale = 4.0 / (window_sum * window_sum);
+
+    init_bands(p);
+    ring_reset(p);
+    p->flush_request = 0;
+    p->abort_request = 0;
+
+    publish_begin(p);
+    p->bins = bins;
+    memset(&p->latest, 0, sizeof(struct GrooveSpectrumReading));
+    publish_end(p);
+
+    p->sink->buffer_size = spectrum->sink_buffer_size;
+    if (groove_sink_attach(p->sink, playlist) < 0) {
+        groove_spectrum_detach(spectrum);
+        av_log(NULL, AV_LOG_ERROR, "unable to attach sink\n");
+        return -1;
+    }
+
+    if (pthread_create(&p->thread_id, NULL, spectrum_thread, spectrum) != 0) {
+        groove_spectrum_detach(spectrum);
+        av_log(NULL, AV_LOG_ERROR, "unable to create spectrum thread\n");
+        return -1;
+    }
+    p->thread_inited = 1;
+
+    return 0;
+}
+
+int groove_spectrum_detach(struct GrooveSpectrum *spectrum) {
+    struct GrooveSpectrumPrivate *p = (struct GrooveSpectrumPrivate *) spectrum;
+
+    p->abort_request = 1;
+    if (p->sink->playlist)
+        groove_sink_detach(p->sink);
+    if (p->thread_inited) {
+        pthread_join(p->thread_id, NULL);
+        p->thread_inited = 0;
+    }
+
+    publish_begin(p);
+    float *bins = p->bins;
+    p->bins = NULL;
+    publish_end(p);
+    av_free(bins);
+
+    if (p->rdft) {
+        av_rdft_end(p->rdft);
+        p->rdft = NULL;
+    }
+    av_freep(&p->window);
+    av_freep(&p->ring);
+    av_freep(&p->fft);
+    av_freep(&p->power);
+    av_freep(&p->levels);
+    av_freep(&p->band_first);
+    av_freep(&p->band_last);
+
+    spectrum->playlist = NULL;
+    p->abort_request = 0;
+
+    return 0;
+}
+
+int groove_spectrum_get(struct GrooveSpectrum *spectrum,
+        struct GrooveSpectrumReading *reading, float *bins)
+{
+    struct GrooveSpectrumPrivate *p = (struct GrooveSpectrumPrivate *) spectrum;
+
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&p->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        if (!p->bins)
+            return 0;
+        *reading = p->latest;
+        memcpy(bins, p->bins, p->bin_count * sizeof(float));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&p->seq, __ATOMIC_RELAXED) == seq)
+            break;
+    }
+
+    return reading->count > 0;
+}
+
+double groove_spectrum_bin_frequency(struct GrooveSpectrum *spectrum, int index) {
+    struct GrooveSpectrumPrivate *p = (struct GrooveSpectrumPrivate *) spectrum;
+    return sqrt(band_edge(p, index) * band_edge(p, index + 1));
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_SPECTRUM_H_INCLUDED
+#define GROOVE_SPECTRUM_H_INCLUDED
+
+#include "groove.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* attach a GrooveSpectrum to a playlist to keep the frequency spectrum of
+ * the latest audio up to date, for visualizers. it has one FFT per
+ * playlist, which any number of threads can read with
+ * groove_spectrum_get without taking a lock.
+ * the audio is mixed down to mono at 44100 Hz. its own thread takes every
+ * buffer from the sink as soon as it is decoded and only transforms the
+ * latest window, skipping windows when it falls behind.
+ * because of that its sink is never full, so the playlist must use
+ * GROOVE_ANY_SINK_FULL. the other sinks then decide how far ahead the
+ * playlist decodes. with GROOVE_EVERY_SINK_FULL, the default, the playlist
+ * would never stop decoding, and the queues of the other sinks would grow
+ * without bound.
+ */
+
+#define GROOVE_SPECTRUM_WINDOW_HANN        0
+#define GROOVE_SPECTRUM_WINDOW_HAMMING     1
+#define GROOVE_SPECTRUM_WINDOW_BLACKMAN    2
+#define GROOVE_SPECTRUM_WINDOW_RECTANGULAR 3
+
+struct GrooveSpectrumReading {
+    /* the playlist item the audio came from. NULL if it has since been
+     * removed from the playlist
+     */
+    struct GroovePlaylistItem *item;
+    /* position in seconds in item at the end of the transformed window */
+    double pos;
+    /* how many readings were taken since attaching. compare it with the
+     * previous reading to find out whether this one is new.
+     */
+    uint64_t count;
+};
+
+struct GrooveSpectrum {
+    /* how many frames each transform covers. must be a power of two from
+     * 32 to 65536. defaults to 2048
+     */
+    int fft_size;
+
+    /* one of the GROOVE_SPECTRUM_WINDOW_* values.
+     * defaults to GROOVE_SPECTRUM_WINDOW_HANN
+     */
+    int window;
+
+    /* how much consecutive windows overlap, from 0 up to but not including
+     * 1. defaults to 0.5
+     */
+    double overlap;
+
+    /* at most this many readings are taken per second of audio. windows in
+     * between are skipped. defaults to 60
+     */
+    double max_rate;
+
+    /* readings have bin_count values, one per band. the bands are spaced
+     * evenly on a log scale from min_frequency to max_frequency.
+     * defaults to 64 bands from 20 Hz to 20000 Hz
+     */
+    int bin_count;
+    double min_frequency;
+    double max_frequency;
+
+    /* how big the sink buffer should be, in sample frames.
+     * groove_spectrum_create defaults this to 1024
+     */
+    int sink_buffer_size;
+
+    /* read-only. set when attached and cleared when detached */
+    struct GroovePlaylist *playlist;
+};
+
+struct GrooveSpectrum *groove_spectrum_create(void);
+void groove_spectrum_destroy(struct GrooveSpectrum *spectrum);
+
+/* once you attach, you must detach before destroying the playlist.
+ * the settings are read when attaching. set the fill mode of playlist to
+ * GROOVE_ANY_SINK_FULL, see above.
+ * returns 0 on success, < 0 on error
+ */
+int groove_spectrum_attach(struct GrooveSpectrum *spectrum,
+        struct GroovePlaylist *playlist);
+int groove_spectrum_detach(struct GrooveSpectrum *spectrum);
+
+/* copies the latest reading into reading and its bin_count band levels
+ * into bins, in dB relative to a full scale sine wave, no lower than -120.
+ * returns 1 if there is a reading, 0 if there is none yet.
+ * this never blocks: it only retries the copy if a reading was published
+ * during it, so it can be polled from any number of threads at any rate,
+ * except while groove_spectrum_detach is running.
+ */
+int groove_spectrum_get(struct GrooveSpectrum *spectrum,
+        struct GrooveSpectrumReading *reading, float *bins);
+
+/* the center frequency in Hz of band index while attached */
+double groove_spectrum_bin_frequency(struct GrooveSpectrum *spectrum, int index);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_SPECTRUM_H_INCLUDED */
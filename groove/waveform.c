@@ -0,0 +1,759 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "waveform.h"
+#include "queue.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include <pthread.h>
+
+#define WAVEFORM_MAX_CHANNELS 8
+#define WAVEFORM_VERSION 1
+
+static const char waveform_magic[4] = {'G', 'R', 'W', 'F'};
+
+// the item being analyzed. only touched while holding info_head_mutex.
+struct WaveformTrack {
+    int sample_rate;
+    int channel_count;
+    uint64_t frame_count;
+
+    // the bin being filled, per channel
+    float bin_min[WAVEFORM_MAX_CHANNELS];
+    float bin_max[WAVEFORM_MAX_CHANNELS];
+    double bin_sum[WAVEFORM_MAX_CHANNELS];
+    int bin_frames;
+
+    // the finished bins of the first level. emit_track_info takes them over.
+    float *min;
+    float *max;
+    float *rms;
+    int bin_count;
+    int bin_capacity;
+    // set when a bin could not be stored. the rest of the track is ignored
+    // and no info is sent for it.
+    char failed;
+};
+
+struct GrooveWaveformPrivate {
+    struct GrooveWaveform externals;
+
+    struct GrooveQueue *info_queue;
+
+    // info_head_mutex applies to variables inside this block.
+    pthread_mutex_t info_head_mutex;
+    char info_head_mutex_inited;
+    // current playlist item pointer
+    struct GroovePlaylistItem *info_head;
+    double info_pos;
+    // the analyzer thread waits on this when the info queue is full
+    pthread_cond_t drain_cond;
+    char drain_cond_inited;
+    // how many items are in the queue
+    int info_queue_count;
+    double album_duration;
+    struct WaveformTrack track;
+    // copies of base_bin_size and max_bin_size taken when attaching
+    int base_bin_size;
+    int max_bin_size;
+
+    // the analyzer the plugin was added to. with groove_waveform_attach it
+    // is own_analyzer.
+    struct GrooveAnalyzer *analyzer;
+    struct GrooveAnalyzer *own_analyzer;
+    struct GrooveAnalyzerPlugin plugin;
+
+    // set temporarily
+    struct GroovePlaylistItem *purge_item;
+
+    int abort_request;
+};
+
+static void track_reset(struct WaveformTrack *track) {
+    track->frame_count = 0;
+    track->bin_frames = 0;
+    track->bin_count = 0;
+    track->failed = 0;
+    for (int c = 0; c < WAVEFORM_MAX_CHANNELS; c += 1) {
+        track->bin_min[c] = FLT_MAX;
+        track->bin_max[c] = -FLT_MAX;
+        track->bin_sum[c] = 0.0;
+    }
+}
+
+static void track_free(struct WaveformTrack *track) {
+    av_free(track->min);
+    av_free(track->max);
+    av_free(track->rms);
+    track->min = NULL;
+    track->max = NULL;
+    track->rms = NULL;
+    track->bin_capacity = 0;
+    track_reset(track);
+}
+
+// adds the min, max and sum of squares of count samples to the bin. four
+// independent accumulators let the compiler keep them in vector registers.
+static void scan_samples(const float *samples, int count, float *min, float *max,
+        double *sum)
+{
+    float lo[4], hi[4], squares[4];
+    for (int k = 0; k < 4; k += 1) {
+        lo[k] = *min;
+        hi[k] = *max;
+        squares[k] = 0.0f;
+    }
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        for (int k = 0; k < 4; k += 1) {
+            float x = samples[i + k];
+            lo[k] = (x < lo[k]) ? x : lo[k];
+            hi[k] = (x > hi[k]) ? x : hi[k];
+            squares[k] += x * x;
+        }
+    }
+    for (; i < count; i += 1) {
+        float x = samples[i];
+        lo[0] = (x < lo[0]) ? x : lo[0];
+        hi[0] = (x > hi[0]) ? x : hi[0];
+        squares[0] += x * x;
+    }
+
+    for (int k = 0; k < 4; k += 1) {
+        *min = (lo[k] < *min) ? lo[k] : *min;
+        *max = (hi[k] > *max) ? hi[k] : *max;
+        *sum += squares[k];
+    }
+}
+
+static int finish_bin(struct WaveformTrack *track) {
+    if (track->bin_count >= track->bin_capacity) {
+        int new_capacity = track->bin_capacity ? track->bin_capacity * 2 : 1024;
+        size_t size = new_capacity * track->channel_count * sizeof(float);
+        float *new_min = av_realloc(track->min, size);
+        if (new_min)
+            track->min = new_min;
+        float *new_max = av_realloc(track->max, size);
+        if (new_max)
+            track->max = new_max;
+        float *new_rms = av_realloc(track->rms, size);
+        if (new_rms)
+            track->rms = new_rms;
+        if (!new_min || !new_max || !new_rms) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate waveform\n");
+            return -1;
+        }
+        track->bin_capacity = new_capacity;
+    }
+
+    int base = track->bin_count * track->channel_count;
+    for (int c = 0; c < track->channel_count; c += 1) {
+        track->min[base + c] = track->bin_min[c];
+        track->max[base + c] = track->bin_max[c];
+        track->rms[base + c] = sqrt(track->bin_sum[c] / track->bin_frames);
+        track->bin_min[c] = FLT_MAX;
+        track->bin_max[c] = -FLT_MAX;
+        track->bin_sum[c] = 0.0;
+    }
+    track->bin_count += 1;
+    track->bin_frames = 0;
+    return 0;
+}
+
+static void track_add_buffer(struct GrooveWaveformPrivate *p, struct GrooveBuffer *buffer) {
+    struct WaveformTrack *track = &p->track;
+    if (track->failed)
+        return;
+    int i = 0;
+    while (i < buffer->frame_count) {
+        int count = buffer->frame_count - i;
+        if (count > p->base_bin_size - track->bin_frames)
+            count = p->base_bin_size - track->bin_frames;
+        for (int c = 0; c < track->channel_count; c += 1) {
+            const float *samples = (const float *)buffer->data[c];
+            scan_samples(samples + i, count, &track->bin_min[c], &track->bin_max[c],
+                    &track->bin_sum[c]);
+        }
+        track->bin_frames += count;
+        i += count;
+        if (track->bin_frames == p->base_bin_size && finish_bin(track) < 0) {
+            track->failed = 1;
+            return;
+        }
+    }
+    track->frame_count += buffer->frame_count;
+}
+
+// how many frames bin index of a level covers
+static double bin_frames(const struct GrooveWaveformLevel *level, int index,
+        uint64_t frame_count)
+{
+    if (index < level->bin_count - 1)
+        return level->bin_size;
+    return frame_count - (uint64_t)(level->bin_count - 1) * level->bin_size;
+}
+
+// makes level out of the bins of prev, two at a time
+static int build_level(struct GrooveWaveformLevel *level, const struct GrooveWaveformLevel *prev,
+        int channel_count, uint64_t frame_count)
+{
+    level->bin_size = prev->bin_size * 2;
+    level->bin_count = (prev->bin_count + 1) / 2;
+    size_t size = level->bin_count * channel_count * sizeof(float);
+    level->min = av_malloc(size);
+    level->max = av_malloc(size);
+    level->rms = av_malloc(size);
+    if (!level->min || !level->max || !level->rms)
+        return -1;
+
+    for (int i = 0; i < level->bin_count; i += 1) {
+        int a = i * 2;
+        int b = (a + 1 < prev->bin_count) ? a + 1 : a;
+        double frames_a = bin_frames(prev, a, frame_count);
+        double frames_b = (b != a) ? bin_frames(prev, b, frame_count) : 0.0;
+        for (int c = 0; c < channel_count; c += 1) {
+            int ia = a * channel_count + c;
+            int ib = b * channel_count + c;
+            int out = i * channel_count + c;
+            level->min[out] = (prev->min[ia] < prev->min[ib]) ? prev->min[ia] : prev->min[ib];
+            level->max[out] = (prev->max[ia] > prev->max[ib]) ? prev->max[ia] : prev->max[ib];
+            double energy = prev->rms[ia] * prev->rms[ia] * frames_a +
+                prev->rms[ib] * prev->rms[ib] * frames_b;
+            level->rms[out] = sqrt(energy / (frames_a + frames_b));
+        }
+    }
+    return 0;
+}
+
+static int emit_track_info(struct GrooveWaveformPrivate *p) {
+    struct WaveformTrack *track = &p->track;
+    if (track->failed || (track->bin_frames > 0 && finish_bin(track) < 0)) {
+        track_reset(track);
+        return -1;
+    }
+
+    struct GrooveWaveformInfo *info = av_mallocz(sizeof(struct GrooveWaveformInfo));
+    int level_count = 1;
+    for (int64_t size = (int64_t)p->base_bin_size * 2; size <= p->max_bin_size; size *= 2)
+        level_count += 1;
+    struct GrooveWaveformLevel *levels = av_mallocz(level_count * sizeof(struct GrooveWaveformLevel));
+    if (!info || !levels) {
+        av_free(info);
+        av_free(levels);
+        track_reset(track);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate waveform info\n");
+        return -1;
+    }
+
+    uint64_t frame_count = track->frame_count;
+    info->item = p->info_head;
+    info->sample_rate = track->sample_rate;
+    info->channel_count = track->channel_count;
+    info->duration = track->sample_rate ? frame_count / (double)track->sample_rate : 0.0;
+    info->level_count = level_count;
+    info->levels = levels;
+    p->album_duration += info->duration;
+
+    // the first level takes over the bins of the track
+    levels[0].bin_size = p->base_bin_size;
+    levels[0].bin_count = track->bin_count;
+    levels[0].min = track->min;
+    levels[0].max = track->max;
+    levels[0].rms = track->rms;
+    track->min = NULL;
+    track->max = NULL;
+    track->rms = NULL;
+    track->bin_capacity = 0;
+    track_reset(track);
+
+    for (int i = 1; i < level_count; i += 1) {
+        if (build_level(&levels[i], &levels[i - 1], info->channel_count, frame_count) < 0) {
+            groove_waveform_free_info(info);
+            av_free(info);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate waveform info\n");
+            return -1;
+        }
+    }
+
+    groove_queue_put(p->info_queue, info);
+    return 0;
+}
+
+// sends the last track info and the sentinel. info_head_mutex must be held.
+static void waveform_end(struct GrooveWaveformPrivate *p) {
+    if (p->info_head)
+        emit_track_info(p);
+
+    struct GrooveWaveformInfo *info = av_mallocz(sizeof(struct GrooveWaveformInfo));
+    if (info) {
+        info->duration = p->album_duration;
+        groove_queue_put(p->info_queue, info);
+    } else {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate album waveform info\n");
+    }
+
+    p->album_duration = 0.0;
+    p->info_head = NULL;
+    p->info_pos = -1.0;
+}
+
+static void info_queue_cleanup(struct GrooveQueue* queue, void *obj) {
+    struct GrooveWaveformInfo *info = obj;
+    struct GrooveWaveformPrivate *p = queue->context;
+    p->info_queue_count -= 1;
+    groove_waveform_free_info(info);
+    av_free(info);
+}
+
+static void info_queue_put(struct GrooveQueue *queue, void *obj) {
+    struct GrooveWaveformPrivate *p = queue->context;
+    p->info_queue_count += 1;
+}
+
+static void info_queue_get(struct GrooveQueue *queue, void *obj) {
+    struct GrooveWaveformPrivate *p = queue->context;
+    struct GrooveWaveform *waveform = &p->externals;
+
+    p->info_queue_count -= 1;
+
+    if (p->info_queue_count < waveform->info_queue_size)
+        pthread_cond_signal(&p->drain_cond);
+}
+
+static int info_queue_purge(struct GrooveQueue* queue, void *obj) {
+    struct GrooveWaveformInfo *info = obj;
+    struct GrooveWaveformPrivate *p = queue->context;
+
+    return info->item == p->purge_item;
+}
+
+static void plugin_attach(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylist *playlist) {
+    struct GrooveWaveformPrivate *p = plugin->userdata;
+    p->externals.playlist = playlist;
+    p->abort_request = 0;
+}
+
+static void plugin_detach(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveWaveformPrivate *p = plugin->userdata;
+    pthread_mutex_lock(&p->info_head_mutex);
+    p->abort_request = 1;
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_buffer(struct GrooveAnalyzerPlugin *plugin, struct GrooveBuffer *buffer) {
+    struct GrooveWaveformPrivate *p = plugin->userdata;
+    struct GrooveWaveform *waveform = &p->externals;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    while (!p->abort_request && p->info_queue_count >= waveform->info_queue_size)
+        pthread_cond_wait(&p->drain_cond, &p->info_head_mutex);
+    if (p->abort_request) {
+        pthread_mutex_unlock(&p->info_head_mutex);
+        return;
+    }
+
+    if (buffer->item != p->info_head) {
+        if (p->info_head)
+            emit_track_info(p);
+        track_reset(&p->track);
+        p->track.sample_rate = buffer->format.sample_rate;
+        p->track.channel_count = groove_channel_layout_count(buffer->format.channel_layout);
+        if (p->track.channel_count > WAVEFORM_MAX_CHANNELS) {
+            av_log(NULL, AV_LOG_ERROR, "unable to draw a waveform of more than %d channels\n",
+                    WAVEFORM_MAX_CHANNELS);
+            p->track.channel_count = WAVEFORM_MAX_CHANNELS;
+            p->track.failed = 1;
+        }
+        p->info_head = buffer->item;
+        p->info_pos = buffer->pos;
+    }
+    track_add_buffer(p, buffer);
+    p->info_pos = buffer->pos;
+
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_end(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveWaveformPrivate *p = plugin->userdata;
+    pthread_mutex_lock(&p->info_head_mutex);
+    waveform_end(p);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_flush(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveWaveformPrivate *p = plugin->userdata;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    groove_queue_flush(p->info_queue);
+    track_reset(&p->track);
+    p->info_head = NULL;
+    p->info_pos = -1.0;
+
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_purge(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylistItem *item) {
+    struct GrooveWaveformPrivate *p = plugin->userdata;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    p->purge_item = item;
+    groove_queue_purge(p->info_queue);
+    p->purge_item = NULL;
+
+    if (p->info_head == item) {
+        p->info_head = NULL;
+        p->info_pos = -1.0;
+    }
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+struct GrooveWaveform *groove_waveform_create(void) {
+    struct GrooveWaveformPrivate *p = av_mallocz(sizeof(struct GrooveWaveformPrivate));
+    if (!p) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate waveform\n");
+        return NULL;
+    }
+
+    struct GrooveWaveform *waveform = &p->externals;
+
+    if (pthread_mutex_init(&p->info_head_mutex, NULL) != 0) {
+        groove_waveform_destroy(waveform);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    p->info_head_mutex_inited = 1;
+
+    if (pthread_cond_init(&p->drain_cond, NULL) != 0) {
+        groove_waveform_destroy(waveform);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
+        return NULL;
+    }
+    p->drain_cond_inited = 1;
+
+    p->info_queue = groove_queue_create();
+    if (!p->info_queue) {
+        groove_waveform_destroy(waveform);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate queue\n");
+        return NULL;
+    }
+    p->info_queue->context = waveform;
+    p->info_queue->cleanup = info_queue_cleanup;
+    p->info_queue->put = info_queue_put;
+    p->info_queue->get = info_queue_get;
+    p->info_queue->purge = info_queue_purge;
+
+    // planar float, so that each channel is one run of samples to scan
+    p->plugin.audio_format.sample_rate = 44100;
+    p->plugin.audio_format.channel_layout = GROOVE_CH_LAYOUT_STEREO;
+    p->plugin.audio_format.sample_fmt = GROOVE_SAMPLE_FMT_FLTP;
+    p->plugin.userdata = p;
+    p->plugin.attach = plugin_attach;
+    p->plugin.detach = plugin_detach;
+    p->plugin.buffer = plugin_buffer;
+    p->plugin.end = plugin_end;
+    p->plugin.flush = plugin_flush;
+    p->plugin.purge = plugin_purge;
+
+    track_reset(&p->track);
+
+    // set some defaults
+    waveform->info_queue_size = INT_MAX;
+    waveform->sink_buffer_size = 8192;
+    waveform->channel_layout = GROOVE_CH_LAYOUT_STEREO;
+    waveform->base_bin_size = 256;
+    waveform->max_bin_size = 65536;
+
+    return waveform;
+}
+
+void groove_waveform_destroy(struct GrooveWaveform *waveform) {
+    if (!waveform)
+        return;
+
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+
+    if (p->info_queue)
+        groove_queue_destroy(p->info_queue);
+
+    if (p->info_head_mutex_inited)
+        pthread_mutex_destroy(&p->info_head_mutex);
+
+    if (p->drain_cond_inited)
+        pthread_cond_destroy(&p->drain_cond);
+
+    track_free(&p->track);
+    av_free(p);
+}
+
+int groove_waveform_attach_analyzer(struct GrooveWaveform *waveform,
+        struct GrooveAnalyzer *analyzer)
+{
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+
+    if (groove_channel_layout_count(waveform->channel_layout) > WAVEFORM_MAX_CHANNELS) {
+        av_log(NULL, AV_LOG_ERROR, "unable to draw a waveform of more than %d channels\n",
+                WAVEFORM_MAX_CHANNELS);
+        return -1;
+    }
+
+    groove_queue_reset(p->info_queue);
+
+    p->base_bin_size = (waveform->base_bin_size > 0) ? waveform->base_bin_size : 1;
+    p->max_bin_size = waveform->max_bin_size;
+    track_reset(&p->track);
+
+    p->plugin.audio_format.channel_layout = waveform->channel_layout;
+    p->plugin.buffer_size = waveform->sink_buffer_size;
+    if (groove_analyzer_add_plugin(analyzer, &p->plugin) < 0) {
+        groove_waveform_detach(waveform);
+        return -1;
+    }
+    p->analyzer = analyzer;
+
+    return 0;
+}
+
+int groove_waveform_attach(struct GrooveWaveform *waveform,
+        struct GroovePlaylist *playlist)
+{
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+
+    p->own_analyzer = groove_analyzer_create();
+    if (!p->own_analyzer)
+        return -1;
+
+    if (groove_waveform_attach_analyzer(waveform, p->own_analyzer) < 0)
+        return -1;
+
+    if (groove_analyzer_attach(p->own_analyzer, playlist) < 0) {
+        groove_waveform_detach(waveform);
+        return -1;
+    }
+
+    return 0;
+}
+
+int groove_waveform_detach(struct GrooveWaveform *waveform) {
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+
+    if (p->own_analyzer)
+        groove_analyzer_detach(p->own_analyzer);
+
+    groove_queue_flush(p->info_queue);
+    groove_queue_abort(p->info_queue);
+
+    if (p->analyzer) {
+        groove_analyzer_remove_plugin(p->analyzer, &p->plugin);
+        p->analyzer = NULL;
+    }
+    groove_analyzer_destroy(p->own_analyzer);
+    p->own_analyzer = NULL;
+
+    waveform->playlist = NULL;
+
+    p->abort_request = 0;
+    p->info_head = NULL;
+    p->info_pos = 0;
+    track_free(&p->track);
+
+    return 0;
+}
+
+int groove_waveform_info_get(struct GrooveWaveform *waveform,
+        struct GrooveWaveformInfo *info, int block)
+{
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+
+    struct GrooveWaveformInfo *info_ptr;
+    if (groove_queue_get(p->info_queue, (void**)&info_ptr, block) == 1) {
+        *info = *info_ptr;
+        av_free(info_ptr);
+        return 1;
+    }
+
+    return 0;
+}
+
+int groove_waveform_info_peek(struct GrooveWaveform *waveform, int block) {
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+    return groove_queue_peek(p->info_queue, block);
+}
+
+void groove_waveform_position(struct GrooveWaveform *waveform,
+        struct GroovePlaylistItem **item, double *seconds)
+{
+    struct GrooveWaveformPrivate *p = (struct GrooveWaveformPrivate *) waveform;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+
+    if (item)
+        *item = p->info_head;
+
+    if (seconds)
+        *seconds = p->info_pos;
+
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+void groove_waveform_free_info(struct GrooveWaveformInfo *info) {
+    if (!info->levels) return;
+    for (int i = 0; i < info->level_count; i += 1) {
+        av_free(info->levels[i].min);
+        av_free(info->levels[i].max);
+        av_free(info->levels[i].rms);
+    }
+    av_free(info->levels);
+    info->levels = NULL;
+    info->level_count = 0;
+}
+
+static uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = (value >> 24) & 0xff;
+    return out + 4;
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static uint8_t *put_samples(uint8_t *out, const float *values, int count) {
+    for (int i = 0; i < count; i += 1) {
+        float x = values[i];
+        x = (x > 1.0f) ? 1.0f : ((x < -1.0f) ? -1.0f : x);
+        int16_t value = lrintf(x * 32767.0f);
+        out[0] = (uint16_t)value & 0xff;
+        out[1] = ((uint16_t)value >> 8) & 0xff;
+        out += 2;
+    }
+    return out;
+}
+
+static const uint8_t *get_samples(const uint8_t *in, float *values, int count) {
+    for (int i = 0; i < count; i += 1) {
+        int16_t value = (int16_t)(uint16_t)(in[0] | (in[1] << 8));
+        values[i] = value / 32767.0f;
+        in += 2;
+    }
+    return in;
+}
+
+// the format is the magic, then version, sample_rate, channel_count,
+// duration in milliseconds and level_count, then for every level its
+// bin_size and bin_count followed by its min, max and rms values, all
+// little endian
+int groove_waveform_serialize(const struct GrooveWaveformInfo *info,
+        uint8_t **data, int *size)
+{
+    int64_t total = sizeof(waveform_magic) + 5 * 4;
+    for (int i = 0; i < info->level_count; i += 1)
+        total += 2 * 4 + (int64_t)info->levels[i].bin_count * info->channel_count * 3 * 2;
+    if (total > INT_MAX)
+        return -1;
+
+    uint8_t *out = av_malloc(total);
+    if (!out) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate waveform data\n");
+        return -1;
+    }
+    *data = out;
+    *size = total;
+
+    memcpy(out, waveform_magic, sizeof(waveform_magic));
+    out += sizeof(waveform_magic);
+    out = put_u32(out, WAVEFORM_VERSION);
+    out = put_u32(out, info->sample_rate);
+    out = put_u32(out, info->channel_count);
+    out = put_u32(out, lrint(info->duration * 1000.0));
+    out = put_u32(out, info->level_count);
+    for (int i = 0; i < info->level_count; i += 1) {
+        const struct GrooveWaveformLevel *level = &info->levels[i];
+        int count = level->bin_count * info->channel_count;
+        out = put_u32(out, level->bin_size);
+        out = put_u32(out, level->bin_count);
+        out = put_samples(out, level->min, count);
+        out = put_samples(out, level->max, count);
+        out = put_samples(out, level->rms, count);
+    }
+
+    return 0;
+}
+
+int groove_waveform_deserialize(const uint8_t *data, int size,
+        struct GrooveWaveformInfo *info)
+{
+    memset(info, 0, sizeof(struct GrooveWaveformInfo));
+
+    const uint8_t *end = data + size;
+    if (size < (int)sizeof(waveform_magic) + 5 * 4 ||
+        memcmp(data, waveform_magic, sizeof(waveform_magic)) != 0)
+    {
+        return -1;
+    }
+    const uint8_t *in = data + sizeof(waveform_magic);
+    if (get_u32(in) != WAVEFORM_VERSION)
+        return -1;
+    info->sample_rate = get_u32(in + 4);
+    info->channel_count = get_u32(in + 8);
+    info->duration = get_u32(in + 12) / 1000.0;
+    uint32_t level_count = get_u32(in + 16);
+    in += 5 * 4;
+    if (info->channel_count < 1 || info->channel_count > WAVEFORM_MAX_CHANNELS ||
+        level_count > 32)
+    {
+        return -1;
+    }
+
+    info->levels = av_mallocz(level_count * sizeof(struct GrooveWaveformLevel));
+    if (!info->levels && level_count > 0)
+        return -1;
+    info->level_count = level_count;
+
+    for (uint32_t i = 0; i < level_count; i += 1) {
+        struct GrooveWaveformLevel *level = &info->levels[i];
+        if (end - in < 2 * 4)
+            goto error;
+        level->bin_size = get_u32(in);
+        uint32_t bin_count = get_u32(in + 4);
+        in += 2 * 4;
+        int64_t count = (int64_t)bin_count * info->channel_count;
+        if ((end - in) / (3 * 2) < count)
+            goto error;
+        level->bin_count = bin_count;
+        size_t values_size = (count ? count : 1) * sizeof(float);
+        level->min = av_malloc(values_size);
+        level->max = av_malloc(values_size);
+        level->rms = av_malloc(values_size);
+        if (!level->min || !level->max || !level->rms)
+            goto error;
+        in = get_samples(in, level->min, count);
+        in = get_samples(in, level->max, count);
+        in = get_samples(in, level->rms, count);
+    }
+
+    return 0;
+
+error:
+    groove_waveform_free_info(info);
+    return -1;
+}
+
+void groove_waveform_dealloc(void *ptr) {
+    av_free(ptr);
+}
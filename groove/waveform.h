@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_WAVEFORM_H_INCLUDED
+#define GROOVE_WAVEFORM_H_INCLUDED
+
+#include "groove.h"
+#include "analyzer.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* use this to draw waveform overviews. each playlist item gets the minimum,
+ * maximum and RMS of every channel in bins of base_bin_size frames, and
+ * again with bins twice as big, and so on up to max_bin_size.
+ * the audio is analyzed at 44100 Hz, in channel_layout.
+ */
+
+struct GrooveWaveformLevel {
+    /* how many frames each bin covers. the last bin may cover fewer. */
+    int bin_size;
+    int bin_count;
+    /* bin_count * channel_count values each, the channels of a bin next to
+     * each other: bin i of channel c is at [i * channel_count + c].
+     * samples are from -1.0 to 1.0.
+     */
+    float *min;
+    float *max;
+    float *rms;
+};
+
+struct GrooveWaveformInfo {
+    /* the playlist item that this info applies to.
+     * When this is NULL this is the end-of-playlist sentinel. Its duration
+     * is the total of all songs and other properties are undefined.
+     */
+    struct GroovePlaylistItem *item;
+
+    /* how many seconds long this song is */
+    double duration;
+
+    int sample_rate;
+    int channel_count;
+
+    /* levels[0] has the smallest bins */
+    int level_count;
+    struct GrooveWaveformLevel *levels;
+};
+
+struct GrooveWaveform {
+    /* maximum number of GrooveWaveformInfo items to store in this
+     * waveform's queue. this defaults to MAX_INT, meaning that
+     * the waveform will cause the decoder to decode the entire
+     * playlist. if you want to instead, for example, obtain waveforms
+     * at the same time as playback, you might set this value to 1.
+     */
+    int info_queue_size;
+
+    /* how big the sink buffer should be, in sample frames.
+     * groove_waveform_create defaults this to 8192
+     */
+    int sink_buffer_size;
+
+    /* the channel layout to analyze the audio in. set this to 0 to analyze
+     * every file in its own channel layout, without downmixing it.
+     * at most 8 channels are supported: attaching fails for a bigger
+     * layout, and with 0, files with more channels get no info.
+     * defaults to GROOVE_CH_LAYOUT_STEREO
+     */
+    uint64_t channel_layout;
+
+    /* how many frames the bins of the first and the last level cover.
+     * each level has bins twice as big as the one before.
+     * default to 256 and 65536
+     */
+    int base_bin_size;
+    int max_bin_size;
+
+    /* read-only. set when attached and cleared when detached */
+    struct GroovePlaylist *playlist;
+};
+
+struct GrooveWaveform *groove_waveform_create(void);
+void groove_waveform_destroy(struct GrooveWaveform *waveform);
+
+/* once you attach, you must detach before destroying the playlist */
+int groove_waveform_attach(struct GrooveWaveform *waveform,
+        struct GroovePlaylist *playlist);
+int groove_waveform_detach(struct GrooveWaveform *waveform);
+
+/* instead of attaching to a playlist, analyze the audio of analyzer as one
+ * of its plugins. call this while analyzer is detached, and detach
+ * analyzer before detaching waveform.
+ * returns 0 on success, < 0 on error
+ */
+int groove_waveform_attach_analyzer(struct GrooveWaveform *waveform,
+        struct GrooveAnalyzer *analyzer);
+
+/* returns < 0 on error, 0 on aborted (block=1) or no info ready (block=0),
+ * 1 on info returned.
+ * When you get info you must free it with groove_waveform_free_info.
+ */
+int groove_waveform_info_get(struct GrooveWaveform *waveform,
+        struct GrooveWaveformInfo *info, int block);
+
+void groove_waveform_free_info(struct GrooveWaveformInfo *info);
+
+/* returns < 0 on error, 0 on no info ready, 1 on info ready
+ * if block is 1, block until info is ready
+ */
+int groove_waveform_info_peek(struct GrooveWaveform *waveform, int block);
+
+/* get the position of the waveform head
+ * both the current playlist item and the position in seconds in the playlist
+ * item are given. item will be set to NULL if the playlist is empty
+ * you may pass NULL for item or seconds
+ */
+void groove_waveform_position(struct GrooveWaveform *waveform,
+        struct GroovePlaylistItem **item, double *seconds);
+
+/* stores the levels of info in a compact, byte order independent format,
+ * with every value rounded to 16 bits. free data with
+ * groove_waveform_dealloc. item is not stored.
+ * returns 0 on success, < 0 on error
+ */
+int groove_waveform_serialize(const struct GrooveWaveformInfo *info,
+        uint8_t **data, int *size);
+
+/* reads data written by groove_waveform_serialize into info. item is set to
+ * NULL. free info with groove_waveform_free_info.
+ * returns 0 on success, < 0 on error
+ */
+int groove_waveform_deserialize(const uint8_t *data, int size,
+        struct GrooveWaveformInfo *info);
+
+void groove_waveform_dealloc(void *ptr);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_WAVEFORM_H_INCLUDED */
@@ -18,6 +18,25 @@
 #include <string.h>
 #include <pthread.h>
 
+// chromaprint downmixes and resamples everything to 11025Hz mono before
+// analyzing it. the sink asks for that format directly, so the filter graph
+// does the only conversion.
+#define FINGERPRINT_SAMPLE_RATE 11025
+
+// one playlist item fingerprinted by a worker when worker_count > 0
+struct FingerprintJob {
+    struct GroovePlaylistItem *item;
+    char *filename;
+    double gain;
+    double peak;
+    // written by the worker, read by collect_thread once done is set.
+    // collect_thread takes over fingerprint when it sends the info.
+    int32_t *fingerprint;
+    int fingerprint_size;
+    double duration;
+    int done;
+};
+
 struct GrooveFingerprinterPrivate {
     struct GrooveFingerprinter externals;
 
@@ -27,6 +46,7 @@ struct GrooveFingerprinterPrivate {
     struct GrooveSink *sink;
     struct GrooveQueue *info_queue;
     pthread_t thread_id;
+    char thread_inited;
 
     // info_head_mutex applies to variables inside this block.
     pthread_mutex_t info_head_mutex;
@@ -41,9 +61,34 @@ struct GrooveFingerprinterPrivate {
     int info_queue_count;
     double track_duration;
     double album_duration;
+    // the fingerprint of info_head was already sent because max_duration
+    // was reached. the rest of its audio is ignored.
+    char track_done;
 
     ChromaprintContext *chroma_ctx;
 
+    // set by groove_fingerprinter_attach_analyzer. the plugin then does the
+    // work of print_thread.
+    struct GrooveAnalyzer *analyzer;
+    struct GrooveAnalyzerPlugin plugin;
+
+    // for worker_count > 0. jobs_mutex applies to next_job, the done flags
+    // and done_order.
+    struct FingerprintJob *jobs;
+    int job_count;
+    int next_job;
+    // the indexes of the finished jobs in the order they finished
+    int *done_order;
+    int done_count;
+    // copy of unordered taken when attaching
+    int unordered;
+    pthread_t *worker_ids;
+    int worker_thread_count;
+    pthread_mutex_t jobs_mutex;
+    char jobs_mutex_inited;
+    pthread_cond_t job_done_cond;
+    char job_done_cond_inited;
+
     // set temporarily
     struct GroovePlaylistItem *purge_item;
 
@@ -58,6 +103,11 @@ static int emit_track_info(struct GrooveFingerprinterPrivate *p) {
     }
     info->item = p->info_head;
     info->duration = p->track_duration;
+    // a track cut short by max_duration still reports its full length,
+    // which fingerprint lookups need
+    if (p->track_done && p->info_head)
+        info->duration = groove_file_duration(p->info_head->file);
+    p->album_duration += info->duration;
 
     if (!chromaprint_finish(p->chroma_ctx)) {
         av_log(NULL, AV_LOG_ERROR, "unable to finish chromaprint\n");
@@ -75,6 +125,88 @@ static int emit_track_info(struct GrooveFingerprinterPrivate *p) {
     return 0;
 }
 
+// sends the end of playlist sentinel and starts a new album.
+// info_head_mutex must be held.
+static void emit_album_info(struct GrooveFingerprinterPrivate *p) {
+    struct GrooveFingerprinterInfo *info = av_mallocz(
+            sizeof(struct GrooveFingerprinterInfo));
+    if (info) {
+        info->duration = p->album_duration;
+        groove_queue_put(p->info_queue, info);
+    } else {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate album fingerprint info\n");
+    }
+
+    p->album_duration = 0.0;
+
+    p->info_head = NULL;
+    p->info_pos = -1.0;
+}
+
+// feeds buffer to ctx, but no more than max_duration seconds of the track
+// in total. track_duration is the duration fed so far and is updated.
+// returns 1 once max_duration is reached.
+static int feed_buffer(ChromaprintContext *ctx, struct GrooveBuffer *buffer,
+        double max_duration, double *track_duration)
+{
+    int frame_count = buffer->frame_count;
+    int sample_rate = buffer->format.sample_rate;
+    if (max_duration > 0.0 && *track_duration + frame_count / (double)sample_rate > max_duration) {
+        frame_count = (max_duration - *track_duration) * sample_rate;
+        if (frame_count < 0)
+            frame_count = 0;
+    }
+    *track_duration += frame_count / (double)sample_rate;
+    if (!chromaprint_feed(ctx, buffer->data[0], frame_count)) {
+        av_log(NULL, AV_LOG_ERROR, "unable to feed fingerprint\n");
+    }
+    return frame_count < buffer->frame_count;
+}
+
+// fingerprints one buffer. info_head_mutex must be held.
+// returns the item to skip with groove_playlist_skip_item after unlocking,
+// or NULL.
+static struct GroovePlaylistItem *print_buffer(struct GrooveFingerprinterPrivate *p,
+        struct GrooveBuffer *buffer)
+{
+    struct GrooveFingerprinter *printer = &p->externals;
+
+    if (buffer->item != p->info_head) {
+        if (p->info_head && !p->track_done) {
+            emit_track_info(p);
+        }
+        p->track_done = 0;
+        if (!chromaprint_start(p->chroma_ctx, FINGERPRINT_SAMPLE_RATE, 1)) {
+            av_log(NULL, AV_LOG_ERROR, "unable to start fingerprint\n");
+        }
+        p->track_duration = 0.0;
+        p->info_head = buffer->item;
+        p->info_pos = buffer->pos;
+    }
+
+    if (p->track_done)
+        return NULL;
+
+    // once max_duration is reached, send the fingerprint right away and
+    // stop the playlist from decoding the rest of the item
+    if (feed_buffer(p->chroma_ctx, buffer, printer->max_duration, &p->track_duration)) {
+        p->track_done = 1;
+        emit_track_info(p);
+        return p->info_head;
+    }
+    return NULL;
+}
+
+// sends the last track info and the sentinel. info_head_mutex must be held.
+static void print_end(struct GrooveFingerprinterPrivate *p) {
+    // last file info
+    if (!p->track_done)
+        emit_track_info(p);
+    p->track_done = 0;
+
+    emit_album_info(p);
+}
+
 static void *print_thread(void *arg) {
     struct GrooveFingerprinterPrivate *p = arg;
     struct GrooveFingerprinter *printer = &p->externals;
@@ -99,24 +231,7 @@ static void *print_thread(void *arg) {
         pthread_mutex_lock(&p->info_head_mutex);
 
         if (result == GROOVE_BUFFER_END) {
-            // last file info
-            emit_track_info(p);
-
-            // send album info
-            struct GrooveFingerprinterInfo *info = av_mallocz(
-                    sizeof(struct GrooveFingerprinterInfo));
-            if (info) {
-                info->duration = p->album_duration;
-                groove_queue_put(p->info_queue, info);
-            } else {
-                av_log(NULL, AV_LOG_ERROR, "unable to allocate album fingerprint info\n");
-            }
-
-            p->album_duration = 0.0;
-
-            p->info_head = NULL;
-            p->info_pos = -1.0;
-
+            print_end(p);
             pthread_mutex_unlock(&p->info_head_mutex);
             continue;
         }
@@ -126,29 +241,165 @@ static void *print_thread(void *arg) {
             break;
         }
 
-        if (buffer->item != p->info_head) {
-            if (p->info_head) {
-                emit_track_info(p);
-            }
-            if (!chromaprint_start(p->chroma_ctx, 44100, 2)) {
-                av_log(NULL, AV_LOG_ERROR, "unable to start fingerprint\n");
-            }
-            p->track_duration = 0.0;
-            p->info_head = buffer->item;
-            p->info_pos = buffer->pos;
+        struct GroovePlaylistItem *skip_item = print_buffer(p, buffer);
+
+        pthread_mutex_unlock(&p->info_head_mutex);
+        // the playlist calls sink_purge with its mutex held, so this must be
+        // done without holding info_head_mutex
+        if (skip_item)
+            groove_playlist_skip_item(printer->playlist, skip_item);
+        groove_buffer_unref(buffer);
+    }
+
+    return NULL;
+}
+
+// decodes and fingerprints one job on a private playlist with its own
+// chromaprint context, so that several jobs can be decoded at the same time
+static void print_job(struct GrooveFingerprinterPrivate *p, struct FingerprintJob *job) {
+    struct GrooveFingerprinter *printer = &p->externals;
+
+    struct GrooveFile *file = groove_file_open(job->filename);
+    if (!file) {
+        av_log(NULL, AV_LOG_ERROR, "fingerprinter: unable to open %s\n", job->filename);
+        return;
+    }
+
+    ChromaprintContext *ctx = chromaprint_new(CHROMAPRINT_ALGORITHM_DEFAULT);
+    struct GroovePlaylist *playlist = groove_playlist_create();
+    struct GrooveSink *sink = groove_sink_create();
+    if (!ctx || !playlist || !sink) {
+        av_log(NULL, AV_LOG_ERROR, "fingerprinter: out of memory\n");
+        groove_sink_destroy(sink);
+        if (playlist)
+            groove_playlist_destroy(playlist);
+        if (ctx)
+            chromaprint_free(ctx);
+        groove_file_close(file);
+        return;
+    }
+
+    sink->audio_format = p->sink->audio_format;
+    sink->buffer_size = printer->sink_buffer_size;
+    groove_playlist_set_gain(playlist, printer->playlist->gain);
+
+    // insert before attaching so that the sink never sees the end of the
+    // empty playlist
+    groove_playlist_insert(playlist, file, job->gain, job->peak, NULL);
+    if (groove_sink_attach(sink, playlist) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "fingerprinter: unable to attach sink\n");
+    } else if (!chromaprint_start(ctx, FINGERPRINT_SAMPLE_RATE, 1)) {
+        av_log(NULL, AV_LOG_ERROR, "unable to start fingerprint\n");
+        groove_sink_detach(sink);
+    } else {
+        // detaching stops the decoding, so max_duration cuts it short
+        int reached = 0;
+        struct GrooveBuffer *buffer;
+        while (!reached && !p->abort_request &&
+                groove_sink_buffer_get(sink, &buffer, 1) == GROOVE_BUFFER_YES)
+        {
+            reached = feed_buffer(ctx, buffer, printer->max_duration, &job->duration);
+            groove_buffer_unref(buffer);
+        }
+        groove_sink_detach(sink);
+
+        if (reached)
+            job->duration = groove_file_duration(file);
+        if (!chromaprint_finish(ctx)) {
+            av_log(NULL, AV_LOG_ERROR, "unable to finish chromaprint\n");
+        } else if (!chromaprint_get_raw_fingerprint(ctx,
+                    (void**)&job->fingerprint, &job->fingerprint_size))
+        {
+            av_log(NULL, AV_LOG_ERROR, "unable to get fingerprint\n");
+        }
+    }
+
+    chromaprint_free(ctx);
+    groove_sink_destroy(sink);
+    groove_playlist_clear(playlist);
+    groove_playlist_destroy(playlist);
+    groove_file_close(file);
+}
+
+static void *worker_thread(void *arg) {
+    struct GrooveFingerprinterPrivate *p = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&p->jobs_mutex);
+        if (p->abort_request || p->next_job >= p->job_count) {
+            pthread_mutex_unlock(&p->jobs_mutex);
+            break;
+        }
+        int index = p->next_job;
+        p->next_job += 1;
+        pthread_mutex_unlock(&p->jobs_mutex);
+
+        print_job(p, &p->jobs[index]);
+
+        pthread_mutex_lock(&p->jobs_mutex);
+        p->jobs[index].done = 1;
+        p->done_order[p->done_count] = index;
+        p->done_count += 1;
+        pthread_cond_broadcast(&p->job_done_cond);
+        pthread_mutex_unlock(&p->jobs_mutex);
+    }
+
+    return NULL;
+}
+
+// when worker_count > 0 this thread runs instead of print_thread. it emits
+// the results of the workers in playlist order, or in the order they
+// finish with unordered, followed by the end of playlist sentinel.
+static void *collect_thread(void *arg) {
+    struct GrooveFingerprinterPrivate *p = arg;
+    struct GrooveFingerprinter *printer = &p->externals;
+
+    for (int i = 0; i < p->job_count; i += 1) {
+        pthread_mutex_lock(&p->info_head_mutex);
+        while (!p->abort_request && p->info_queue_count >= printer->info_queue_size)
+            pthread_cond_wait(&p->drain_cond, &p->info_head_mutex);
+        if (!p->unordered) {
+            p->info_head = p->jobs[i].item;
+            p->info_pos = 0.0;
         }
+        pthread_mutex_unlock(&p->info_head_mutex);
 
-        double buffer_duration = buffer->frame_count / (double)buffer->format.sample_rate;
-        p->track_duration += buffer_duration;
-        p->album_duration += buffer_duration;
-        if (!chromaprint_feed(p->chroma_ctx, buffer->data[0], buffer->frame_count * 2)) {
-            av_log(NULL, AV_LOG_ERROR, "unable to feed fingerprint\n");
+        pthread_mutex_lock(&p->jobs_mutex);
+        while (!p->abort_request &&
+                (p->unordered ? p->done_count <= i : !p->jobs[i].done))
+        {
+            pthread_cond_wait(&p->job_done_cond, &p->jobs_mutex);
         }
+        int index = p->unordered ? p->done_order[i] : i;
+        pthread_mutex_unlock(&p->jobs_mutex);
 
+        if (p->abort_request)
+            return NULL;
+
+        struct FingerprintJob *job = &p->jobs[index];
+        struct GrooveFingerprinterInfo *info = av_mallocz(sizeof(struct GrooveFingerprinterInfo));
+        if (!info) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprinter info\n");
+            continue;
+        }
+        info->item = job->item;
+        info->duration = job->duration;
+        info->fingerprint = job->fingerprint;
+        info->fingerprint_size = job->fingerprint_size;
+        job->fingerprint = NULL;
+
+        pthread_mutex_lock(&p->info_head_mutex);
+        p->info_head = job->item;
+        p->info_pos = 0.0;
+        p->album_duration += job->duration;
+        groove_queue_put(p->info_queue, info);
         pthread_mutex_unlock(&p->info_head_mutex);
-        groove_buffer_unref(buffer);
     }
 
+    pthread_mutex_lock(&p->info_head_mutex);
+    emit_album_info(p);
+    pthread_mutex_unlock(&p->info_head_mutex);
+
     return NULL;
 }
 
@@ -181,9 +432,7 @@ static int info_queue_purge(struct GrooveQueue* queue, void *obj) {
     return info->item == p->purge_item;
 }
 
-static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
-    struct GrooveFingerprinterPrivate *p = sink->userdata;
-
+static void printer_purge(struct GrooveFingerprinterPrivate *p, struct GroovePlaylistItem *item) {
     pthread_mutex_lock(&p->info_head_mutex);
     p->purge_item = item;
     groove_queue_purge(p->info_queue);
@@ -197,12 +446,11 @@ static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item)
     pthread_mutex_unlock(&p->info_head_mutex);
 }
 
-static void sink_flush(struct GrooveSink *sink) {
-    struct GrooveFingerprinterPrivate *p = sink->userdata;
-
+static void printer_flush(struct GrooveFingerprinterPrivate *p) {
     pthread_mutex_lock(&p->info_head_mutex);
     groove_queue_flush(p->info_queue);
     p->track_duration = 0.0;
+    p->track_done = 0;
     p->info_head = NULL;
     p->info_pos = -1.0;
 
@@ -210,6 +458,59 @@ static void sink_flush(struct GrooveSink *sink) {
     pthread_mutex_unlock(&p->info_head_mutex);
 }
 
+static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
+    printer_purge(sink->userdata, item);
+}
+
+static void sink_flush(struct GrooveSink *sink) {
+    printer_flush(sink->userdata);
+}
+
+static void plugin_attach(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylist *playlist) {
+    struct GrooveFingerprinterPrivate *p = plugin->userdata;
+    p->externals.playlist = playlist;
+    p->abort_request = 0;
+}
+
+static void plugin_detach(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveFingerprinterPrivate *p = plugin->userdata;
+    pthread_mutex_lock(&p->info_head_mutex);
+    p->abort_request = 1;
+    pthread_cond_signal(&p->drain_cond);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+// the analyzer thread waits here while the info queue is full, like
+// print_thread does. the other plugins of the analyzer need all of the
+// item, so once max_duration is reached the rest of it is only ignored
+// instead of skipped.
+static void plugin_buffer(struct GrooveAnalyzerPlugin *plugin, struct GrooveBuffer *buffer) {
+    struct GrooveFingerprinterPrivate *p = plugin->userdata;
+    struct GrooveFingerprinter *printer = &p->externals;
+
+    pthread_mutex_lock(&p->info_head_mutex);
+    while (!p->abort_request && p->info_queue_count >= printer->info_queue_size)
+        pthread_cond_wait(&p->drain_cond, &p->info_head_mutex);
+    if (!p->abort_request)
+        print_buffer(p, buffer);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_end(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveFingerprinterPrivate *p = plugin->userdata;
+    pthread_mutex_lock(&p->info_head_mutex);
+    print_end(p);
+    pthread_mutex_unlock(&p->info_head_mutex);
+}
+
+static void plugin_flush(struct GrooveAnalyzerPlugin *plugin) {
+    printer_flush(plugin->userdata);
+}
+
+static void plugin_purge(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylistItem *item) {
+    printer_purge(plugin->userdata, item);
+}
+
 struct GrooveFingerprinter *groove_fingerprinter_create(void) {
     struct GrooveFingerprinterPrivate *p = av_mallocz(sizeof(struct GrooveFingerprinterPrivate));
     if (!p) {
@@ -233,6 +534,20 @@ struct GrooveFingerprinter *groove_fingerprinter_create(void) {
     }
     p->drain_cond_inited = 1;
 
+    if (pthread_mutex_init(&p->jobs_mutex, NULL) != 0) {
+        groove_fingerprinter_destroy(printer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    p->jobs_mutex_inited = 1;
+
+    if (pthread_cond_init(&p->job_done_cond, NULL) != 0) {
+        groove_fingerprinter_destroy(printer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
+        return NULL;
+    }
+    p->job_done_cond_inited = 1;
+
     p->info_queue = groove_queue_create();
     if (!p->info_queue) {
         groove_fingerprinter_destroy(printer);
@@ -251,13 +566,21 @@ struct GrooveFingerprinter *groove_fingerprinter_create(void) {
         av_log(NULL, AV_LOG_ERROR, "unable to allocate sink\n");
         return NULL;
     }
-    p->sink->audio_format.sample_rate = 44100;
-    p->sink->audio_format.channel_layout = GROOVE_CH_LAYOUT_STEREO;
+    p->sink->audio_format.sample_rate = FINGERPRINT_SAMPLE_RATE;
+    p->sink->audio_format.channel_layout = GROOVE_CH_LAYOUT_MONO;
     p->sink->audio_format.sample_fmt = GROOVE_SAMPLE_FMT_S16;
     p->sink->userdata = printer;
     p->sink->purge = sink_purge;
     p->sink->flush = sink_flush;
 
+    p->plugin.userdata = p;
+    p->plugin.attach = plugin_attach;
+    p->plugin.detach = plugin_detach;
+    p->plugin.buffer = plugin_buffer;
+    p->plugin.end = plugin_end;
+    p->plugin.flush = plugin_flush;
+    p->plugin.purge = plugin_purge;
+
     // set some defaults
     printer->info_queue_size = INT_MAX;
     printer->sink_buffer_size = p->sink->buffer_size;
@@ -283,9 +606,74 @@ void groove_fingerprinter_destroy(struct GrooveFingerprinter *printer) {
     if (p->drain_cond_inited)
         pthread_cond_destroy(&p->drain_cond);
 
+    if (p->jobs_mutex_inited)
+        pthread_mutex_destroy(&p->jobs_mutex);
+
+    if (p->job_done_cond_inited)
+        pthread_cond_destroy(&p->job_done_cond);
+
     av_free(p);
 }
 
+// sets up one job per playlist item and starts the worker pool
+static int attach_workers(struct GrooveFingerprinter *printer) {
+    struct GrooveFingerprinterPrivate *p = (struct GrooveFingerprinterPrivate *) printer;
+    struct GroovePlaylist *playlist = printer->playlist;
+
+    int count = groove_playlist_count(playlist);
+    int alloc_count = (count > 0) ? count : 1;
+    p->jobs = av_mallocz(alloc_count * sizeof(struct FingerprintJob));
+    p->done_order = av_mallocz(alloc_count * sizeof(int));
+    if (!p->jobs || !p->done_order) {
+        groove_fingerprinter_detach(printer);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint jobs\n");
+        return -1;
+    }
+
+    struct GroovePlaylistItem *item = playlist->head;
+    for (int i = 0; i < count; i += 1, item = item->next) {
+        struct FingerprintJob *job = &p->jobs[i];
+        job->item = item;
+        job->gain = item->gain;
+        job->peak = item->peak;
+        job->filename = av_strdup(item->file->filename);
+        if (!job->filename) {
+            groove_fingerprinter_detach(printer);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint jobs\n");
+            return -1;
+        }
+        p->job_count += 1;
+    }
+    p->next_job = 0;
+    p->done_count = 0;
+    p->unordered = printer->unordered;
+
+    p->worker_ids = av_mallocz(printer->worker_count * sizeof(pthread_t));
+    if (!p->worker_ids) {
+        groove_fingerprinter_detach(printer);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint workers\n");
+        return -1;
+    }
+
+    if (pthread_create(&p->thread_id, NULL, collect_thread, printer) != 0) {
+        groove_fingerprinter_detach(printer);
+        av_log(NULL, AV_LOG_ERROR, "unable to create printer thread\n");
+        return -1;
+    }
+    p->thread_inited = 1;
+
+    for (int i = 0; i < printer->worker_count; i += 1) {
+        if (pthread_create(&p->worker_ids[i], NULL, worker_thread, printer) != 0) {
+            groove_fingerprinter_detach(printer);
+            av_log(NULL, AV_LOG_ERROR, "unable to create fingerprint worker\n");
+            return -1;
+        }
+        p->worker_thread_count += 1;
+    }
+
+    return 0;
+}
+
 int groove_fingerprinter_attach(struct GrooveFingerprinter *printer,
         struct GroovePlaylist *playlist)
 {
@@ -294,6 +682,9 @@ int groove_fingerprinter_attach(struct GrooveFingerprinter *printer,
     printer->playlist = playlist;
     groove_queue_reset(p->info_queue);
 
+    if (printer->worker_count > 0)
+        return attach_workers(printer);
+
     p->chroma_ctx = chromaprint_new(CHROMAPRINT_ALGORITHM_DEFAULT);
     if (!p->chroma_ctx) {
         groove_fingerprinter_detach(printer);
@@ -312,6 +703,32 @@ int groove_fingerprinter_attach(struct GrooveFingerprinter *printer,
         av_log(NULL, AV_LOG_ERROR, "unable to create printer thread\n");
         return -1;
     }
+    p->thread_inited = 1;
+
+    return 0;
+}
+
+int groove_fingerprinter_attach_analyzer(struct GrooveFingerprinter *printer,
+        struct GrooveAnalyzer *analyzer)
+{
+    struct GrooveFingerprinterPrivate *p = (struct GrooveFingerprinterPrivate *) printer;
+
+    groove_queue_reset(p->info_queue);
+
+    p->chroma_ctx = chromaprint_new(CHROMAPRINT_ALGORITHM_DEFAULT);
+    if (!p->chroma_ctx) {
+        groove_fingerprinter_detach(printer);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate chromaprint\n");
+        return -1;
+    }
+
+    p->plugin.audio_format = p->sink->audio_format;
+    p->plugin.buffer_size = printer->sink_buffer_size;
+    if (groove_analyzer_add_plugin(analyzer, &p->plugin) < 0) {
+        groove_fingerprinter_detach(printer);
+        return -1;
+    }
+    p->analyzer = analyzer;
 
     return 0;
 }
@@ -320,11 +737,43 @@ int groove_fingerprinter_detach(struct GrooveFingerprinter *printer) {
     struct GrooveFingerprinterPrivate *p = (struct GrooveFingerprinterPrivate *) printer;
 
     p->abort_request = 1;
-    groove_sink_detach(p->sink);
+    if (p->sink->playlist)
+        groove_sink_detach(p->sink);
     groove_queue_flush(p->info_queue);
     groove_queue_abort(p->info_queue);
+    pthread_mutex_lock(&p->info_head_mutex);
     pthread_cond_signal(&p->drain_cond);
-    pthread_join(p->thread_id, NULL);
+    pthread_mutex_unlock(&p->info_head_mutex);
+    pthread_mutex_lock(&p->jobs_mutex);
+    pthread_cond_broadcast(&p->job_done_cond);
+    pthread_mutex_unlock(&p->jobs_mutex);
+    if (p->thread_inited) {
+        pthread_join(p->thread_id, NULL);
+        p->thread_inited = 0;
+    }
+
+    for (int i = 0; i < p->worker_thread_count; i += 1)
+        pthread_join(p->worker_ids[i], NULL);
+    p->worker_thread_count = 0;
+    av_free(p->worker_ids);
+    p->worker_ids = NULL;
+
+    for (int i = 0; i < p->job_count; i += 1) {
+        av_free(p->jobs[i].filename);
+        if (p->jobs[i].fingerprint)
+            chromaprint_dealloc(p->jobs[i].fingerprint);
+    }
+    av_free(p->jobs);
+    p->jobs = NULL;
+    p->job_count = 0;
+    av_free(p->done_order);
+    p->done_order = NULL;
+    p->done_count = 0;
+
+    if (p->analyzer) {
+        groove_analyzer_remove_plugin(p->analyzer, &p->plugin);
+        p->analyzer = NULL;
+    }
 
     printer->playlist = NULL;
 
@@ -337,6 +786,7 @@ int groove_fingerprinter_detach(struct GrooveFingerprinter *printer) {
     p->info_head = NULL;
     p->info_pos = 0;
     p->track_duration = 0.0;
+    p->track_done = 0;
 
     return 0;
 }
@@ -9,6 +9,7 @@
 #define GROOVE_FINGERPRINTER_H_INCLUDED
 
 #include <groove/groove.h>
+#include <groove/analyzer.h>
 
 #ifdef __cplusplus
 extern "C"
@@ -27,8 +28,8 @@ struct GrooveFingerprinterInfo {
     double duration;
 
     /* the playlist item that this info applies to.
-     * When this is NULL this is the end-of-playlist sentinel and
-     * other properties are undefined.
+     * When this is NULL this is the end-of-playlist sentinel. Its duration
+     * is the total of all songs and other properties are undefined.
      */
     struct GroovePlaylistItem *item;
 };
@@ -49,6 +50,43 @@ struct GrooveFingerprinter {
 
     /* read-only. set when attached and cleared when detached */
     struct GroovePlaylist *playlist;
+
+    /* set to a number of seconds to only fingerprint the beginning of each
+     * item. once that much has been analyzed the fingerprint is sent right
+     * away and the playlist skips to the next item instead of decoding the
+     * rest. that cuts the item short for every other sink of the playlist
+     * as well, so use a playlist of its own for the fingerprinter. with
+     * groove_fingerprinter_attach_analyzer the item is not skipped, because
+     * the other plugins need all of it; the rest is decoded but not
+     * fingerprinted.
+     * duration is still the full length of the item.
+     * AcoustID lookups use the first 120 seconds.
+     * defaults to 0, which fingerprints whole items.
+     */
+    double max_duration;
+
+    /* set to a positive number to fingerprint that many playlist items at
+     * once, each on its own thread with its own decoder and chromaprint
+     * context. this is for fingerprinting files as fast as possible, not
+     * for following playback:
+     * - the items in the playlist when you attach are fingerprinted once,
+     *   and each file is opened again by filename. the playlist itself is
+     *   not decoded.
+     * - you must not add or remove playlist items until you have
+     *   received the end of playlist sentinel or detached.
+     * - info is delivered in playlist order, followed by the sentinel.
+     * - groove_fingerprinter_position reports the item whose info is
+     *   expected next.
+     * defaults to 0, which fingerprints the audio the playlist decodes, on
+     * one thread.
+     */
+    int worker_count;
+    /* with worker_count, set to 1 to get the info of each item as soon as
+     * it is done instead of in playlist order. the sentinel still comes
+     * last, and groove_fingerprinter_position reports the item whose info
+     * was sent last. defaults to 0.
+     */
+    int unordered;
 };
 
 struct GrooveFingerprinter *groove_fingerprinter_create(void);
@@ -59,6 +97,14 @@ int groove_fingerprinter_attach(struct GrooveFingerprinter *printer,
         struct GroovePlaylist *playlist);
 int groove_fingerprinter_detach(struct GrooveFingerprinter *printer);
 
+/* instead of attaching to a playlist, fingerprint the audio of analyzer as
+ * one of its plugins. call this while analyzer is detached, and detach
+ * analyzer before detaching printer. worker_count is ignored.
+ * returns 0 on success, < 0 on error
+ */
+int groove_fingerprinter_attach_analyzer(struct GrooveFingerprinter *printer,
+        struct GrooveAnalyzer *analyzer);
+
 /* returns < 0 on error, 0 on aborted (block=1) or no info ready (block=0),
  * 1 on info returned.
  * When you get info you must free it with groove_fingerprinter_free_info.
@@ -0,0 +1,624 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#include "index.h"
+
+#include <libavutil/mem.h>
+#include <libavutil/log.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#define INDEX_VERSION 1
+// every INDEX_STRIDE-th item of a stored fingerprint is indexed, while every
+// item of a query is looked up, so a match is found at any shift
+#define INDEX_STRIDE 4
+// the top 20 bits of an item are its key
+#define INDEX_KEY_SHIFT 12
+// keys shared by this many postings, such as the ones of silence, tell the
+// fingerprints apart too poorly to be worth looking at
+#define INDEX_MAX_BUCKET 1000
+// a fingerprint and shift are only compared when at least this many keys
+// agree on them
+#define INDEX_MIN_VOTES 2
+
+static const char index_magic[4] = {'G', 'R', 'F', 'I'};
+
+// the file is this header followed by the ids, starts, items and postings
+// arrays, the same way they are laid out in memory
+struct IndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+    uint64_t item_count;
+    uint64_t posting_count;
+};
+
+// item pos of fingerprint number fingerprint has key
+struct IndexPosting {
+    uint32_t key;
+    uint32_t fingerprint;
+    uint32_t pos;
+};
+
+// a fingerprint whose items agree with the query when shifted by offset
+struct IndexCandidate {
+    uint32_t fingerprint;
+    int32_t offset;
+};
+
+struct GrooveFingerprintIndexPrivate {
+    struct GrooveFingerprintIndex externals;
+
+    // the id of each fingerprint, and where its items start. starts has
+    // count + 1 entries, so that the last one is where the items end.
+    uint64_t *ids;
+    uint64_t ids_capacity;
+    uint64_t *starts;
+    uint64_t starts_capacity;
+    uint32_t *items;
+    uint64_t item_count;
+    uint64_t item_capacity;
+    struct IndexPosting *postings;
+    uint64_t posting_count;
+    uint64_t posting_capacity;
+    // postings are sorted by key, then fingerprint, then pos. finds on
+    // several threads may all want to sort, so the sort is done under
+    // sort_mutex.
+    char postings_sorted;
+    pthread_mutex_t sort_mutex;
+    char sort_mutex_inited;
+
+    // for a loaded index, the arrays point into this mapping until the
+    // first add copies them
+    void *map;
+    size_t map_size;
+};
+
+static uint32_t item_key(uint32_t item) {
+    return item >> INDEX_KEY_SHIFT;
+}
+
+static int popcount64(uint64_t x) {
+#if defined(__GNUC__) && defined(__POPCNT__)
+    return __builtin_popcountll(x);
+#else
+    // without the popcnt instruction the builtin is a call into libgcc
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (x * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+// the number of bits that differ between the count items of a and b
+static uint64_t count_bit_errors(const int32_t *a, const uint32_t *b, int64_t count) {
+    uint64_t bit_errors = 0;
+    int64_t i = 0;
+#ifdef __SSSE3__
+    // looks up the bit count of each nibble of four items at a time, then
+    // sums the bytes with psadbw
+    const __m128i nibble_bits = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m128i low_nibble = _mm_set1_epi8(0x0f);
+    __m128i sums = _mm_setzero_si128();
+    for (; i + 4 <= count; i += 4) {
+        __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + i)),
+                _mm_loadu_si128((const __m128i *)(b + i)));
+        __m128i lo = _mm_and_si128(x, low_nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), low_nibble);
+        __m128i bits = _mm_add_epi8(_mm_shuffle_epi8(nibble_bits, lo),
+                _mm_shuffle_epi8(nibble_bits, hi));
+        sums = _mm_add_epi64(sums, _mm_sad_epu8(bits, _mm_setzero_si128()));
+    }
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, sums);
+    bit_errors = lanes[0] + lanes[1];
+#endif
+    for (; i + 2 <= count; i += 2) {
+        uint64_t x = ((uint64_t)((uint32_t)a[i] ^ b[i]) << 32) |
+            ((uint32_t)a[i + 1] ^ b[i + 1]);
+        bit_errors += popcount64(x);
+    }
+    if (i < count)
+        bit_errors += popcount64((uint32_t)a[i] ^ b[i]);
+    return bit_errors;
+}
+
+// grows an array so that it holds at least needed elements
+static int grow_array(void **array, uint64_t *capacity, uint64_t needed, size_t elem_size) {
+    if (needed <= *capacity)
+        return 0;
+    uint64_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    void *new_array = av_realloc(*array, new_capacity * elem_size);
+    if (!new_array)
+        return -1;
+    *array = new_array;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static void *copy_array(const void *array, uint64_t count, size_t elem_size) {
+    void *copy = av_malloc((count ? count : 1) * elem_size);
+    if (copy && count)
+        memcpy(copy, array, count * elem_size);
+    return copy;
+}
+
+// copies the arrays of a loaded index out of the mapping so that they can
+// be added to
+static int ensure_owned(struct GrooveFingerprintIndexPrivate *p) {
+    if (!p->map)
+        return 0;
+
+    uint64_t count = p->externals.count;
+    uint64_t *ids = copy_array(p->ids, count, sizeof(uint64_t));
+    uint64_t *starts = copy_array(p->starts, count + 1, sizeof(uint64_t));
+    uint32_t *items = copy_array(p->items, p->item_count, sizeof(uint32_t));
+    struct IndexPosting *postings = copy_array(p->postings, p->posting_count,
+            sizeof(struct IndexPosting));
+    if (!ids || !starts || !items || !postings) {
+        av_free(ids);
+        av_free(starts);
+        av_free(items);
+        av_free(postings);
+        return -1;
+    }
+
+    munmap(p->map, p->map_size);
+    p->map = NULL;
+    p->map_size = 0;
+    p->ids = ids;
+    p->ids_capacity = count;
+    p->starts = starts;
+    p->starts_capacity = count + 1;
+    p->items = items;
+    p->item_capacity = p->item_count;
+    p->postings = postings;
+    p->posting_capacity = p->posting_count;
+    return 0;
+}
+
+static int compare_postings(const void *a, const void *b) {
+    const struct IndexPosting *pa = a;
+    const struct IndexPosting *pb = b;
+    if (pa->key != pb->key)
+        return (pa->key < pb->key) ? -1 : 1;
+    if (pa->fingerprint != pb->fingerprint)
+        return (pa->fingerprint < pb->fingerprint) ? -1 : 1;
+    if (pa->pos != pb->pos)
+        return (pa->pos < pb->pos) ? -1 : 1;
+    return 0;
+}
+
+static int compare_candidates(const void *a, const void *b) {
+    const struct IndexCandidate *ca = a;
+    const struct IndexCandidate *cb = b;
+    if (ca->fingerprint != cb->fingerprint)
+        return (ca->fingerprint < cb->fingerprint) ? -1 : 1;
+    if (ca->offset != cb->offset)
+        return (ca->offset < cb->offset) ? -1 : 1;
+    return 0;
+}
+
+// most similar first
+static int compare_matches(const void *a, const void *b) {
+    const struct GrooveFingerprintMatch *ma = a;
+    const struct GrooveFingerprintMatch *mb = b;
+    if (ma->similarity != mb->similarity)
+        return (ma->similarity > mb->similarity) ? -1 : 1;
+    return 0;
+}
+
+static void sort_postings(struct GrooveFingerprintIndexPrivate *p) {
+    pthread_mutex_lock(&p->sort_mutex);
+    if (!p->postings_sorted) {
+        qsort(p->postings, p->posting_count, sizeof(struct IndexPosting), compare_postings);
+        p->postings_sorted = 1;
+    }
+    pthread_mutex_unlock(&p->sort_mutex);
+}
+
+// the first posting with key, or posting_count if there is none
+static uint64_t find_bucket(const struct GrooveFingerprintIndexPrivate *p, uint32_t key) {
+    uint64_t lo = 0;
+    uint64_t hi = p->posting_count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (p->postings[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// the fraction of equal bits where query item i lines up with stored item
+// i - offset. 0 if they do not overlap.
+static double similarity_at(const int32_t *query, int query_size,
+        const uint32_t *stored, int64_t stored_size, int offset)
+{
+    int64_t begin = (offset > 0) ? offset : 0;
+    int64_t end = stored_size + offset;
+    if (end > query_size)
+        end = query_size;
+    if (end <= begin)
+        return 0.0;
+
+    uint64_t bit_errors = count_bit_errors(query + begin, stored + begin - offset,
+            end - begin);
+    return 1.0 - bit_errors / (32.0 * (end - begin));
+}
+
+struct GrooveFingerprintIndex *groove_fingerprint_index_create(void) {
+    struct GrooveFingerprintIndexPrivate *p = av_mallocz(sizeof(struct GrooveFingerprintIndexPrivate));
+    if (!p) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint index\n");
+        return NULL;
+    }
+
+    struct GrooveFingerprintIndex *fp_index = &p->externals;
+
+    if (pthread_mutex_init(&p->sort_mutex, NULL) != 0) {
+        groove_fingerprint_index_destroy(fp_index);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    p->sort_mutex_inited = 1;
+
+    p->starts = av_mallocz(sizeof(uint64_t));
+    p->starts_capacity = 1;
+    if (!p->starts) {
+        groove_fingerprint_index_destroy(fp_index);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint index\n");
+        return NULL;
+    }
+    p->postings_sorted = 1;
+
+    // set some defaults
+    fp_index->max_offset = 80;
+
+    return fp_index;
+}
+
+void groove_fingerprint_index_destroy(struct GrooveFingerprintIndex *fp_index) {
+    if (!fp_index)
+        return;
+
+    struct GrooveFingerprintIndexPrivate *p = (struct GrooveFingerprintIndexPrivate *) fp_index;
+
+    if (p->map) {
+        munmap(p->map, p->map_size);
+    } else {
+        av_free(p->ids);
+        av_free(p->starts);
+        av_free(p->items);
+        av_free(p->postings);
+    }
+
+    if (p->sort_mutex_inited)
+        pthread_mutex_destroy(&p->sort_mutex);
+
+    av_free(p);
+}
+
+int groove_fingerprint_index_add(struct GrooveFingerprintIndex *fp_index,
+        uint64_t id, const int32_t *fingerprint, int size)
+{
+    struct GrooveFingerprintIndexPrivate *p = (struct GrooveFingerprintIndexPrivate *) fp_index;
+
+    if (size < 0)
+        return -1;
+
+    uint64_t count = fp_index->count;
+    uint64_t posting_add = (size + INDEX_STRIDE - 1) / INDEX_STRIDE;
+    if (ensure_owned(p) < 0 ||
+        grow_array((void **)&p->ids, &p->ids_capacity, count + 1, sizeof(uint64_t)) < 0 ||
+        grow_array((void **)&p->starts, &p->starts_capacity, count + 2, sizeof(uint64_t)) < 0 ||
+        grow_array((void **)&p->items, &p->item_capacity, p->item_count + size,
+            sizeof(uint32_t)) < 0 ||
+        grow_array((void **)&p->postings, &p->posting_capacity,
+            p->posting_count + posting_add, sizeof(struct IndexPosting)) < 0)
+    {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint index\n");
+        return -1;
+    }
+    uint32_t *items = p->items + p->item_count;
+    for (int i = 0; i < size; i += 1)
+        items[i] = (uint32_t)fingerprint[i];
+    for (int i = 0; i < size; i += INDEX_STRIDE) {
+        struct IndexPosting *posting = &p->postings[p->posting_count];
+        posting->key = item_key(items[i]);
+        posting->fingerprint = count;
+        posting->pos = i;
+        p->posting_count += 1;
+    }
+    if (posting_add > 0)
+        p->postings_sorted = 0;
+
+    p->ids[count] = id;
+    p->item_count += size;
+    p->starts[count + 1] = p->item_count;
+    fp_index->count += 1;
+
+    return 0;
+}
+
+int groove_fingerprint_index_find(struct GrooveFingerprintIndex *fp_index,
+        const int32_t *fingerprint, int size, double min_similarity,
+        struct GrooveFingerprintMatch *matches, int max_matches)
+{
+    struct GrooveFingerprintIndexPrivate *p = (struct GrooveFingerprintIndexPrivate *) fp_index;
+
+    sort_postings(p);
+
+    // every key of the query votes for the fingerprints and shifts that
+    // share it
+    struct IndexCandidate *candidates = NULL;
+    uint64_t candidate_count = 0;
+    uint64_t candidate_capacity = 0;
+    for (int i = 0; i < size; i += 1) {
+        uint32_t key = item_key((uint32_t)fingerprint[i]);
+        uint64_t first = find_bucket(p, key);
+        uint64_t end = first;
+        while (end < p->posting_count && p->postings[end].key == key)
+            end += 1;
+        if (end - first > INDEX_MAX_BUCKET)
+            continue;
+
+        if (grow_array((void **)&candidates, &candidate_capacity,
+                    candidate_count + (end - first), sizeof(struct IndexCandidate)) < 0)
+        {
+            av_free(candidates);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint candidates\n");
+            return -1;
+        }
+        for (uint64_t j = first; j < end; j += 1) {
+            int offset = i - (int)p->postings[j].pos;
+            if (offset > fp_index->max_offset || offset < -fp_index->max_offset)
+                continue;
+            candidates[candidate_count].fingerprint = p->postings[j].fingerprint;
+            candidates[candidate_count].offset = offset;
+            candidate_count += 1;
+        }
+    }
+    qsort(candidates, candidate_count, sizeof(struct IndexCandidate), compare_candidates);
+
+    // compare the fingerprint and shift of every run of enough votes, and
+    // keep the best shift of each fingerprint
+    struct GrooveFingerprintMatch *found = NULL;
+    uint64_t found_count = 0;
+    uint64_t found_capacity = 0;
+    // the fingerprint of the last entry of found
+    int64_t found_number = -1;
+    uint64_t run = 0;
+    while (run < candidate_count) {
+        uint64_t run_end = run + 1;
+        while (run_end < candidate_count &&
+                compare_candidates(&candidates[run], &candidates[run_end]) == 0)
+        {
+            run_end += 1;
+        }
+
+        if (run_end - run >= INDEX_MIN_VOTES) {
+            uint32_t number = candidates[run].fingerprint;
+            int offset = candidates[run].offset;
+            const uint32_t *stored = p->items + p->starts[number];
+            int64_t stored_size = p->starts[number + 1] - p->starts[number];
+            double similarity = similarity_at(fingerprint, size, stored, stored_size, offset);
+
+            if (similarity >= min_similarity) {
+                if (found_number == number) {
+                    struct GrooveFingerprintMatch *last = &found[found_count - 1];
+                    if (similarity > last->similarity) {
+                        last->similarity = similarity;
+                        last->offset = offset;
+                    }
+                } else {
+                    if (grow_array((void **)&found, &found_capacity, found_count + 1,
+                                sizeof(struct GrooveFingerprintMatch)) < 0)
+                    {
+                        av_free(candidates);
+                        av_free(found);
+                        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint matches\n");
+                        return -1;
+                    }
+                    found[found_count].id = p->ids[number];
+                    found[found_count].similarity = similarity;
+                    found[found_count].offset = offset;
+                    found_count += 1;
+                    found_number = number;
+                }
+            }
+        }
+
+        run = run_end;
+    }
+    av_free(candidates);
+
+    qsort(found, found_count, sizeof(struct GrooveFingerprintMatch), compare_matches);
+    int match_count = 0;
+    if (max_matches > 0)
+        match_count = (found_count < (uint64_t)max_matches) ? (int)found_count : max_matches;
+    if (match_count > 0)
+        memcpy(matches, found, match_count * sizeof(struct GrooveFingerprintMatch));
+    av_free(found);
+
+    return match_count;
+}
+
+static int write_array(FILE *f, const void *array, uint64_t count, size_t elem_size) {
+    if (!count)
+        return 0;
+    return (fwrite(array, elem_size, count, f) == count) ? 0 : -1;
+}
+
+// the index is written to a temporary file and then renamed, so that an
+// index mapped from the old file keeps working. mkstemp picks a temporary
+// name that no other process saving to filename has.
+int groove_fingerprint_index_save(struct GrooveFingerprintIndex *fp_index,
+        const char *filename)
+{
+    struct GrooveFingerprintIndexPrivate *p = (struct GrooveFingerprintIndexPrivate *) fp_index;
+
+    sort_postings(p);
+
+    size_t size = strlen(filename) + 8;
+    char *tmp_path = av_malloc(size);
+    if (!tmp_path) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate fingerprint index path\n");
+        return -1;
+    }
+    snprintf(tmp_path, size, "%s.XXXXXX", filename);
+
+    struct IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, index_magic, sizeof(index_magic));
+    header.version = INDEX_VERSION;
+    header.count = fp_index->count;
+    header.item_count = p->item_count;
+    header.posting_count = p->posting_count;
+
+    // mkstemp makes the file private, which an index usually is not
+    int fd = mkstemp(tmp_path);
+    if (fd >= 0)
+        fchmod(fd, 0644);
+    FILE *f = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+    if (fd >= 0 && !f)
+        close(fd);
+    int err = !f;
+    if (f) {
+        err = write_array(f, &header, 1, sizeof(header)) ||
+            write_array(f, p->ids, header.count, sizeof(uint64_t)) ||
+            write_array(f, p->starts, header.count + 1, sizeof(uint64_t)) ||
+            write_array(f, p->items, header.item_count, sizeof(uint32_t)) ||
+            write_array(f, p->postings, header.posting_count, sizeof(struct IndexPosting));
+        if (fclose(f) != 0)
+            err = -1;
+    }
+    if (!err && rename(tmp_path, filename) != 0)
+        err = -1;
+    if (err) {
+        av_log(NULL, AV_LOG_ERROR, "unable to write fingerprint index %s\n", filename);
+        if (fd >= 0)
+            remove(tmp_path);
+    }
+
+    av_free(tmp_path);
+    return err ? -1 : 0;
+}
+
+// checks that the arrays of a mapped index only point inside of it, so that
+// a damaged file cannot make a query read past the items. the postings must
+// also be sorted, since a mapped index cannot sort them.
+static int index_arrays_valid(const uint64_t *starts, uint64_t count, uint64_t item_count,
+        const struct IndexPosting *postings, uint64_t posting_count)
+{
+    if (starts[0] != 0 || starts[count] != item_count)
+        return 0;
+    for (uint64_t i = 0; i < count; i += 1) {
+        if (starts[i + 1] < starts[i])
+            return 0;
+    }
+    for (uint64_t i = 0; i < posting_count; i += 1) {
+        const struct IndexPosting *posting = &postings[i];
+        if (posting->fingerprint >= count ||
+            posting->pos >= starts[posting->fingerprint + 1] - starts[posting->fingerprint])
+        {
+            return 0;
+        }
+        if (i > 0 && compare_postings(&postings[i - 1], posting) > 0)
+            return 0;
+    }
+    return 1;
+}
+
+struct GrooveFingerprintIndex *groove_fingerprint_index_load(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        av_log(NULL, AV_LOG_ERROR, "unable to open fingerprint index %s\n", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct IndexHeader)) {
+        close(fd);
+        av_log(NULL, AV_LOG_ERROR, "%s is not a fingerprint index\n", filename);
+        return NULL;
+    }
+    size_t map_size = st.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        av_log(NULL, AV_LOG_ERROR, "unable to map fingerprint index %s\n", filename);
+        return NULL;
+    }
+
+    const struct IndexHeader *header = map;
+    int sane = header->count <= INT32_MAX && header->item_count <= map_size &&
+        header->posting_count <= map_size;
+    uint64_t expected_size = sizeof(struct IndexHeader) +
+        header->count * sizeof(uint64_t) +
+        (header->count + 1) * sizeof(uint64_t) +
+        header->item_count * sizeof(uint32_t) +
+        header->posting_count * sizeof(struct IndexPosting);
+    if (memcmp(header->magic, index_magic, sizeof(index_magic)) != 0 ||
+        header->version != INDEX_VERSION || !sane || expected_size != map_size)
+    {
+        munmap(map, map_size);
+        av_log(NULL, AV_LOG_ERROR, "%s is not a fingerprint index\n", filename);
+        return NULL;
+    }
+
+    char *data = (char *)map + sizeof(struct IndexHeader);
+    uint64_t *ids = (uint64_t *)data;
+    data += header->count * sizeof(uint64_t);
+    uint64_t *starts = (uint64_t *)data;
+    data += (header->count + 1) * sizeof(uint64_t);
+    uint32_t *items = (uint32_t *)data;
+    data += header->item_count * sizeof(uint32_t);
+    struct IndexPosting *postings = (struct IndexPosting *)data;
+    if (!index_arrays_valid(starts, header->count, header->item_count, postings,
+                header->posting_count))
+    {
+        munmap(map, map_size);
+        av_log(NULL, AV_LOG_ERROR, "fingerprint index %s is damaged\n", filename);
+        return NULL;
+    }
+
+    struct GrooveFingerprintIndex *fp_index = groove_fingerprint_index_create();
+    if (!fp_index) {
+        munmap(map, map_size);
+        return NULL;
+    }
+    struct GrooveFingerprintIndexPrivate *p = (struct GrooveFingerprintIndexPrivate *) fp_index;
+    av_free(p->starts);
+
+    p->ids = ids;
+    p->starts = starts;
+    p->items = items;
+    p->postings = postings;
+
+    fp_index->count = header->count;
+    p->item_count = header->item_count;
+    p->posting_count = header->posting_count;
+    p->postings_sorted = 1;
+    p->map = map;
+    p->map_size = map_size;
+
+    return fp_index;
+}
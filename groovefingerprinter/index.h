@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2013 Andrew Kelley
+ *
+ * This file is part of libgroove, which is MIT licensed.
+ * See http://opensource.org/licenses/MIT
+ */
+
+#ifndef GROOVE_FINGERPRINT_INDEX_H_INCLUDED
+#define GROOVE_FINGERPRINT_INDEX_H_INCLUDED
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* use this to find near-duplicates among raw fingerprints from
+ * GrooveFingerprinterInfo without an external service.
+ * fingerprints are compared bit by bit where they overlap, at the shifts
+ * suggested by an inverted index of their items.
+ */
+
+struct GrooveFingerprintMatch {
+    /* the id the fingerprint was added with */
+    uint64_t id;
+    /* the fraction of bits that are the same where the fingerprints
+     * overlap, from 0 to 1. unrelated audio scores about 0.5.
+     */
+    double similarity;
+    /* item i of the query lines up with item i - offset of the match, so
+     * this is negative when the query starts partway into the match.
+     * one item is about 0.12 seconds.
+     */
+    int offset;
+};
+
+struct GrooveFingerprintIndex {
+    /* how many items the start of a match may be shifted against the
+     * start of the query. defaults to 80, which is about 10 seconds
+     */
+    int max_offset;
+
+    /* read-only. how many fingerprints are in the index */
+    int count;
+};
+
+struct GrooveFingerprintIndex *groove_fingerprint_index_create(void);
+void groove_fingerprint_index_destroy(struct GrooveFingerprintIndex *fp_index);
+
+/* copies fingerprint into the index under id. ids need not be unique.
+ * returns 0 on success, < 0 on error
+ */
+int groove_fingerprint_index_add(struct GrooveFingerprintIndex *fp_index,
+        uint64_t id, const int32_t *fingerprint, int size);
+
+/* finds the fingerprints that are at least min_similarity similar to
+ * fingerprint and stores up to max_matches of them in matches, the most
+ * similar first. 0.8 is a reasonable min_similarity for duplicates.
+ * finds may run on several threads at once, as long as nothing is added
+ * meanwhile.
+ * returns the number of matches stored, < 0 on error
+ */
+int groove_fingerprint_index_find(struct GrooveFingerprintIndex *fp_index,
+        const int32_t *fingerprint, int size, double min_similarity,
+        struct GrooveFingerprintMatch *matches, int max_matches);
+
+/* writes the index to filename, replacing it at once, so that it is safe
+ * to save over the file an index was loaded from.
+ * the file can only be loaded on machines with the same byte order.
+ * returns 0 on success, < 0 on error
+ */
+int groove_fingerprint_index_save(struct GrooveFingerprintIndex *fp_index,
+        const char *filename);
+
+/* maps a file written by groove_fingerprint_index_save into memory. it is
+ * searched where it is mapped, so loading takes no time, and pages are
+ * only read from disk as they are needed. the first add copies the index
+ * into memory.
+ * returns NULL on error
+ */
+struct GrooveFingerprintIndex *groove_fingerprint_index_load(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* GROOVE_FINGERPRINT_INDEX_H_INCLUDED */
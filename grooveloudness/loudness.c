@@ -7,17 +7,136 @@
 
 #include "loudness.h"
 #include <groove/queue.h>
+#include <groove/cache.h>
 
 #include <ebur128.h>
 
 #include <libavutil/mem.h>
 #include <libavutil/log.h>
+#include <libavutil/channel_layout.h>
 
 #include <limits.h>
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
 
+// album histograms have one bin per 0.1 LU from -70 LUFS, which is the
+// absolute gate of EBU R128, up to +30 LUFS. this matches the resolution of
+// EBUR128_MODE_HISTOGRAM.
+#define HISTOGRAM_BIN_COUNT 1000
+#define HISTOGRAM_MIN_LOUDNESS -70.0
+
+// with normalize, the gain starts following a track once this many seconds
+// of it were measured, and then moves at most NORMALIZE_MAX_STEP dB every
+// NORMALIZE_INTERVAL seconds. the playlist ramps to each new gain, so small
+// steps cost nothing; changes of less than NORMALIZE_MIN_STEP dB are only
+// skipped because nobody can hear them.
+#define NORMALIZE_WARMUP 3.0
+#define NORMALIZE_INTERVAL 1.0
+#define NORMALIZE_MAX_STEP 1.0
+#define NORMALIZE_MIN_STEP 0.01
+
+// bump CACHE_VERSION when the layout of cache entries changes
+#define CACHE_VERSION 1
+static const char cache_magic[4] = {'G', 'R', 'L', 'C'};
+
+// how many 400ms momentary and 3s short-term loudness blocks fell into each
+// bin. the momentary blocks overlap by 75% and are used for integrated
+// loudness, the short-term blocks overlap by 2s and are used for loudness
+// range, the same way ebur128 gates them.
+struct LoudnessHistogram {
+    uint32_t momentary[HISTOGRAM_BIN_COUNT];
+    uint32_t shortterm[HISTOGRAM_BIN_COUNT];
+};
+
+// the live meter of detect_thread, when meter_interval is set
+struct MeterState {
+    double interval;
+    // seconds of audio and the highest sample since the last reading
+    double elapsed;
+    double peak;
+    // where the audio being added comes from
+    struct GroovePlaylistItem *item;
+    double pos;
+
+    // mutex applies to latest
+    pthread_mutex_t mutex;
+    char mutex_inited;
+    struct GrooveLoudnessMeter latest;
+};
+
+// the format a track's ebur128 state was set up for, and room to convert
+// audio that ebur128 cannot take directly. each thread that feeds audio to
+// ebur128 has its own.
+struct TrackScanner {
+    // GROOVE_LOUDNESS_* flags
+    int modes;
+
+    int sample_rate;
+    uint64_t channel_layout;
+    int channel_count;
+    // with GROOVE_LOUDNESS_MOMENTARY or an album histogram, how many more
+    // frames to add before polling the momentary and short-term loudness
+    size_t frames_until_poll;
+    // how many times the loudness was polled since the state was set up
+    int poll_count;
+
+    // set up ebur128 states with EBUR128_MODE_HISTOGRAM
+    int use_histogram;
+    // when not NULL, the loudness blocks of the current track are added to
+    // this
+    struct LoudnessHistogram *histogram;
+    // when not NULL, readings are published to this
+    struct MeterState *meter;
+    // when estimating, the momentary energy of the current window
+    char collect_window;
+    double window_energy;
+    int window_blocks;
+
+    // used to interleave planar audio and to convert unsigned 8-bit audio
+    uint8_t *scratch;
+    size_t scratch_size;
+};
+
+// the measurements of one track. this is also what the cache stores.
+struct TrackStats {
+    // 0 until the track is measured or loaded from the cache
+    int measured;
+    double duration;
+    double loudness;
+    double loudness_range;
+    double peak;
+    double max_momentary;
+    double max_shortterm;
+    // set for fast estimates. see estimate_windows
+    int estimated;
+    double estimate_error;
+};
+
+// one playlist item analyzed by a worker when worker_count > 0
+struct ScanJob {
+    struct GroovePlaylistItem *item;
+    char *filename;
+    double gain;
+    double peak;
+    // make a fast estimate instead of decoding the whole file
+    int estimate;
+    // written by the worker, read by collect_thread once done is set
+    struct TrackStats stats;
+    int done;
+};
+
+// lets a worker tell the audio it seeked to from the audio that was
+// already decoded. the decode thread of the private playlist sets flushed
+// while holding jobs_mutex, after it emptied the sink and before it puts
+// anything decoded after the seek in it.
+struct WindowSeek {
+    struct GrooveLoudnessDetectorPrivate *d;
+    int flushed;
+};
+
 struct GrooveLoudnessDetectorPrivate {
     struct GrooveLoudnessDetector externals;
 
@@ -28,6 +147,7 @@ struct GrooveLoudnessDetectorPrivate {
     struct GrooveSink *sink;
     struct GrooveQueue *info_queue;
     pthread_t thread_id;
+    char thread_inited;
 
     // info_head_mutex applies to variables inside this block.
     pthread_mutex_t info_head_mutex;
@@ -41,8 +161,70 @@ struct GrooveLoudnessDetectorPrivate {
     // how many items are in the queue
     int info_queue_count;
     double album_peak;
-    double track_duration;
     double album_duration;
+    double album_max_momentary;
+    double album_max_shortterm;
+    int album_estimated;
+    double album_estimate_error;
+    struct TrackStats track_stats;
+    // copies of modes, use_histogram, cache_dir and the estimate settings
+    // taken when attaching. use_histogram is also set when there is a
+    // cache_dir.
+    int modes;
+    int estimate_windows;
+    double estimate_window;
+    int use_histogram;
+    char *cache_dir;
+    // with use_histogram, the loudness blocks of the album so far. workers
+    // add to it while holding jobs_mutex.
+    struct LoudnessHistogram album_histogram;
+    // the loudness blocks of the track detect_thread is analyzing
+    struct LoudnessHistogram track_histogram;
+    // with cache_dir, where detect_thread stores the current track
+    struct GrooveCacheKey track_key;
+    char track_key_valid;
+    // the current track was loaded from the cache and is not analyzed
+    char track_cached;
+    // the current track was decoded from its beginning, so that it can be
+    // stored in the cache
+    char track_from_start;
+
+    // copies of normalize and normalize_target taken when attaching
+    char normalize;
+    double normalize_target;
+    // the gain of the current track in dB, and how many seconds of it were
+    // measured since the gain was last considered
+    double normalize_gain;
+    double normalize_elapsed;
+    // a gain change for set_decode_gain. detect_thread sets it while
+    // holding info_head_mutex and applies it after unlocking, because the
+    // playlist calls sink_purge with its own mutex held.
+    struct GroovePlaylistItem *gain_item;
+    double gain_value;
+    double gain_peak;
+    // only touched by detect_thread
+    struct TrackScanner scanner;
+    struct MeterState meter;
+
+    // set by groove_loudness_detector_attach_analyzer. the plugin then does
+    // the work of detect_thread.
+    struct GrooveAnalyzer *analyzer;
+    struct GrooveAnalyzerPlugin plugin;
+
+    // for worker_count > 0. the state of jobs[i] is all_track_states[i].
+    // jobs_mutex applies to next_job, jobs_ready and the done flags.
+    // with estimate_refine, the second half of jobs measures the items in
+    // full, and it becomes ready once the estimates have been sent.
+    struct ScanJob *jobs;
+    int job_count;
+    int jobs_ready;
+    int next_job;
+    pthread_t *worker_ids;
+    int worker_thread_count;
+    pthread_mutex_t jobs_mutex;
+    char jobs_mutex_inited;
+    pthread_cond_t job_done_cond;
+    char job_done_cond_inited;
 
     // set temporarily
     struct GroovePlaylistItem *purge_item;
@@ -50,36 +232,204 @@ struct GrooveLoudnessDetectorPrivate {
     int abort_request;
 };
 
-static int emit_track_info(struct GrooveLoudnessDetectorPrivate *d) {
+static void stats_reset(struct TrackStats *stats) {
+    stats->measured = 0;
+    stats->duration = 0.0;
+    stats->loudness = 0.0;
+    stats->loudness_range = 0.0;
+    stats->peak = 0.0;
+    stats->max_momentary = -HUGE_VAL;
+    stats->max_shortterm = -HUGE_VAL;
+    stats->estimated = 0;
+    stats->estimate_error = 0.0;
+}
+
+static void histogram_add(uint32_t *bins, double loudness) {
+    // this also skips -HUGE_VAL, which is what ebur128 reports for silence
+    if (!(loudness >= HISTOGRAM_MIN_LOUDNESS))
+        return;
+    int index = (int)((loudness - HISTOGRAM_MIN_LOUDNESS) * 10.0);
+    if (index >= HISTOGRAM_BIN_COUNT)
+        index = HISTOGRAM_BIN_COUNT - 1;
+    bins[index] += 1;
+}
+
+static void histogram_merge(struct LoudnessHistogram *dest,
+        const struct LoudnessHistogram *src)
+{
+    for (int i = 0; i < HISTOGRAM_BIN_COUNT; i += 1) {
+        dest->momentary[i] += src->momentary[i];
+        dest->shortterm[i] += src->shortterm[i];
+    }
+}
+
+static double bin_loudness(int index) {
+    return HISTOGRAM_MIN_LOUDNESS + (index + 0.5) / 10.0;
+}
+
+static double loudness_to_energy(double loudness) {
+    return pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+static double energy_to_loudness(double energy) {
+    return 10.0 * log10(energy) - 0.691;
+}
+
+// returns the first bin that passes the relative gate, which is
+// relative_gate LU below the mean loudness of all blocks, or -1 if there
+// are no blocks.
+static int histogram_gate(const uint32_t *bins, double relative_gate) {
+    double energy = 0.0;
+    uint64_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BIN_COUNT; i += 1) {
+        energy += bins[i] * loudness_to_energy(bin_loudness(i));
+        count += bins[i];
+    }
+    if (count == 0)
+        return -1;
+    double gate = energy_to_loudness(energy / count) + relative_gate;
+    if (gate < HISTOGRAM_MIN_LOUDNESS)
+        return 0;
+    int index = (int)((gate - HISTOGRAM_MIN_LOUDNESS) * 10.0);
+    return (index < HISTOGRAM_BIN_COUNT) ? index : HISTOGRAM_BIN_COUNT - 1;
+}
+
+static double histogram_integrated(const uint32_t *bins) {
+    int start = histogram_gate(bins, -10.0);
+    if (start < 0)
+        return -HUGE_VAL;
+    double energy = 0.0;
+    uint64_t count = 0;
+    for (int i = start; i < HISTOGRAM_BIN_COUNT; i += 1) {
+        energy += bins[i] * loudness_to_energy(bin_loudness(i));
+        count += bins[i];
+    }
+    return (count > 0) ? energy_to_loudness(energy / count) : -HUGE_VAL;
+}
+
+// the difference between the 10th and the 95th percentile of the gated
+// short-term loudness
+static double histogram_range(const uint32_t *bins) {
+    int start = histogram_gate(bins, -20.0);
+    if (start < 0)
+        return 0.0;
+    uint64_t count = 0;
+    for (int i = start; i < HISTOGRAM_BIN_COUNT; i += 1)
+        count += bins[i];
+    if (count == 0)
+        return 0.0;
+    uint64_t low = (uint64_t)((count - 1) * 0.1 + 0.5);
+    uint64_t high = (uint64_t)((count - 1) * 0.95 + 0.5);
+    int low_index = -1;
+    int high_index = -1;
+    uint64_t seen = 0;
+    for (int i = start; i < HISTOGRAM_BIN_COUNT; i += 1) {
+        seen += bins[i];
+        if (low_index < 0 && seen > low)
+            low_index = i;
+        if (seen > high) {
+            high_index = i;
+            break;
+        }
+    }
+    return bin_loudness(high_index) - bin_loudness(low_index);
+}
+
+static int emit_track_info(struct GrooveLoudnessDetectorPrivate *d,
+        struct GroovePlaylistItem *item, const struct TrackStats *stats)
+{
     struct GrooveLoudnessDetectorInfo *info = av_mallocz(sizeof(struct GrooveLoudnessDetectorInfo));
     if (!info) {
         av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness detector info\n");
         return -1;
     }
-    info->item = d->info_head;
-    info->duration = d->track_duration;
+    info->item = item;
+    info->duration = stats->duration;
 
-    ebur128_state *cur_track_state = d->all_track_states[d->cur_track_index];
-    if (!cur_track_state) {
+    if (!stats->measured) {
         // we received the end before we expected it. This happens for example
         // when a DRM-protected song is played. In this situation, set duration to 0
         // to indicate no song data.
         info->loudness = 0;
         info->peak = 0;
     } else {
-        ebur128_loudness_global(cur_track_state, &info->loudness);
-        ebur128_true_peak(cur_track_state, 0, &info->peak);
-        double out;
-        ebur128_true_peak(cur_track_state, 1, &out);
-        if (out > info->peak) info->peak = out;
+        info->loudness = stats->loudness;
+        info->loudness_range = stats->loudness_range;
+        if (d->modes & GROOVE_LOUDNESS_MOMENTARY) {
+            info->max_momentary = stats->max_momentary;
+            info->max_shortterm = stats->max_shortterm;
+            if (stats->max_momentary > d->album_max_momentary)
+                d->album_max_momentary = stats->max_momentary;
+            if (stats->max_shortterm > d->album_max_shortterm)
+                d->album_max_shortterm = stats->max_shortterm;
+        }
+        info->peak = stats->peak;
         if (info->peak > d->album_peak) d->album_peak = info->peak;
     }
+    if (stats->estimated) {
+        info->estimated = 1;
+        info->estimate_error = stats->estimate_error;
+        d->album_estimated = 1;
+        if (stats->estimate_error > d->album_estimate_error)
+            d->album_estimate_error = stats->estimate_error;
+    }
 
     groove_queue_put(d->info_queue, info);
 
     return 0;
 }
 
+// emits the album info for states, which must not contain NULL entries.
+// with use_histogram the album histogram is used instead.
+static void emit_album_info(struct GrooveLoudnessDetectorPrivate *d,
+        ebur128_state **states, int state_count)
+{
+    struct GrooveLoudnessDetector *detector = &d->externals;
+    struct GrooveLoudnessDetectorInfo *info = av_mallocz(
+            sizeof(struct GrooveLoudnessDetectorInfo));
+    if (!info) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate album loudness info\n");
+        return;
+    }
+    info->duration = d->album_duration;
+    if (!detector->disable_album && d->use_histogram) {
+        if (d->modes & GROOVE_LOUDNESS_INTEGRATED)
+            info->loudness = histogram_integrated(d->album_histogram.momentary);
+        if (d->modes & GROOVE_LOUDNESS_RANGE)
+            info->loudness_range = histogram_range(d->album_histogram.shortterm);
+    } else if (!detector->disable_album && state_count > 0) {
+        if (d->modes & GROOVE_LOUDNESS_INTEGRATED)
+            ebur128_loudness_global_multiple(states, state_count, &info->loudness);
+        if (d->modes & GROOVE_LOUDNESS_RANGE)
+            ebur128_loudness_range_multiple(states, state_count, &info->loudness_range);
+    }
+    if (d->modes & GROOVE_LOUDNESS_MOMENTARY) {
+        info->max_momentary = d->album_max_momentary;
+        info->max_shortterm = d->album_max_shortterm;
+    }
+    info->peak = d->album_peak;
+    info->estimated = d->album_estimated;
+    info->estimate_error = d->album_estimate_error;
+    groove_queue_put(d->info_queue, info);
+}
+
+// resets the album totals after the album info has been emitted
+static void album_reset(struct GrooveLoudnessDetectorPrivate *d) {
+    d->album_peak = 0.0;
+    d->album_duration = 0.0;
+    d->album_max_momentary = -HUGE_VAL;
+    d->album_max_shortterm = -HUGE_VAL;
+    memset(&d->album_histogram, 0, sizeof(struct LoudnessHistogram));
+    d->album_estimated = 0;
+    d->album_estimate_error = 0.0;
+}
+
+// whether the ebur128 state of every track is kept until the album info is
+// sent
+static int keep_track_states(struct GrooveLoudnessDetectorPrivate *d) {
+    return !d->externals.disable_album && !d->use_histogram;
+}
+
 static int resize_state_history(struct GrooveLoudnessDetectorPrivate *d) {
     int new_size = d->state_history_count * 2;
     d->all_track_states = realloc(d->all_track_states, new_size * sizeof(ebur128_state *));
@@ -93,6 +443,682 @@ static int resize_state_history(struct GrooveLoudnessDetectorPrivate *d) {
     return 0;
 }
 
+// tells ebur128 which speaker each channel of the layout belongs to, so that
+// surround channels are weighted and the LFE channels are ignored.
+// ITU-R BS.1770-4 weights channels between 60 and 120 degrees from the front
+// by 1.41 and all others by 1.0, and ebur128 only knows these weights by the
+// speakers that have them.
+static void set_channel_map(ebur128_state *state, uint64_t channel_layout) {
+    if (channel_layout == GROOVE_CH_LAYOUT_MONO) {
+        // a mono track is played on both speakers of a stereo system
+        ebur128_set_channel(state, 0, EBUR128_DUAL_MONO);
+        return;
+    }
+    // back channels are the surround channels of layouts without side
+    // channels, and behind them otherwise
+    int back_is_surround = !(channel_layout & (AV_CH_SIDE_LEFT|AV_CH_SIDE_RIGHT));
+    int index = 0;
+    for (int bit = 0; bit < 64; bit += 1) {
+        uint64_t channel = ((uint64_t)1) << bit;
+        if (!(channel_layout & channel))
+            continue;
+        int value;
+        switch (channel) {
+            case AV_CH_FRONT_LEFT:
+            case AV_CH_FRONT_LEFT_OF_CENTER:
+            case AV_CH_STEREO_LEFT:
+            case AV_CH_TOP_FRONT_LEFT:
+            case AV_CH_TOP_BACK_LEFT:
+                value = EBUR128_LEFT;
+                break;
+            case AV_CH_FRONT_RIGHT:
+            case AV_CH_FRONT_RIGHT_OF_CENTER:
+            case AV_CH_STEREO_RIGHT:
+            case AV_CH_TOP_FRONT_RIGHT:
+            case AV_CH_TOP_BACK_RIGHT:
+                value = EBUR128_RIGHT;
+                break;
+            case AV_CH_FRONT_CENTER:
+            case AV_CH_BACK_CENTER:
+            case AV_CH_TOP_CENTER:
+            case AV_CH_TOP_FRONT_CENTER:
+            case AV_CH_TOP_BACK_CENTER:
+                value = EBUR128_CENTER;
+                break;
+            case AV_CH_BACK_LEFT:
+                value = back_is_surround ? EBUR128_LEFT_SURROUND : EBUR128_LEFT;
+                break;
+            case AV_CH_BACK_RIGHT:
+                value = back_is_surround ? EBUR128_RIGHT_SURROUND : EBUR128_RIGHT;
+                break;
+            case AV_CH_SIDE_LEFT:
+            case AV_CH_WIDE_LEFT:
+            case AV_CH_SURROUND_DIRECT_LEFT:
+                value = EBUR128_LEFT_SURROUND;
+                break;
+            case AV_CH_SIDE_RIGHT:
+            case AV_CH_WIDE_RIGHT:
+            case AV_CH_SURROUND_DIRECT_RIGHT:
+                value = EBUR128_RIGHT_SURROUND;
+                break;
+            default:
+                // the LFE channels, and channels we know nothing about
+                value = EBUR128_UNUSED;
+                break;
+        }
+        ebur128_set_channel(state, index, value);
+        index += 1;
+    }
+}
+
+// only enable the ebur128 modes that we need, since true peak in particular
+// is expensive
+static int ebur128_modes(const struct TrackScanner *scanner) {
+    int modes = scanner->modes;
+    int mode = EBUR128_MODE_M;
+    if (scanner->use_histogram)
+        mode |= EBUR128_MODE_HISTOGRAM;
+    if (scanner->meter)
+        mode |= EBUR128_MODE_S;
+    if (modes & GROOVE_LOUDNESS_INTEGRATED)
+        mode |= EBUR128_MODE_I;
+    if (modes & GROOVE_LOUDNESS_SAMPLE_PEAK)
+        mode |= EBUR128_MODE_SAMPLE_PEAK;
+    if (modes & GROOVE_LOUDNESS_TRUE_PEAK)
+        mode |= EBUR128_MODE_TRUE_PEAK;
+    if (modes & GROOVE_LOUDNESS_RANGE)
+        mode |= EBUR128_MODE_LRA;
+    if (modes & GROOVE_LOUDNESS_MOMENTARY)
+        mode |= EBUR128_MODE_S;
+    return mode;
+}
+
+// makes sure *state matches the format of buffer, creating it if
+// necessary. returns the state or NULL on error.
+static ebur128_state *scanner_prepare(struct TrackScanner *scanner,
+        ebur128_state **state, struct GrooveBuffer *buffer)
+{
+    int channel_count = groove_channel_layout_count(buffer->format.channel_layout);
+
+    if (*state && scanner->sample_rate == buffer->format.sample_rate &&
+        scanner->channel_layout == buffer->format.channel_layout)
+    {
+        return *state;
+    }
+
+    if (channel_count < 1 || buffer->format.sample_rate < 1) {
+        av_log(NULL, AV_LOG_ERROR, "loudness scanner: invalid audio format\n");
+        return NULL;
+    }
+
+    if (!*state) {
+        *state = ebur128_init(channel_count, buffer->format.sample_rate,
+                ebur128_modes(scanner));
+        if (!*state) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate EBU R128 track context\n");
+            return NULL;
+        }
+    } else {
+        // the format changed in the middle of the track
+        ebur128_change_parameters(*state, channel_count, buffer->format.sample_rate);
+    }
+    set_channel_map(*state, buffer->format.channel_layout);
+
+    scanner->sample_rate = buffer->format.sample_rate;
+    scanner->channel_layout = buffer->format.channel_layout;
+    scanner->channel_count = channel_count;
+    scanner->frames_until_poll = buffer->format.sample_rate / 10;
+    scanner->poll_count = 0;
+
+    return *state;
+}
+
+static uint8_t *get_scratch(struct TrackScanner *scanner, size_t size) {
+    if (size > scanner->scratch_size) {
+        uint8_t *new_scratch = av_realloc(scanner->scratch, size);
+        if (!new_scratch) {
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scratch buffer\n");
+            return NULL;
+        }
+        scanner->scratch = new_scratch;
+        scanner->scratch_size = size;
+    }
+    return scanner->scratch;
+}
+
+// stores the measurements of state in stats. without a peak mode the peak
+// is unknown, so it is reported as full scale.
+static void scanner_finish(struct TrackScanner *scanner, ebur128_state *state,
+        struct TrackStats *stats)
+{
+    stats->measured = 1;
+    if (scanner->modes & GROOVE_LOUDNESS_INTEGRATED)
+        ebur128_loudness_global(state, &stats->loudness);
+    if (scanner->modes & GROOVE_LOUDNESS_RANGE)
+        ebur128_loudness_range(state, &stats->loudness_range);
+
+    int true_peak = scanner->modes & GROOVE_LOUDNESS_TRUE_PEAK;
+    if (!true_peak && !(scanner->modes & GROOVE_LOUDNESS_SAMPLE_PEAK)) {
+        stats->peak = 1.0;
+        return;
+    }
+    stats->peak = 0.0;
+    for (int i = 0; i < scanner->channel_count; i += 1) {
+        double out;
+        if (true_peak)
+            ebur128_true_peak(state, i, &out);
+        else
+            ebur128_sample_peak(state, i, &out);
+        if (out > stats->peak) stats->peak = out;
+    }
+}
+
+// adds interleaved samples to state. fmt must be an interleaved format.
+static int add_interleaved_frames(ebur128_state *state, enum GrooveSampleFormat fmt,
+        const uint8_t *samples, size_t frame_count)
+{
+    switch (fmt) {
+        case GROOVE_SAMPLE_FMT_S16:
+            return ebur128_add_frames_short(state, (const short *)samples, frame_count);
+        case GROOVE_SAMPLE_FMT_S32:
+            return ebur128_add_frames_int(state, (const int *)samples, frame_count);
+        case GROOVE_SAMPLE_FMT_FLT:
+            return ebur128_add_frames_float(state, (const float *)samples, frame_count);
+        case GROOVE_SAMPLE_FMT_DBL:
+            return ebur128_add_frames_double(state, (const double *)samples, frame_count);
+        default:
+            av_log(NULL, AV_LOG_ERROR, "loudness scanner: unsupported sample format\n");
+            return -1;
+    }
+}
+
+// the highest absolute value of count interleaved samples, in float format
+static double interleaved_peak(enum GrooveSampleFormat fmt, const uint8_t *samples,
+        size_t count)
+{
+    double peak = 0.0;
+    for (size_t i = 0; i < count; i += 1) {
+        double value;
+        switch (fmt) {
+            case GROOVE_SAMPLE_FMT_S16:
+                value = ((const int16_t *)samples)[i] / 32768.0;
+                break;
+            case GROOVE_SAMPLE_FMT_S32:
+                value = ((const int32_t *)samples)[i] / 2147483648.0;
+                break;
+            case GROOVE_SAMPLE_FMT_FLT:
+                value = ((const float *)samples)[i];
+                break;
+            case GROOVE_SAMPLE_FMT_DBL:
+                value = ((const double *)samples)[i];
+                break;
+            default:
+                return 0.0;
+        }
+        value = fabs(value);
+        if (value > peak) peak = value;
+    }
+    return peak;
+}
+
+// publishes a reading once meter->interval seconds of audio were added
+static void meter_update(struct MeterState *meter, ebur128_state *state, double seconds) {
+    meter->elapsed += seconds;
+    // allow for rounding, so that an interval of 0.1 is not missed
+    if (meter->elapsed + 0.0005 < meter->interval)
+        return;
+
+    double momentary;
+    double shortterm;
+    if (ebur128_loudness_momentary(state, &momentary) != 0)
+        momentary = -HUGE_VAL;
+    if (ebur128_loudness_shortterm(state, &shortterm) != 0)
+        shortterm = -HUGE_VAL;
+
+    pthread_mutex_lock(&meter->mutex);
+    meter->latest.item = meter->item;
+    meter->latest.pos = meter->pos;
+    meter->latest.momentary = momentary;
+    meter->latest.shortterm = shortterm;
+    meter->latest.peak = meter->peak;
+    meter->latest.count += 1;
+    pthread_mutex_unlock(&meter->mutex);
+
+    meter->elapsed = 0.0;
+    meter->peak = 0.0;
+}
+
+// records the momentary and short-term loudness of the last 100ms
+static void scanner_poll(struct TrackScanner *scanner, ebur128_state *state,
+        struct TrackStats *stats, double seconds)
+{
+    scanner->poll_count += 1;
+
+    if (scanner->meter)
+        meter_update(scanner->meter, state, seconds);
+
+    if (scanner->collect_window) {
+        double loudness;
+        if (ebur128_loudness_momentary(state, &loudness) == 0 &&
+            loudness >= HISTOGRAM_MIN_LOUDNESS)
+        {
+            scanner->window_energy += loudness_to_energy(loudness);
+            scanner->window_blocks += 1;
+        }
+    }
+
+    if (scanner->modes & GROOVE_LOUDNESS_MOMENTARY) {
+        double loudness;
+        if (ebur128_loudness_momentary(state, &loudness) == 0 &&
+            loudness > stats->max_momentary)
+        {
+            stats->max_momentary = loudness;
+        }
+        if (ebur128_loudness_shortterm(state, &loudness) == 0 &&
+            loudness > stats->max_shortterm)
+        {
+            stats->max_shortterm = loudness;
+        }
+    }
+
+    struct LoudnessHistogram *histogram = scanner->histogram;
+    if (!histogram)
+        return;
+    // like ebur128, start counting blocks once they are full: a momentary
+    // block every 100ms after 400ms and a short-term block every second
+    // after 3s
+    double loudness;
+    if ((scanner->modes & GROOVE_LOUDNESS_INTEGRATED) && scanner->poll_count >= 4 &&
+        ebur128_loudness_momentary(state, &loudness) == 0)
+    {
+        histogram_add(histogram->momentary, loudness);
+    }
+    if ((scanner->modes & GROOVE_LOUDNESS_RANGE) && scanner->poll_count >= 30 &&
+        (scanner->poll_count - 30) % 10 == 0 &&
+        ebur128_loudness_shortterm(state, &loudness) == 0)
+    {
+        histogram_add(histogram->shortterm, loudness);
+    }
+}
+
+// adds interleaved samples to state. when measuring momentary and
+// short-term loudness, keeping a histogram or metering the audio is added
+// 100ms at a time, since that is how often ebur128 updates them.
+static int scanner_feed(struct TrackScanner *scanner, ebur128_state *state,
+        enum GrooveSampleFormat fmt, const uint8_t *samples, size_t frame_count,
+        double buffer_peak, struct TrackStats *stats)
+{
+    struct MeterState *meter = scanner->meter;
+    if (!(scanner->modes & GROOVE_LOUDNESS_MOMENTARY) && !scanner->histogram &&
+        !meter && !scanner->collect_window)
+    {
+        return add_interleaved_frames(state, fmt, samples, frame_count);
+    }
+
+    size_t frame_size = groove_sample_format_bytes_per_sample(fmt) * scanner->channel_count;
+    size_t poll_interval = scanner->sample_rate / 10;
+    while (frame_count > 0) {
+        size_t count = frame_count;
+        if (count > scanner->frames_until_poll)
+            count = scanner->frames_until_poll;
+        int err = add_interleaved_frames(state, fmt, samples, count);
+        if (err)
+            return err;
+        if (meter) {
+            double peak = (buffer_peak >= 0.0) ? buffer_peak :
+                interleaved_peak(fmt, samples, count * scanner->channel_count);
+            if (peak > meter->peak) meter->peak = peak;
+            meter->pos += count / (double)scanner->sample_rate;
+        }
+        samples += count * frame_size;
+        frame_count -= count;
+        scanner->frames_until_poll -= count;
+
+        if (scanner->frames_until_poll == 0) {
+            scanner_poll(scanner, state, stats, poll_interval / (double)scanner->sample_rate);
+            scanner->frames_until_poll = (poll_interval > 0) ? poll_interval : 1;
+        }
+    }
+    return 0;
+}
+
+// feeds buffer to ebur128 in the sample format it arrived in
+static int scanner_add_frames(struct TrackScanner *scanner,
+        ebur128_state *state, struct GrooveBuffer *buffer, struct TrackStats *stats)
+{
+    // with nothing to measure the audio is only decoded and counted
+    if (!scanner->modes && !scanner->meter && !scanner->collect_window)
+        return 0;
+
+    enum GrooveSampleFormat fmt = buffer->format.sample_fmt;
+    int channel_count = scanner->channel_count;
+    size_t frame_count = buffer->frame_count;
+    size_t sample_count = frame_count * channel_count;
+    int planar = (fmt >= GROOVE_SAMPLE_FMT_U8P);
+
+    // the meter takes the peak the decode thread already found, if any.
+    // it then counts towards every reading the buffer spans.
+    double buffer_peak = -1.0;
+    if (buffer->peak) {
+        buffer_peak = 0.0;
+        for (int ch = 0; ch < channel_count; ch += 1) {
+            if (buffer->peak[ch] > buffer_peak) buffer_peak = buffer->peak[ch];
+        }
+    }
+
+    if (fmt == GROOVE_SAMPLE_FMT_U8 || fmt == GROOVE_SAMPLE_FMT_U8P) {
+        // ebur128 has no unsigned 8-bit input, so convert to float
+        float *out = (float *)get_scratch(scanner, sample_count * sizeof(float));
+        if (!out)
+            return -1;
+        for (int ch = 0; ch < channel_count; ch += 1) {
+            for (size_t i = 0; i < frame_count; i += 1) {
+                uint8_t sample = planar ? buffer->data[ch][i] :
+                    buffer->data[0][i * channel_count + ch];
+                out[i * channel_count + ch] = (sample - 128) / 128.0f;
+            }
+        }
+        return scanner_feed(scanner, state, GROOVE_SAMPLE_FMT_FLT,
+                (const uint8_t *)out, frame_count, buffer_peak, stats);
+    }
+
+    const uint8_t *samples = buffer->data[0];
+    if (planar && channel_count > 1) {
+        int bytes_per_sample = groove_sample_format_bytes_per_sample(fmt);
+        uint8_t *interleaved = get_scratch(scanner, sample_count * bytes_per_sample);
+        if (!interleaved)
+            return -1;
+        for (int ch = 0; ch < channel_count; ch += 1) {
+            const uint8_t *src = buffer->data[ch];
+            uint8_t *dest = interleaved + ch * bytes_per_sample;
+            for (size_t i = 0; i < frame_count; i += 1) {
+                memcpy(dest, src, bytes_per_sample);
+                src += bytes_per_sample;
+                dest += channel_count * bytes_per_sample;
+            }
+        }
+        samples = interleaved;
+    }
+
+    // the planar formats follow the interleaved ones in the same order
+    if (planar)
+        fmt -= GROOVE_SAMPLE_FMT_U8P - GROOVE_SAMPLE_FMT_U8;
+    return scanner_feed(scanner, state, fmt, samples, frame_count, buffer_peak, stats);
+}
+
+// returns 0 on success, < 0 if the file cannot be found
+static int cache_key_init(struct GrooveCacheKey *key, const char *filename,
+        double gain, double peak)
+{
+    double params[] = {gain, peak};
+    return groove_cache_key_init(key, filename, params, 2);
+}
+
+// only the bins that have blocks are stored
+static int write_bins(FILE *f, const uint32_t *bins) {
+    uint32_t count = 0;
+    for (int i = 0; i < HISTOGRAM_BIN_COUNT; i += 1) {
+        if (bins[i])
+            count += 1;
+    }
+    if (groove_cache_write(f, &count, sizeof(count)))
+        return -1;
+    for (uint32_t i = 0; i < HISTOGRAM_BIN_COUNT; i += 1) {
+        if (!bins[i])
+            continue;
+        uint32_t pair[2] = {i, bins[i]};
+        if (groove_cache_write(f, pair, sizeof(pair)))
+            return -1;
+    }
+    return 0;
+}
+
+static int read_bins(FILE *f, uint32_t *bins) {
+    uint32_t count;
+    if (groove_cache_read(f, &count, sizeof(count)) || count > HISTOGRAM_BIN_COUNT)
+        return -1;
+    for (uint32_t i = 0; i < count; i += 1) {
+        uint32_t pair[2];
+        if (groove_cache_read(f, pair, sizeof(pair)) || pair[0] >= HISTOGRAM_BIN_COUNT)
+            return -1;
+        bins[pair[0]] = pair[1];
+    }
+    return 0;
+}
+
+// what cache_store writes after the key
+struct CacheEntry {
+    int modes;
+    const struct TrackStats *stats;
+    const struct LoudnessHistogram *histogram;
+};
+
+static int write_cache_entry(FILE *f, void *context) {
+    struct CacheEntry *entry = context;
+    const struct TrackStats *stats = entry->stats;
+    int32_t entry_modes = entry->modes;
+    double values[6] = {stats->duration, stats->loudness, stats->loudness_range,
+        stats->peak, stats->max_momentary, stats->max_shortterm};
+
+    if (groove_cache_write(f, &entry_modes, sizeof(entry_modes)) ||
+        groove_cache_write(f, values, sizeof(values)) ||
+        write_bins(f, entry->histogram->momentary) ||
+        write_bins(f, entry->histogram->shortterm))
+    {
+        return -1;
+    }
+    return 0;
+}
+
+// returns 1 if f holds measurements made with at least modes, 0 otherwise
+static int read_cache_entry(FILE *f, int modes, struct TrackStats *stats,
+        struct LoudnessHistogram *histogram)
+{
+    int32_t entry_modes;
+    double values[6];
+    if (groove_cache_read(f, &entry_modes, sizeof(entry_modes)) ||
+        (entry_modes & modes) != modes ||
+        groove_cache_read(f, values, sizeof(values)) ||
+        read_bins(f, histogram->momentary) ||
+        read_bins(f, histogram->shortterm))
+    {
+        return 0;
+    }
+
+    stats->measured = 1;
+    stats->duration = values[0];
+    stats->loudness = values[1];
+    stats->loudness_range = values[2];
+    stats->peak = values[3];
+    stats->max_momentary = values[4];
+    stats->max_shortterm = values[5];
+    return 1;
+}
+
+// returns 1 and fills in stats and histogram if the cache has the
+// measurements of key, 0 otherwise
+static int cache_load(const char *cache_dir, int modes, const struct GrooveCacheKey *key,
+        struct TrackStats *stats, struct LoudnessHistogram *histogram)
+{
+    FILE *f = groove_cache_open(cache_dir, key, "", cache_magic, CACHE_VERSION);
+    if (!f)
+        return 0;
+
+    memset(histogram, 0, sizeof(struct LoudnessHistogram));
+    int found = read_cache_entry(f, modes, stats, histogram);
+    fclose(f);
+    if (!found) {
+        stats_reset(stats);
+        memset(histogram, 0, sizeof(struct LoudnessHistogram));
+    }
+    return found;
+}
+
+static void cache_store(const char *cache_dir, int modes, const struct GrooveCacheKey *key,
+        const struct TrackStats *stats, const struct LoudnessHistogram *histogram)
+{
+    struct CacheEntry entry = {modes, stats, histogram};
+    groove_cache_store(cache_dir, key, "", cache_magic, CACHE_VERSION,
+            write_cache_entry, &entry);
+}
+
+// called when detect_thread starts on a new track
+static void begin_track(struct GrooveLoudnessDetectorPrivate *d, struct GrooveBuffer *buffer) {
+    struct GrooveLoudnessDetector *detector = &d->externals;
+
+    if (d->normalize) {
+        // start from whatever gain the item was given, for example from an
+        // estimate
+        double gain = buffer->item->gain;
+        d->normalize_gain = (gain > 0.0) ? 20.0 * log10(gain) : 0.0;
+        d->normalize_elapsed = 0.0;
+    }
+
+    stats_reset(&d->track_stats);
+    memset(&d->track_histogram, 0, sizeof(struct LoudnessHistogram));
+    d->track_cached = 0;
+    d->track_key_valid = 0;
+    // allow for files whose first timestamp is not quite 0
+    d->track_from_start = (buffer->pos < 0.1);
+
+    // metering analyzes every track anyway, so reading the cache would not
+    // save anything
+    if (!d->cache_dir || d->scanner.meter)
+        return;
+    struct GroovePlaylistItem *item = buffer->item;
+    // when normalizing, the sink receives the audio without any gain
+    double gain = d->normalize ? 1.0 : item->gain * detector->playlist->gain;
+    double peak = d->normalize ? 1.0 : item->peak;
+    if (cache_key_init(&d->track_key, item->file->filename, gain, peak) < 0)
+        return;
+    d->track_key_valid = 1;
+    d->track_cached = cache_load(d->cache_dir, d->modes, &d->track_key,
+            &d->track_stats, &d->track_histogram);
+
+    // the track was measured before, so it can get its final gain right away
+    if (d->normalize && d->track_cached && isfinite(d->track_stats.loudness)) {
+        d->normalize_gain = d->normalize_target - d->track_stats.loudness;
+        d->gain_item = item;
+        d->gain_value = pow(10.0, d->normalize_gain / 20.0);
+        d->gain_peak = d->track_stats.peak;
+    }
+}
+
+// moves the gain of the current track toward normalize_target
+static void normalize_update(struct GrooveLoudnessDetectorPrivate *d, ebur128_state *state,
+        double seconds)
+{
+    d->normalize_elapsed += seconds;
+    if (d->track_stats.duration < NORMALIZE_WARMUP || d->normalize_elapsed < NORMALIZE_INTERVAL)
+        return;
+    d->normalize_elapsed = 0.0;
+
+    double loudness;
+    if (ebur128_loudness_global(state, &loudness) != 0 || !isfinite(loudness))
+        return;
+    double step = d->normalize_target - loudness - d->normalize_gain;
+    if (step > NORMALIZE_MAX_STEP)
+        step = NORMALIZE_MAX_STEP;
+    else if (step < -NORMALIZE_MAX_STEP)
+        step = -NORMALIZE_MAX_STEP;
+    if (fabs(step) < NORMALIZE_MIN_STEP)
+        return;
+
+    d->normalize_gain += step;
+    d->gain_item = d->info_head;
+    d->gain_value = pow(10.0, d->normalize_gain / 20.0);
+    d->gain_peak = d->info_head->peak;
+}
+
+static int emit_current_track_info(struct GrooveLoudnessDetectorPrivate *d) {
+    struct GrooveLoudnessDetector *detector = &d->externals;
+    ebur128_state *state = d->all_track_states[d->cur_track_index];
+    if (state && !d->track_cached) {
+        scanner_finish(&d->scanner, state, &d->track_stats);
+        // a track that was purged or only partly decoded is not stored
+        if (d->cache_dir && d->track_key_valid && d->track_from_start && d->info_head) {
+            cache_store(d->cache_dir, d->modes, &d->track_key, &d->track_stats,
+                    &d->track_histogram);
+        }
+    }
+    if (d->use_histogram && !detector->disable_album) {
+        histogram_merge(&d->album_histogram, &d->track_histogram);
+        memset(&d->track_histogram, 0, sizeof(struct LoudnessHistogram));
+    }
+    d->track_key_valid = 0;
+    d->track_cached = 0;
+    return emit_track_info(d, d->info_head, &d->track_stats);
+}
+
+// analyzes one buffer. info_head_mutex must be held.
+// returns the item to change the gain of with set_decode_gain after
+// unlocking, or NULL.
+static struct GroovePlaylistItem *detect_buffer(struct GrooveLoudnessDetectorPrivate *d,
+        struct GrooveBuffer *buffer)
+{
+    if (buffer->item != d->info_head) {
+        if (d->all_track_states[d->cur_track_index] || d->track_cached) {
+            emit_current_track_info(d);
+            if (!keep_track_states(d)) {
+                if (d->all_track_states[d->cur_track_index])
+                    ebur128_destroy(&d->all_track_states[d->cur_track_index]);
+            } else {
+                d->cur_track_index += 1;
+                if (d->cur_track_index >= d->state_history_count) {
+                    av_log(NULL, AV_LOG_WARNING, "loudness scanner: resizing state history."
+                            " Unless you're loudness-scanning very large albums you might"
+                            " consider setting use_histogram or disable_album to 1.\n");
+                    resize_state_history(d);
+                }
+            }
+        }
+        begin_track(d, buffer);
+        d->info_head = buffer->item;
+        d->info_pos = buffer->pos;
+    }
+
+    double buffer_duration = buffer->frame_count / (double)buffer->format.sample_rate;
+    d->album_duration += buffer_duration;
+    // a cached track already has its measurements
+    if (!d->track_cached) {
+        d->meter.item = buffer->item;
+        d->meter.pos = buffer->pos;
+        d->track_stats.duration += buffer_duration;
+        ebur128_state *state = scanner_prepare(&d->scanner,
+                &d->all_track_states[d->cur_track_index], buffer);
+        if (state) {
+            scanner_add_frames(&d->scanner, state, buffer, &d->track_stats);
+            if (d->normalize && d->info_head)
+                normalize_update(d, state, buffer_duration);
+        }
+    }
+
+    struct GroovePlaylistItem *gain_item = d->gain_item;
+    d->gain_item = NULL;
+    return gain_item;
+}
+
+// sends the last track info and the album info. info_head_mutex must be
+// held.
+static void detect_end(struct GrooveLoudnessDetectorPrivate *d) {
+    // last file info
+    emit_current_track_info(d);
+
+    // send album info
+    emit_album_info(d, d->all_track_states, d->cur_track_index + 1);
+
+    for (int i = 0; i <= d->cur_track_index; i += 1) {
+        if (d->all_track_states[i])
+            ebur128_destroy(&d->all_track_states[i]);
+    }
+    d->cur_track_index = 0;
+
+    album_reset(d);
+
+    d->info_head = NULL;
+    d->info_pos = -1.0;
+}
+
 static void *detect_thread(void *arg) {
     struct GrooveLoudnessDetectorPrivate *d = arg;
     struct GrooveLoudnessDetector *detector = &d->externals;
@@ -117,38 +1143,7 @@ static void *detect_thread(void *arg) {
         pthread_mutex_lock(&d->info_head_mutex);
 
         if (result == GROOVE_BUFFER_END) {
-            // last file info
-            emit_track_info(d);
-
-            // send album info
-            struct GrooveLoudnessDetectorInfo *info = av_mallocz(
-                    sizeof(struct GrooveLoudnessDetectorInfo));
-            if (info) {
-                info->duration = d->album_duration;
-                if (!detector->disable_album) {
-                    ebur128_loudness_global_multiple(d->all_track_states, d->cur_track_index + 1,
-                            &info->loudness);
-                }
-                info->peak = d->album_peak;
-                groove_queue_put(d->info_queue, info);
-            } else {
-                av_log(NULL, AV_LOG_ERROR, "unable to allocate album loudness info\n");
-            }
-
-            if (!detector->disable_album) {
-                for (int i = 0; i <= d->cur_track_index; i += 1) {
-                    if (d->all_track_states[i])
-                        ebur128_destroy(&d->all_track_states[i]);
-                }
-                d->cur_track_index = 0;
-            }
-
-            d->album_peak = 0.0;
-            d->album_duration = 0.0;
-
-            d->info_head = NULL;
-            d->info_pos = -1.0;
-
+            detect_end(d);
             pthread_mutex_unlock(&d->info_head_mutex);
             continue;
         }
@@ -158,41 +1153,312 @@ static void *detect_thread(void *arg) {
             break;
         }
 
-        if (buffer->item != d->info_head) {
-            if (d->all_track_states[d->cur_track_index]) {
-                emit_track_info(d);
-                if (detector->disable_album) {
-                    ebur128_destroy(&d->all_track_states[d->cur_track_index]);
-                } else {
-                    d->cur_track_index += 1;
-                    if (d->cur_track_index >= d->state_history_count) {
-                        av_log(NULL, AV_LOG_WARNING, "loudness scanner: resizing state history."
-                                " Unless you're loudness-scanning very large albums you might"
-                                " consider setting disable_album to 1.\n");
-                        resize_state_history(d);
-                    }
-                }
+        struct GroovePlaylistItem *gain_item = detect_buffer(d, buffer);
+        pthread_mutex_unlock(&d->info_head_mutex);
+
+        if (gain_item) {
+            groove_playlist_set_decode_gain(detector->playlist, gain_item,
+                    d->gain_value, d->gain_peak);
+        }
+        groove_buffer_unref(buffer);
+    }
+
+    return NULL;
+}
+
+static void window_sink_flush(struct GrooveSink *sink) {
+    struct WindowSeek *seek = sink->userdata;
+    pthread_mutex_lock(&seek->d->jobs_mutex);
+    seek->flushed = 1;
+    pthread_mutex_unlock(&seek->d->jobs_mutex);
+}
+
+// analyzes estimate_windows evenly spaced windows of the item instead of all
+// of it. the error is the standard error of the mean window loudness,
+// corrected for the part of the track that was sampled.
+static void scan_windows(struct GrooveLoudnessDetectorPrivate *d, struct TrackScanner *scanner,
+        struct ScanJob *job, ebur128_state **state, struct GroovePlaylist *playlist,
+        struct GrooveSink *sink, struct WindowSeek *seek, double duration)
+{
+    int window_count = d->estimate_windows;
+    double window = d->estimate_window;
+    double *window_loudness = av_malloc(window_count * sizeof(double));
+    if (!window_loudness) {
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness estimate windows\n");
+        return;
+    }
+    int measured_count = 0;
+
+    scanner->collect_window = 1;
+    for (int i = 0; i < window_count && !d->abort_request; i += 1) {
+        pthread_mutex_lock(&d->jobs_mutex);
+        seek->flushed = 0;
+        pthread_mutex_unlock(&d->jobs_mutex);
+
+        double start = (i + 0.5) * duration / window_count - window / 2.0;
+        groove_playlist_seek(playlist, playlist->head, (start > 0.0) ? start : 0.0);
+        scanner->window_energy = 0.0;
+        scanner->window_blocks = 0;
+
+        double elapsed = 0.0;
+        int ended = 0;
+        while (elapsed < window) {
+            // skip what was decoded before the seek. the flag must be read
+            // before getting the buffer: a buffer taken out of the queue
+            // before the flush is stale even if the flush happens by the
+            // time it is returned.
+            pthread_mutex_lock(&d->jobs_mutex);
+            int fresh = seek->flushed;
+            pthread_mutex_unlock(&d->jobs_mutex);
+            struct GrooveBuffer *buffer;
+            if (d->abort_request ||
+                groove_sink_buffer_get(sink, &buffer, 1) != GROOVE_BUFFER_YES)
+            {
+                ended = 1;
+                break;
             }
-            d->all_track_states[d->cur_track_index] = ebur128_init(2, 44100,
-                    EBUR128_MODE_TRUE_PEAK|EBUR128_MODE_I);
-            if (!d->all_track_states[d->cur_track_index]) {
-                av_log(NULL, AV_LOG_ERROR, "unable to allocate EBU R128 track context\n");
+            if (fresh) {
+                elapsed += buffer->frame_count / (double)buffer->format.sample_rate;
+                ebur128_state *st = scanner_prepare(scanner, state, buffer);
+                if (st)
+                    scanner_add_frames(scanner, st, buffer, &job->stats);
             }
-            d->track_duration = 0.0;
-            d->info_head = buffer->item;
-            d->info_pos = buffer->pos;
+            groove_buffer_unref(buffer);
+        }
+
+        if (scanner->window_blocks > 0) {
+            window_loudness[measured_count] = energy_to_loudness(
+                    scanner->window_energy / scanner->window_blocks);
+            measured_count += 1;
+        }
+        if (ended)
+            break;
+    }
+    scanner->collect_window = 0;
+
+    job->stats.duration = duration;
+    job->stats.estimated = 1;
+    if (measured_count < 2) {
+        job->stats.estimate_error = HUGE_VAL;
+    } else {
+        double mean = 0.0;
+        for (int i = 0; i < measured_count; i += 1)
+            mean += window_loudness[i];
+        mean /= measured_count;
+        double variance = 0.0;
+        for (int i = 0; i < measured_count; i += 1)
+            variance += (window_loudness[i] - mean) * (window_loudness[i] - mean);
+        variance /= measured_count - 1;
+        double sampled = window_count * window / duration;
+        job->stats.estimate_error = sqrt(variance / measured_count * (1.0 - sampled));
+    }
+    av_free(window_loudness);
+}
+
+// decodes and analyzes one job on a private playlist, so that several jobs
+// can be decoded at the same time
+static void scan_job(struct GrooveLoudnessDetectorPrivate *d, struct TrackScanner *scanner,
+        struct ScanJob *job, ebur128_state **state)
+{
+    struct GrooveLoudnessDetector *detector = &d->externals;
+
+    stats_reset(&job->stats);
+    struct GrooveCacheKey key;
+    int key_valid = 0;
+    if (d->cache_dir) {
+        double gain = job->gain * detector->playlist->gain;
+        key_valid = (cache_key_init(&key, job->filename, gain, job->peak) >= 0);
+        if (key_valid && cache_load(d->cache_dir, d->modes, &key, &job->stats,
+                    scanner->histogram))
+        {
+            return;
+        }
+    }
+
+    struct GrooveFile *file = groove_file_open(job->filename);
+    if (!file) {
+        av_log(NULL, AV_LOG_ERROR, "loudness scanner: unable to open %s\n", job->filename);
+        return;
+    }
+
+    struct GroovePlaylist *playlist = groove_playlist_create();
+    struct GrooveSink *sink = groove_sink_create();
+    if (!playlist || !sink) {
+        av_log(NULL, AV_LOG_ERROR, "loudness scanner: out of memory\n");
+        groove_sink_destroy(sink);
+        if (playlist)
+            groove_playlist_destroy(playlist);
+        groove_file_close(file);
+        return;
+    }
+
+    sink->audio_format = d->sink->audio_format;
+    sink->disable_resample = 1;
+    sink->buffer_size = detector->sink_buffer_size;
+    groove_playlist_set_gain(playlist, detector->playlist->gain);
+
+    // estimate only when the windows cover at most half of the track, and
+    // the track is long enough to be worth it
+    double duration = groove_file_duration(file);
+    int estimate = job->estimate &&
+        duration > 2.0 * d->estimate_windows * d->estimate_window;
+    struct WindowSeek seek;
+    seek.d = d;
+    seek.flushed = 0;
+    sink->userdata = &seek;
+    sink->flush = window_sink_flush;
+
+    // insert before attaching so that the sink never sees the end of the
+    // empty playlist
+    groove_playlist_insert(playlist, file, job->gain, job->peak, NULL);
+    if (groove_sink_attach(sink, playlist) < 0) {
+        av_log(NULL, AV_LOG_ERROR, "loudness scanner: unable to attach sink\n");
+    } else if (estimate) {
+        scan_windows(d, scanner, job, state, playlist, sink, &seek, duration);
+        groove_sink_detach(sink);
+    } else {
+        struct GrooveBuffer *buffer;
+        while (!d->abort_request &&
+                groove_sink_buffer_get(sink, &buffer, 1) == GROOVE_BUFFER_YES)
+        {
+            job->stats.duration += buffer->frame_count / (double)buffer->format.sample_rate;
+            ebur128_state *st = scanner_prepare(scanner, state, buffer);
+            if (st)
+                scanner_add_frames(scanner, st, buffer, &job->stats);
+            groove_buffer_unref(buffer);
+        }
+        groove_sink_detach(sink);
+    }
+
+    if (*state) {
+        scanner_finish(scanner, *state, &job->stats);
+        if (key_valid && !d->abort_request && !job->stats.estimated)
+            cache_store(d->cache_dir, d->modes, &key, &job->stats, scanner->histogram);
+    }
+
+    groove_sink_destroy(sink);
+    groove_playlist_clear(playlist);
+    groove_playlist_destroy(playlist);
+    groove_file_close(file);
+}
+
+static void *worker_thread(void *arg) {
+    struct GrooveLoudnessDetectorPrivate *d = arg;
+    struct GrooveLoudnessDetector *detector = &d->externals;
+    struct TrackScanner scanner;
+    memset(&scanner, 0, sizeof(scanner));
+    scanner.modes = d->modes;
+    scanner.use_histogram = d->use_histogram;
+
+    // the blocks of each job are collected here and then added to the album
+    // histogram, so that the workers do not contend for it
+    struct LoudnessHistogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    if (d->use_histogram && (!detector->disable_album || d->cache_dir))
+        scanner.histogram = &histogram;
+
+    for (;;) {
+        pthread_mutex_lock(&d->jobs_mutex);
+        // wait for the refine jobs to become ready
+        while (!d->abort_request && d->next_job >= d->jobs_ready &&
+                d->next_job < d->job_count)
+        {
+            pthread_cond_wait(&d->job_done_cond, &d->jobs_mutex);
+        }
+        if (d->abort_request || d->next_job >= d->job_count) {
+            pthread_mutex_unlock(&d->jobs_mutex);
+            break;
         }
+        int index = d->next_job;
+        d->next_job += 1;
+        pthread_mutex_unlock(&d->jobs_mutex);
 
-        double buffer_duration = buffer->frame_count / (double)buffer->format.sample_rate;
-        d->track_duration += buffer_duration;
-        d->album_duration += buffer_duration;
-        ebur128_add_frames_double(d->all_track_states[d->cur_track_index],
-                (double*)buffer->data[0], buffer->frame_count);
+        scan_job(d, &scanner, &d->jobs[index], &d->all_track_states[index]);
 
+        pthread_mutex_lock(&d->jobs_mutex);
+        if (scanner.histogram) {
+            if (!detector->disable_album)
+                histogram_merge(&d->album_histogram, &histogram);
+            memset(&histogram, 0, sizeof(histogram));
+        }
+        d->jobs[index].done = 1;
+        pthread_cond_broadcast(&d->job_done_cond);
+        pthread_mutex_unlock(&d->jobs_mutex);
+    }
+
+    av_free(scanner.scratch);
+    return NULL;
+}
+
+// emits the results of jobs first up to but not including end in playlist
+// order, followed by their album info. returns < 0 when aborted.
+static int collect_jobs(struct GrooveLoudnessDetectorPrivate *d, int first, int end) {
+    struct GrooveLoudnessDetector *detector = &d->externals;
+
+    for (int i = first; i < end; i += 1) {
+        struct ScanJob *job = &d->jobs[i];
+
+        pthread_mutex_lock(&d->info_head_mutex);
+        while (!d->abort_request && d->info_queue_count >= detector->info_queue_size)
+            pthread_cond_wait(&d->drain_cond, &d->info_head_mutex);
+        d->info_head = job->item;
+        d->info_pos = 0.0;
         pthread_mutex_unlock(&d->info_head_mutex);
-        groove_buffer_unref(buffer);
+
+        pthread_mutex_lock(&d->jobs_mutex);
+        while (!d->abort_request && !job->done)
+            pthread_cond_wait(&d->job_done_cond, &d->jobs_mutex);
+        pthread_mutex_unlock(&d->jobs_mutex);
+
+        if (d->abort_request)
+            return -1;
+
+        pthread_mutex_lock(&d->info_head_mutex);
+        d->album_duration += job->stats.duration;
+        emit_track_info(d, job->item, &job->stats);
+        if (!keep_track_states(d) && d->all_track_states[i])
+            ebur128_destroy(&d->all_track_states[i]);
+        pthread_mutex_unlock(&d->info_head_mutex);
+    }
+
+    // gather the states of the tracks that had audio
+    ebur128_state **states = d->all_track_states + first;
+    int state_count = 0;
+    for (int i = 0; i < end - first; i += 1) {
+        if (states[i]) {
+            ebur128_state *state = states[i];
+            states[i] = NULL;
+            states[state_count] = state;
+            state_count += 1;
+        }
     }
 
+    pthread_mutex_lock(&d->info_head_mutex);
+    emit_album_info(d, states, state_count);
+    album_reset(d);
+    d->info_head = NULL;
+    d->info_pos = -1.0;
+    pthread_mutex_unlock(&d->info_head_mutex);
+
+    return 0;
+}
+
+// when worker_count > 0 this thread runs instead of detect_thread. it emits
+// the results of the workers in playlist order.
+static void *collect_thread(void *arg) {
+    struct GrooveLoudnessDetectorPrivate *d = arg;
+
+    if (collect_jobs(d, 0, d->jobs_ready) < 0 || d->jobs_ready == d->job_count)
+        return NULL;
+
+    // now measure the estimated items in full
+    pthread_mutex_lock(&d->jobs_mutex);
+    int first = d->jobs_ready;
+    d->jobs_ready = d->job_count;
+    pthread_cond_broadcast(&d->job_done_cond);
+    pthread_mutex_unlock(&d->jobs_mutex);
+
+    collect_jobs(d, first, d->job_count);
     return NULL;
 }
 
@@ -225,9 +1491,9 @@ static int info_queue_purge(struct GrooveQueue* queue, void *obj) {
     return info->item == d->purge_item;
 }
 
-static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
-    struct GrooveLoudnessDetectorPrivate *d = sink->userdata;
-
+static void detector_purge(struct GrooveLoudnessDetectorPrivate *d,
+        struct GroovePlaylistItem *item)
+{
     pthread_mutex_lock(&d->info_head_mutex);
     d->purge_item = item;
     groove_queue_purge(d->info_queue);
@@ -237,13 +1503,17 @@ static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item)
         d->info_head = NULL;
         d->info_pos = -1.0;
     }
+    if (d->meter.item == item)
+        d->meter.item = NULL;
+    pthread_mutex_lock(&d->meter.mutex);
+    if (d->meter.latest.item == item)
+        d->meter.latest.item = NULL;
+    pthread_mutex_unlock(&d->meter.mutex);
     pthread_cond_signal(&d->drain_cond);
     pthread_mutex_unlock(&d->info_head_mutex);
 }
 
-static void sink_flush(struct GrooveSink *sink) {
-    struct GrooveLoudnessDetectorPrivate *d = sink->userdata;
-
+static void detector_flush(struct GrooveLoudnessDetectorPrivate *d) {
     pthread_mutex_lock(&d->info_head_mutex);
     groove_queue_flush(d->info_queue);
     for (int i = 0; i <= d->cur_track_index; i += 1) {
@@ -251,7 +1521,12 @@ static void sink_flush(struct GrooveSink *sink) {
             ebur128_destroy(&d->all_track_states[i]);
     }
     d->cur_track_index = 0;
-    d->track_duration = 0.0;
+    stats_reset(&d->track_stats);
+    memset(&d->track_histogram, 0, sizeof(struct LoudnessHistogram));
+    d->track_key_valid = 0;
+    d->track_cached = 0;
+    d->meter.elapsed = 0.0;
+    d->meter.peak = 0.0;
     d->info_head = NULL;
     d->info_pos = -1.0;
 
@@ -259,6 +1534,61 @@ static void sink_flush(struct GrooveSink *sink) {
     pthread_mutex_unlock(&d->info_head_mutex);
 }
 
+static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item) {
+    detector_purge(sink->userdata, item);
+}
+
+static void sink_flush(struct GrooveSink *sink) {
+    detector_flush(sink->userdata);
+}
+
+static void plugin_attach(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylist *playlist) {
+    struct GrooveLoudnessDetectorPrivate *d = plugin->userdata;
+    d->externals.playlist = playlist;
+    d->abort_request = 0;
+}
+
+static void plugin_detach(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveLoudnessDetectorPrivate *d = plugin->userdata;
+    pthread_mutex_lock(&d->info_head_mutex);
+    d->abort_request = 1;
+    pthread_cond_signal(&d->drain_cond);
+    pthread_mutex_unlock(&d->info_head_mutex);
+}
+
+// the analyzer thread waits here while the info queue is full, like
+// detect_thread does
+static void plugin_buffer(struct GrooveAnalyzerPlugin *plugin, struct GrooveBuffer *buffer) {
+    struct GrooveLoudnessDetectorPrivate *d = plugin->userdata;
+    struct GrooveLoudnessDetector *detector = &d->externals;
+
+    pthread_mutex_lock(&d->info_head_mutex);
+    while (!d->abort_request && d->info_queue_count >= detector->info_queue_size)
+        pthread_cond_wait(&d->drain_cond, &d->info_head_mutex);
+    struct GroovePlaylistItem *gain_item = d->abort_request ? NULL : detect_buffer(d, buffer);
+    pthread_mutex_unlock(&d->info_head_mutex);
+
+    if (gain_item) {
+        groove_playlist_set_decode_gain(detector->playlist, gain_item,
+                d->gain_value, d->gain_peak);
+    }
+}
+
+static void plugin_end(struct GrooveAnalyzerPlugin *plugin) {
+    struct GrooveLoudnessDetectorPrivate *d = plugin->userdata;
+    pthread_mutex_lock(&d->info_head_mutex);
+    detect_end(d);
+    pthread_mutex_unlock(&d->info_head_mutex);
+}
+
+static void plugin_flush(struct GrooveAnalyzerPlugin *plugin) {
+    detector_flush(plugin->userdata);
+}
+
+static void plugin_purge(struct GrooveAnalyzerPlugin *plugin, struct GroovePlaylistItem *item) {
+    detector_purge(plugin->userdata, item);
+}
+
 struct GrooveLoudnessDetector *groove_loudness_detector_create(void) {
     struct GrooveLoudnessDetectorPrivate *d = av_mallocz(sizeof(struct GrooveLoudnessDetectorPrivate));
     if (!d) {
@@ -282,6 +1612,27 @@ struct GrooveLoudnessDetector *groove_loudness_detector_create(void) {
     }
     d->drain_cond_inited = 1;
 
+    if (pthread_mutex_init(&d->jobs_mutex, NULL) != 0) {
+        groove_loudness_detector_destroy(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    d->jobs_mutex_inited = 1;
+
+    if (pthread_cond_init(&d->job_done_cond, NULL) != 0) {
+        groove_loudness_detector_destroy(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
+        return NULL;
+    }
+    d->job_done_cond_inited = 1;
+
+    if (pthread_mutex_init(&d->meter.mutex, NULL) != 0) {
+        groove_loudness_detector_destroy(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex\n");
+        return NULL;
+    }
+    d->meter.mutex_inited = 1;
+
     d->info_queue = groove_queue_create();
     if (!d->info_queue) {
         groove_loudness_detector_destroy(detector);
@@ -303,12 +1654,26 @@ struct GrooveLoudnessDetector *groove_loudness_detector_create(void) {
     d->sink->audio_format.sample_rate = 44100;
     d->sink->audio_format.channel_layout = GROOVE_CH_LAYOUT_STEREO;
     d->sink->audio_format.sample_fmt = GROOVE_SAMPLE_FMT_DBL;
+    // ebur128 handles any rate, channel count and sample format, so analyze
+    // the decoded audio as it is instead of resampling it.
+    d->sink->disable_resample = 1;
     d->sink->userdata = detector;
     d->sink->purge = sink_purge;
     d->sink->flush = sink_flush;
 
+    d->plugin.userdata = d;
+    d->plugin.attach = plugin_attach;
+    d->plugin.detach = plugin_detach;
+    d->plugin.buffer = plugin_buffer;
+    d->plugin.end = plugin_end;
+    d->plugin.flush = plugin_flush;
+    d->plugin.purge = plugin_purge;
+
     // set some defaults
     detector->info_queue_size = INT_MAX;
+    detector->modes = GROOVE_LOUDNESS_INTEGRATED|GROOVE_LOUDNESS_TRUE_PEAK;
+    detector->estimate_window = 3.0;
+    detector->normalize_target = -18.0;
     detector->sink_buffer_size = d->sink->buffer_size;
 
     return detector;
@@ -332,19 +1697,143 @@ void groove_loudness_detector_destroy(struct GrooveLoudnessDetector *detector) {
     if (d->drain_cond_inited)
         pthread_cond_destroy(&d->drain_cond);
 
+    if (d->jobs_mutex_inited)
+        pthread_mutex_destroy(&d->jobs_mutex);
+
+    if (d->job_done_cond_inited)
+        pthread_cond_destroy(&d->job_done_cond);
+
+    if (d->meter.mutex_inited)
+        pthread_mutex_destroy(&d->meter.mutex);
+
+    av_free(d->scanner.scratch);
     av_free(d);
 }
 
-int groove_loudness_detector_attach(struct GrooveLoudnessDetector *detector,
-        struct GroovePlaylist *playlist)
-{
+// sets up one job per playlist item and starts the worker pool
+static int attach_workers(struct GrooveLoudnessDetector *detector) {
+    struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
+    struct GroovePlaylist *playlist = detector->playlist;
+
+    int item_count = groove_playlist_count(playlist);
+    int estimate = (d->estimate_windows > 0 && d->estimate_window > 0.0);
+    int refine = estimate && detector->estimate_refine;
+    int count = refine ? item_count * 2 : item_count;
+
+    // one state per job. cur_track_index is set so that detach destroys
+    // them all.
+    d->state_history_count = (count > 0) ? count : 1;
+    d->all_track_states = calloc(d->state_history_count, sizeof(ebur128_state*));
+    d->cur_track_index = d->state_history_count - 1;
+    d->jobs = av_mallocz(d->state_history_count * sizeof(struct ScanJob));
+    if (!d->all_track_states || !d->jobs) {
+        groove_loudness_detector_detach(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scan jobs\n");
+        return -1;
+    }
+
+    struct GroovePlaylistItem *item = playlist->head;
+    for (int i = 0; i < count; i += 1, item = item->next) {
+        // the refine jobs go over the playlist a second time
+        if (i == item_count)
+            item = playlist->head;
+        struct ScanJob *job = &d->jobs[i];
+        job->item = item;
+        job->estimate = estimate && i < item_count;
+        job->gain = item->gain;
+        job->peak = item->peak;
+        job->filename = av_strdup(item->file->filename);
+        if (!job->filename) {
+            groove_loudness_detector_detach(detector);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scan jobs\n");
+            return -1;
+        }
+        d->job_count += 1;
+    }
+    d->next_job = 0;
+    d->jobs_ready = refine ? item_count : count;
+
+    d->worker_ids = av_mallocz(detector->worker_count * sizeof(pthread_t));
+    if (!d->worker_ids) {
+        groove_loudness_detector_detach(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness scan workers\n");
+        return -1;
+    }
+
+    if (pthread_create(&d->thread_id, NULL, collect_thread, detector) != 0) {
+        groove_loudness_detector_detach(detector);
+        av_log(NULL, AV_LOG_ERROR, "unable to create detector thread\n");
+        return -1;
+    }
+    d->thread_inited = 1;
+
+    for (int i = 0; i < detector->worker_count; i += 1) {
+        if (pthread_create(&d->worker_ids[i], NULL, worker_thread, detector) != 0) {
+            groove_loudness_detector_detach(detector);
+            av_log(NULL, AV_LOG_ERROR, "unable to create loudness scan worker\n");
+            return -1;
+        }
+        d->worker_thread_count += 1;
+    }
+
+    return 0;
+}
+
+// takes copies of the settings and resets the measurements for attaching
+static int attach_settings(struct GrooveLoudnessDetector *detector) {
     struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
 
-    detector->playlist = playlist;
     groove_queue_reset(d->info_queue);
 
+    d->modes = detector->modes;
+    // normalizing follows the playlist, so it needs the default mode
+    d->normalize = detector->normalize && detector->worker_count <= 0;
+    d->normalize_target = detector->normalize_target;
+    d->gain_item = NULL;
+    if (d->normalize)
+        d->modes |= GROOVE_LOUDNESS_INTEGRATED;
+    d->sink->disable_gain = d->normalize;
+    d->estimate_windows = detector->estimate_windows;
+    d->estimate_window = detector->estimate_window;
+    d->use_histogram = detector->use_histogram || detector->cache_dir;
+    if (detector->cache_dir) {
+        d->cache_dir = av_strdup(detector->cache_dir);
+        if (!d->cache_dir) {
+            groove_loudness_detector_detach(detector);
+            av_log(NULL, AV_LOG_ERROR, "unable to allocate loudness cache path\n");
+            return -1;
+        }
+    }
+    d->scanner.modes = d->modes;
+    // with histograms the loudness so far is cheap to get, which normalizing
+    // does every second
+    d->scanner.use_histogram = d->use_histogram || d->normalize;
+    d->scanner.histogram = (d->use_histogram && (!detector->disable_album || d->cache_dir)) ?
+        &d->track_histogram : NULL;
+
+    d->meter.interval = detector->meter_interval;
+    d->meter.elapsed = 0.0;
+    d->meter.peak = 0.0;
+    d->meter.item = NULL;
+    d->meter.pos = 0.0;
+    pthread_mutex_lock(&d->meter.mutex);
+    memset(&d->meter.latest, 0, sizeof(struct GrooveLoudnessMeter));
+    pthread_mutex_unlock(&d->meter.mutex);
+    d->scanner.meter = (detector->meter_interval > 0.0 && detector->worker_count <= 0) ?
+        &d->meter : NULL;
+    d->sink->compute_levels = (d->scanner.meter != NULL);
+    stats_reset(&d->track_stats);
+    album_reset(d);
+
+    return 0;
+}
+
+// sets up the track states of the default mode
+static int attach_states(struct GrooveLoudnessDetector *detector) {
+    struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
+
     // set the initial state history size. if we run out we will realloc later.
-    d->state_history_count = detector->disable_album ? 1 : 128;
+    d->state_history_count = keep_track_states(d) ? 128 : 1;
     d->all_track_states = calloc(d->state_history_count, sizeof(ebur128_state*));
     d->cur_track_index = 0;
     if (!d->all_track_states) {
@@ -353,6 +1842,24 @@ int groove_loudness_detector_attach(struct GrooveLoudnessDetector *detector,
         return -1;
     }
 
+    return 0;
+}
+
+int groove_loudness_detector_attach(struct GrooveLoudnessDetector *detector,
+        struct GroovePlaylist *playlist)
+{
+    struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
+
+    detector->playlist = playlist;
+    if (attach_settings(detector) < 0)
+        return -1;
+
+    if (detector->worker_count > 0)
+        return attach_workers(detector);
+
+    if (attach_states(detector) < 0)
+        return -1;
+
     if (groove_sink_attach(d->sink, playlist) < 0) {
         groove_loudness_detector_detach(detector);
         av_log(NULL, AV_LOG_ERROR, "unable to attach sink\n");
@@ -364,6 +1871,33 @@ int groove_loudness_detector_attach(struct GrooveLoudnessDetector *detector,
         av_log(NULL, AV_LOG_ERROR, "unable to create detector thread\n");
         return -1;
     }
+    d->thread_inited = 1;
+
+    return 0;
+}
+
+int groove_loudness_detector_attach_analyzer(struct GrooveLoudnessDetector *detector,
+        struct GrooveAnalyzer *analyzer)
+{
+    struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
+
+    if (detector->worker_count > 0) {
+        av_log(NULL, AV_LOG_ERROR, "loudness detector: worker_count cannot be used with an analyzer\n");
+        return -1;
+    }
+
+    if (attach_settings(detector) < 0 || attach_states(detector) < 0)
+        return -1;
+
+    d->plugin.audio_format = d->sink->audio_format;
+    d->plugin.disable_resample = d->sink->disable_resample;
+    d->plugin.disable_gain = d->sink->disable_gain;
+    d->plugin.buffer_size = detector->sink_buffer_size;
+    if (groove_analyzer_add_plugin(analyzer, &d->plugin) < 0) {
+        groove_loudness_detector_detach(detector);
+        return -1;
+    }
+    d->analyzer = analyzer;
 
     return 0;
 }
@@ -372,11 +1906,38 @@ int groove_loudness_detector_detach(struct GrooveLoudnessDetector *detector) {
     struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
 
     d->abort_request = 1;
-    groove_sink_detach(d->sink);
+    if (d->sink->playlist)
+        groove_sink_detach(d->sink);
     groove_queue_flush(d->info_queue);
     groove_queue_abort(d->info_queue);
+    pthread_mutex_lock(&d->info_head_mutex);
     pthread_cond_signal(&d->drain_cond);
-    pthread_join(d->thread_id, NULL);
+    pthread_mutex_unlock(&d->info_head_mutex);
+    pthread_mutex_lock(&d->jobs_mutex);
+    pthread_cond_broadcast(&d->job_done_cond);
+    pthread_mutex_unlock(&d->jobs_mutex);
+    if (d->thread_inited) {
+        pthread_join(d->thread_id, NULL);
+        d->thread_inited = 0;
+    }
+
+    for (int i = 0; i < d->worker_thread_count; i += 1)
+        pthread_join(d->worker_ids[i], NULL);
+    d->worker_thread_count = 0;
+    av_free(d->worker_ids);
+    d->worker_ids = NULL;
+
+    for (int i = 0; i < d->job_count; i += 1)
+        av_free(d->jobs[i].filename);
+    av_free(d->jobs);
+    d->jobs = NULL;
+    d->job_count = 0;
+    d->jobs_ready = 0;
+
+    if (d->analyzer) {
+        groove_analyzer_remove_plugin(d->analyzer, &d->plugin);
+        d->analyzer = NULL;
+    }
 
     detector->playlist = NULL;
 
@@ -390,10 +1951,22 @@ int groove_loudness_detector_detach(struct GrooveLoudnessDetector *detector) {
     }
     d->cur_track_index = 0;
 
+    av_free(d->cache_dir);
+    d->cache_dir = NULL;
+
+    // the items of the last reading may be gone after detaching
+    d->scanner.meter = NULL;
+    d->meter.item = NULL;
+    pthread_mutex_lock(&d->meter.mutex);
+    memset(&d->meter.latest, 0, sizeof(struct GrooveLoudnessMeter));
+    pthread_mutex_unlock(&d->meter.mutex);
+    d->track_key_valid = 0;
+    d->track_cached = 0;
+
     d->abort_request = 0;
     d->info_head = NULL;
     d->info_pos = 0;
-    d->track_duration = 0.0;
+    stats_reset(&d->track_stats);
 
     return 0;
 }
@@ -435,3 +2008,17 @@ void groove_loudness_detector_position(struct GrooveLoudnessDetector *detector,
 
     pthread_mutex_unlock(&d->info_head_mutex);
 }
+
+int groove_loudness_detector_meter(struct GrooveLoudnessDetector *detector,
+        struct GrooveLoudnessMeter *meter)
+{
+    struct GrooveLoudnessDetectorPrivate *d = (struct GrooveLoudnessDetectorPrivate *) detector;
+
+    pthread_mutex_lock(&d->meter.mutex);
+    int have_reading = (d->meter.latest.count > 0);
+    if (have_reading)
+        *meter = d->meter.latest;
+    pthread_mutex_unlock(&d->meter.mutex);
+
+    return have_reading;
+}
@@ -9,12 +9,29 @@
 #define GROOVE_LOUDNESS_H_INCLUDED
 
 #include <groove/groove.h>
+#include <groove/analyzer.h>
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif /* __cplusplus */
 
+/* measurements for GrooveLoudnessDetector modes. combine with |. */
+/* integrated loudness, the loudness field */
+#define GROOVE_LOUDNESS_INTEGRATED  0x1
+/* the highest sample value. can miss peaks between samples */
+#define GROOVE_LOUDNESS_SAMPLE_PEAK 0x2
+/* the highest value of the 4x oversampled signal.
+ * takes precedence over GROOVE_LOUDNESS_SAMPLE_PEAK
+ */
+#define GROOVE_LOUDNESS_TRUE_PEAK   0x4
+/* loudness range (LRA), the loudness_range field */
+#define GROOVE_LOUDNESS_RANGE       0x8
+/* the highest momentary and short-term loudness, the max_momentary and
+ * max_shortterm fields
+ */
+#define GROOVE_LOUDNESS_MOMENTARY   0x10
+
 struct GrooveLoudnessDetectorInfo {
     /* loudness is in LUFS. 1 LUFS == 1 dB
      * EBU R128 specifies that playback should target -23 LUFS. replaygain on
@@ -25,7 +42,9 @@ struct GrooveLoudnessDetectorInfo {
      * (this would be the EBU R128 standard).
      */
     double loudness;
-    /* peak amplitude in float format */
+    /* peak amplitude in float format. this is the true peak or the sample
+     * peak depending on modes, and 1.0 if neither is enabled.
+     */
     double peak;
     /* how many seconds long this song is */
     double duration;
@@ -37,6 +56,44 @@ struct GrooveLoudnessDetectorInfo {
      * will be set to 0
      */
     struct GroovePlaylistItem *item;
+
+    /* loudness range in LU. only set with GROOVE_LOUDNESS_RANGE */
+    double loudness_range;
+    /* the highest momentary (400ms) and short-term (3s) loudness in LUFS.
+     * -HUGE_VAL for silence. only set with GROOVE_LOUDNESS_MOMENTARY
+     */
+    double max_momentary;
+    double max_shortterm;
+
+    /* 1 if this info is a fast estimate. see estimate_windows */
+    int estimated;
+    /* for an estimate, the standard error of loudness in LU, judged from
+     * how much the loudness of the windows differs. HUGE_VAL if fewer than
+     * two windows had audio. for album info, the largest error of the
+     * tracks.
+     */
+    double estimate_error;
+};
+
+/* a live reading of the loudness meter. see meter_interval */
+struct GrooveLoudnessMeter {
+    /* the playlist item the audio was measured from. NULL if it has since
+     * been removed from the playlist
+     */
+    struct GroovePlaylistItem *item;
+    /* position in seconds in item at the end of the measured audio */
+    double pos;
+    /* the loudness of the last 400ms and of the last 3s in LUFS.
+     * -HUGE_VAL for silence
+     */
+    double momentary;
+    double shortterm;
+    /* the highest sample peak since the previous reading, in float format */
+    double peak;
+    /* how many readings were taken since attaching. compare it with the
+     * previous reading to find out whether this one is new.
+     */
+    uint64_t count;
 };
 
 struct GrooveLoudnessDetector {
@@ -60,6 +117,101 @@ struct GrooveLoudnessDetector {
 
     /* read-only. set when attached and cleared when detached */
     struct GroovePlaylist *playlist;
+
+    /* set to a positive number to scan that many playlist items at once,
+     * each on its own thread with its own decoder. this is for scanning
+     * files as fast as possible, not for following playback:
+     * - the items in the playlist when you attach are scanned once, and
+     *   each file is opened again by filename. the playlist itself is not
+     *   decoded.
+     * - you must not add or remove playlist items until you have
+     *   received the album info or detached.
+     * - info is still delivered in playlist order, followed by the album
+     *   info.
+     * - groove_loudness_detector_position reports the item whose info is
+     *   expected next.
+     * defaults to 0, which analyzes the audio the playlist decodes, on one
+     * thread.
+     */
+    int worker_count;
+
+    /* which GROOVE_LOUDNESS_* measurements to make. measurements that are
+     * not enabled are not computed and are reported as 0, except the peak,
+     * which is reported as 1.0. with none enabled, the audio is only decoded
+     * and its duration counted.
+     * defaults to GROOVE_LOUDNESS_INTEGRATED|GROOVE_LOUDNESS_TRUE_PEAK
+     */
+    int modes;
+
+    /* set to 1 to measure the album from loudness histograms instead of
+     * keeping every track's measurements until the album info is sent, and
+     * to keep each track's measurements in a histogram as well. memory use
+     * then stays the same no matter how many or how long the tracks are.
+     * integrated loudness and loudness range are accurate to 0.1 LU.
+     * defaults to 0.
+     */
+    int use_histogram;
+
+    /* set to a directory to keep the measurements of each track there. a
+     * track whose file, size, modification time, gain and peak have not
+     * changed since it was measured is not analyzed again, and with
+     * worker_count it is not decoded either. without worker_count, only
+     * tracks that were decoded from their beginning are stored.
+     * the directory must exist. setting this implies use_histogram.
+     * the string is copied when attaching. defaults to NULL.
+     */
+    const char *cache_dir;
+
+    /* set to a number of seconds to take a live meter reading whenever that
+     * much audio has been analyzed, rounded up to 100ms. get the latest
+     * reading with groove_loudness_detector_meter. this runs off the same
+     * sink as the other measurements, so it costs no extra decoding.
+     * audio is analyzed as it is decoded, which is ahead of the speakers by
+     * however much the other sinks buffer. compare the item and pos of a
+     * reading with groove_player_position to line it up with playback.
+     * ignored when worker_count is set. defaults to 0, which disables
+     * metering.
+     */
+    double meter_interval;
+
+    /* set to a positive number to estimate each track from that many evenly
+     * spaced windows of estimate_window seconds instead of decoding all of
+     * it. the peak is then only the peak of the windows. tracks too short
+     * for the windows to cover less than half of them are measured in full.
+     * estimates are never stored in the cache.
+     * only used with worker_count, because it seeks. defaults to 0.
+     */
+    int estimate_windows;
+    /* defaults to 3.0 */
+    double estimate_window;
+    /* set to 1 to measure every track in full once the estimates have been
+     * sent. the estimated album info is then followed by the full info of
+     * every track and another album info.
+     * defaults to 0.
+     */
+    int estimate_refine;
+
+    /* set to 1 to normalize the playlist while it plays, with no scan
+     * beforehand. the gain of each item is adjusted while it is decoded so
+     * that it approaches normalize_target:
+     * - the detector measures the audio before any gain is applied. see
+     *   GrooveSink.disable_gain.
+     * - adjusting starts from the gain the item was inserted with, for
+     *   example from an estimate.
+     * - after 3 seconds of a track the gain moves toward normalize_target
+     *   minus the loudness measured so far, by at most 1 dB per second.
+     *   the playlist ramps smoothly to each new gain, see
+     *   groove_playlist_set_decode_gain.
+     * - with cache_dir, a track that was measured before gets its final
+     *   gain and peak at once, and new tracks are stored for next time.
+     * the gain of the audio decoded ahead of the detector cannot change, so
+     * the first moments of a track play at the gain it started with.
+     * GROOVE_LOUDNESS_INTEGRATED is measured even if it is not in modes.
+     * ignored when worker_count is set. defaults to 0.
+     */
+    int normalize;
+    /* in LUFS. defaults to -18.0, the replaygain reference level */
+    double normalize_target;
 };
 
 struct GrooveLoudnessDetector *groove_loudness_detector_create(void);
@@ -70,6 +222,14 @@ int groove_loudness_detector_attach(struct GrooveLoudnessDetector *detector,
         struct GroovePlaylist *playlist);
 int groove_loudness_detector_detach(struct GrooveLoudnessDetector *detector);
 
+/* instead of attaching to a playlist, analyze the audio of analyzer as one
+ * of its plugins. call this while analyzer is detached, and detach
+ * analyzer before detaching detector. worker_count must be 0.
+ * returns 0 on success, < 0 on error
+ */
+int groove_loudness_detector_attach_analyzer(struct GrooveLoudnessDetector *detector,
+        struct GrooveAnalyzer *analyzer);
+
 /* returns < 0 on error, 0 on aborted (block=1) or no info ready (block=0),
  * 1 on info returned
  */
@@ -90,6 +250,14 @@ int groove_loudness_detector_info_peek(struct GrooveLoudnessDetector *detector,
 void groove_loudness_detector_position(struct GrooveLoudnessDetector *detector,
         struct GroovePlaylistItem **item, double *seconds);
 
+/* copies the latest meter reading into meter.
+ * returns 1 if there is a reading, 0 if there is none yet.
+ * the lock it takes is only held to copy the reading, so this can be
+ * polled from a UI thread at any rate.
+ */
+int groove_loudness_detector_meter(struct GrooveLoudnessDetector *detector,
+        struct GrooveLoudnessMeter *meter);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
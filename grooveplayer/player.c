@@ -6,7 +6,6 @@
  */
 
 #include "player.h"
-#include <groove/queue.h>
 
 #include <libavutil/mem.h>
 #include <libavutil/log.h>
@@ -16,6 +15,35 @@
 #include <time.h>
 #include "osx_time_shim.h"
 
+// a callback rarely crosses more than one playlist item boundary
+#define MAX_CHUNK_SPANS 4
+
+// events of the same kind in a row are merged, so this only fills up when
+// the application stops reading events altogether
+#define EVENT_RING_SIZE 64
+
+// a queued event with the details that do not fit in union GroovePlayerEvent
+struct PlayerEvent {
+    union GroovePlayerEvent event;
+    struct GroovePlayerThroughputEvent throughput;
+    struct GroovePlayerUnderrunEvent underrun;
+};
+
+// a contiguous run of audio from one playlist item within a device chunk
+struct ChunkSpan {
+    struct GroovePlaylistItem *item;
+    // position in seconds into item of the first frame of the span
+    double pos;
+    // how many seconds of item audio the span contains
+    double duration;
+};
+
+// describes the audio that one SDL callback handed to the device
+struct DeviceChunk {
+    struct ChunkSpan spans[MAX_CHUNK_SPANS];
+    int span_count;
+};
+
 struct GroovePlayerPrivate {
     struct GroovePlayer externals;
     struct GrooveBuffer *audio_buf;
@@ -30,24 +58,86 @@ struct GroovePlayerPrivate {
     // number of seconds into the play_head song where the buffered audio
     // is reaching the device
     double play_pos;
+    // the audio copied into the device during the most recent callback.
+    // it becomes audible once the device has played the chunk before it.
+    struct DeviceChunk written_chunk;
+    // the audio the device is currently playing, and when it started
+    struct DeviceChunk audible_chunk;
+    uint64_t audible_nanos;
+    // the last playlist item that became audible. used to emit
+    // GROOVE_EVENT_NOWPLAYING when the change reaches the speakers.
+    struct GroovePlaylistItem *audible_item;
 
     SDL_AudioDeviceID device_id;
     struct GrooveSink *sink;
 
-    struct GrooveQueue *eventq;
+    // events waiting for groove_player_event_get. a fixed ring so that
+    // emitting an event from the audio callback never allocates.
+    pthread_mutex_t event_mutex;
+    int event_mutex_inited;
+    pthread_cond_t event_cond;
+    int event_cond_inited;
+    struct PlayerEvent events[EVENT_RING_SIZE];
+    int event_start;
+    int event_count;
+    int event_abort_request;
+    // the event groove_player_event_get returned last, for the getters
+    struct PlayerEvent last_event;
+
+    // underrun accounting. protected by play_head_mutex.
+    // an episode lasts from the first callback that finds the sink empty
+    // until the next buffer arrives.
+    int underrun_active;
+    uint64_t underrun_frames;
+    uint64_t underrun_count;
+    uint64_t underrun_total_frames;
 
     // for dummy player
-    pthread_t thread_id;
-    int thread_inited;
-    int abort_request;
+    // protected by dummy_list_mutex
+    struct GroovePlayerPrivate *dummy_next;
+    int dummy_registered;
     uint64_t start_nanos;
+    // time added with groove_player_dummy_advance since start_nanos
+    uint64_t stepped_nanos;
+    // copy of dummy_speed taken when the player is attached
+    double dummy_speed;
     uint64_t frames_consumed;
-    pthread_cond_t pause_cond;
-    pthread_condattr_t cond_attr;
-    int pause_cond_inited;
     int paused;
+
+    // for null player
+    pthread_t null_thread_id;
+    int null_thread_inited;
+    int null_abort_request;
+    pthread_cond_t null_pause_cond;
+    int null_pause_cond_inited;
+    // when the previous buffer arrived. 0 if the time since then should not
+    // be counted, such as when the playlist ran out of items.
+    uint64_t last_nanos;
+    // throughput of play_head so far
+    uint64_t item_frame_count;
+    double item_audio_seconds;
+    uint64_t item_wall_nanos;
 };
 
+// all dummy players share one thread which sleeps until the earliest moment
+// that any of them finishes its current buffer, or until it is woken.
+// lock order is dummy_list_mutex, then play_head_mutex of a player.
+// dummy_lifecycle_mutex serializes starting and stopping the thread.
+// dummy_wait_mutex is taken last, and protects dummy_wake_count and
+// dummy_abort_request. it is never held while taking another lock, so that
+// the sinks can wake the thread from inside their queues.
+static pthread_mutex_t dummy_lifecycle_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dummy_list_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t dummy_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t dummy_cond_once = PTHREAD_ONCE_INIT;
+static int dummy_cond_err = 0;
+static pthread_cond_t dummy_cond;
+static uint64_t dummy_wake_count = 0;
+static pthread_t dummy_thread_id;
+static int dummy_thread_running = 0;
+static int dummy_abort_request = 0;
+static struct GroovePlayerPrivate *dummy_list = NULL;
+
 static Uint16 groove_fmt_to_sdl_fmt(enum GrooveSampleFormat fmt) {
     switch (fmt) {
         case GROOVE_SAMPLE_FMT_U8:
@@ -80,15 +170,110 @@ static enum GrooveSampleFormat sdl_fmt_to_groove_fmt(Uint16 sdl_format) {
     }
 }
 
-static void emit_event(struct GrooveQueue *queue, enum GroovePlayerEventType type) {
-    union GroovePlayerEvent *evt = av_malloc(sizeof(union GroovePlayerEvent));
-    if (!evt) {
-        av_log(NULL, AV_LOG_ERROR, "unable to create event: out of memory\n");
+static void put_event(struct GroovePlayerPrivate *p, const struct PlayerEvent *evt) {
+    pthread_mutex_lock(&p->event_mutex);
+
+    if (p->event_abort_request) {
+        pthread_mutex_unlock(&p->event_mutex);
         return;
     }
-    evt->type = type;
-    if (groove_queue_put(queue, evt) < 0)
-        av_log(NULL, AV_LOG_ERROR, "unable to put event on queue: out of memory\n");
+
+    if (p->event_count > 0) {
+        int last_index = (p->event_start + p->event_count - 1) % EVENT_RING_SIZE;
+        struct PlayerEvent *last = &p->events[last_index];
+        enum GroovePlayerEventType type = evt->event.type;
+        // the application asks for the position when it sees this event, so
+        // several in a row are no more useful than one
+        if (type == GROOVE_EVENT_NOWPLAYING && last->event.type == GROOVE_EVENT_NOWPLAYING) {
+            pthread_mutex_unlock(&p->event_mutex);
+            return;
+        }
+        if (type == GROOVE_EVENT_BUFFERUNDERRUN && last->event.type == GROOVE_EVENT_BUFFERUNDERRUN) {
+            last->underrun.duration += evt->underrun.duration;
+            last->underrun.silence_frames += evt->underrun.silence_frames;
+            pthread_mutex_unlock(&p->event_mutex);
+            return;
+        }
+    }
+
+    if (p->event_count == EVENT_RING_SIZE) {
+        av_log(NULL, AV_LOG_WARNING, "player event queue full. dropping oldest event\n");
+        p->event_start = (p->event_start + 1) % EVENT_RING_SIZE;
+        p->event_count -= 1;
+    }
+
+    p->events[(p->event_start + p->event_count) % EVENT_RING_SIZE] = *evt;
+    p->event_count += 1;
+    pthread_cond_signal(&p->event_cond);
+
+    pthread_mutex_unlock(&p->event_mutex);
+}
+
+static void emit_event(struct GroovePlayerPrivate *p, enum GroovePlayerEventType type) {
+    struct PlayerEvent evt;
+    memset(&evt, 0, sizeof(evt));
+    evt.event.type = type;
+    put_event(p, &evt);
+}
+
+// removes queued events that refer to item
+static void purge_events(struct GroovePlayerPrivate *p, struct GroovePlaylistItem *item) {
+    pthread_mutex_lock(&p->event_mutex);
+    int kept = 0;
+    for (int i = 0; i < p->event_count; i += 1) {
+        struct PlayerEvent *evt = &p->events[(p->event_start + i) % EVENT_RING_SIZE];
+        if (evt->event.type == GROOVE_EVENT_THROUGHPUT && evt->throughput.item == item)
+            continue;
+        p->events[(p->event_start + kept) % EVENT_RING_SIZE] = *evt;
+        kept += 1;
+    }
+    p->event_count = kept;
+    if (p->last_event.throughput.item == item)
+        p->last_event.throughput.item = NULL;
+    pthread_mutex_unlock(&p->event_mutex);
+}
+
+// ends the current underrun episode, if any, and reports it.
+// must be called with play_head_mutex held.
+static void end_underrun(struct GroovePlayerPrivate *p) {
+    if (!p->underrun_active)
+        return;
+
+    struct PlayerEvent evt;
+    memset(&evt, 0, sizeof(evt));
+    evt.event.type = GROOVE_EVENT_BUFFERUNDERRUN;
+    evt.underrun.silence_frames = p->underrun_frames;
+    evt.underrun.duration = p->underrun_frames /
+        (double) p->sink->audio_format.sample_rate;
+    put_event(p, &evt);
+
+    p->underrun_active = 0;
+    p->underrun_frames = 0;
+}
+
+// reports the throughput of play_head, the item the null device has just
+// finished consuming. must be called with play_head_mutex held.
+static void emit_throughput_event(struct GroovePlayerPrivate *p) {
+    if (!p->play_head || p->item_frame_count == 0)
+        return;
+
+    struct PlayerEvent evt;
+    memset(&evt, 0, sizeof(evt));
+    evt.event.type = GROOVE_EVENT_THROUGHPUT;
+    struct GroovePlayerThroughputEvent *throughput = &evt.throughput;
+    throughput->item = p->play_head;
+    throughput->frame_count = p->item_frame_count;
+    throughput->audio_seconds = p->item_audio_seconds;
+    throughput->wall_seconds = p->item_wall_nanos / 1000000000.0;
+    throughput->speed = (p->item_wall_nanos > 0) ?
+        (throughput->audio_seconds / throughput->wall_seconds) : 0.0;
+    put_event(p, &evt);
+}
+
+static void reset_throughput(struct GroovePlayerPrivate *p) {
+    p->item_frame_count = 0;
+    p->item_audio_seconds = 0.0;
+    p->item_wall_nanos = 0;
 }
 
 static uint64_t now_nanos(void) {
@@ -100,73 +285,379 @@ static uint64_t now_nanos(void) {
     return tv_sec * sec_mult + tv_nsec;
 }
 
-// this thread is started if the user selects a dummy device instead of a
-// real device.
+static void chunk_reset(struct DeviceChunk *chunk) {
+    chunk->span_count = 0;
+}
+
+// start a new span in the chunk. spans which contain no audio are replaced
+// rather than kept, and if we run out of spans the last one is reused.
+static void chunk_begin_span(struct DeviceChunk *chunk,
+        struct GroovePlaylistItem *item, double pos)
+{
+    struct ChunkSpan *span;
+    if (chunk->span_count > 0 &&
+            chunk->spans[chunk->span_count - 1].duration == 0.0)
+    {
+        span = &chunk->spans[chunk->span_count - 1];
+    } else if (chunk->span_count < MAX_CHUNK_SPANS) {
+        span = &chunk->spans[chunk->span_count];
+        chunk->span_count += 1;
+    } else {
+        span = &chunk->spans[MAX_CHUNK_SPANS - 1];
+    }
+    span->item = item;
+    span->pos = pos;
+    span->duration = 0.0;
+}
+
+static void chunk_forget_item(struct DeviceChunk *chunk,
+        struct GroovePlaylistItem *item)
+{
+    for (int i = 0; i < chunk->span_count; i += 1) {
+        struct ChunkSpan *span = &chunk->spans[i];
+        if (span->item == item) {
+            span->item = NULL;
+            span->pos = -1.0;
+            span->duration = 0.0;
+        }
+    }
+}
+
+// called at the start of each SDL callback. the device has finished playing
+// the audible chunk and moves on to the chunk we wrote last time.
+static void rotate_chunks(struct GroovePlayerPrivate *p, uint64_t now) {
+    p->audible_chunk = p->written_chunk;
+    p->audible_nanos = now;
+    chunk_reset(&p->written_chunk);
+
+    for (int i = 0; i < p->audible_chunk.span_count; i += 1) {
+        struct GroovePlaylistItem *item = p->audible_chunk.spans[i].item;
+        if (item != p->audible_item) {
+            p->audible_item = item;
+            emit_event(p, GROOVE_EVENT_NOWPLAYING);
+        }
+    }
+}
+
+// interpolate the position of the play head between callbacks.
+static void audible_position(struct GroovePlayerPrivate *p,
+        struct GroovePlaylistItem **item, double *seconds)
+{
+    struct DeviceChunk *chunk = &p->audible_chunk;
+    if (chunk->span_count == 0) {
+        *item = NULL;
+        *seconds = -1.0;
+        return;
+    }
+
+    double elapsed = (now_nanos() - p->audible_nanos) / 1000000000.0;
+    // the event for the last item in the chunk has already been emitted, so
+    // report that item, holding it at its start while earlier spans play.
+    struct ChunkSpan *last = &chunk->spans[chunk->span_count - 1];
+    *item = last->item;
+    if (!last->item) {
+        *seconds = -1.0;
+        return;
+    }
+    for (int i = 0; i < chunk->span_count - 1; i += 1)
+        elapsed -= chunk->spans[i].duration;
+    if (elapsed < 0.0)
+        elapsed = 0.0;
+    else if (elapsed > last->duration)
+        elapsed = last->duration;
+    *seconds = last->pos + elapsed;
+}
+
+// how many nanoseconds of audio the dummy device has played since the clock
+// was last reset. must be called with play_head_mutex held.
+static uint64_t dummy_elapsed_nanos(struct GroovePlayerPrivate *p, uint64_t now) {
+    uint64_t wall_nanos = now - p->start_nanos;
+    return (uint64_t)(wall_nanos * p->dummy_speed) + p->stepped_nanos;
+}
+
+// must be called with play_head_mutex held.
+static void dummy_reset_clock(struct GroovePlayerPrivate *p) {
+    p->start_nanos = now_nanos();
+    p->stepped_nanos = 0;
+    p->frames_consumed = 0;
+}
+
+// pulls buffers from the sink until the dummy device has consumed as many
+// frames as its clock says it should have.
+// returns 1 if the sink ran dry before that, 0 otherwise.
+// must be called with play_head_mutex held.
+static int dummy_consume(struct GroovePlayerPrivate *p) {
+    uint64_t elapsed = dummy_elapsed_nanos(p, now_nanos());
+    int more = 1;
+    while (more) {
+        more = 0;
+        if (!p->audio_buf || p->audio_buf_index >= p->audio_buf->frame_count) {
+            groove_buffer_unref(p->audio_buf);
+            p->audio_buf_index = 0;
+            p->audio_buf_size = 0;
+            int ret = groove_sink_buffer_get(p->sink, &p->audio_buf, 0);
+            if (ret == GROOVE_BUFFER_END) {
+                emit_event(p, GROOVE_EVENT_NOWPLAYING);
+                p->play_head = NULL;
+                p->play_pos = -1.0;
+            } else if (ret == GROOVE_BUFFER_YES) {
+                if (p->play_head != p->audio_buf->item)
+                    emit_event(p, GROOVE_EVENT_NOWPLAYING);
+
+                p->play_head = p->audio_buf->item;
+                p->play_pos = p->audio_buf->pos;
+                p->audio_buf_size = p->audio_buf->size;
+            } else {
+                // since this is a dummy player whose only job is to keep
+                // track of time, we're going to pretend that we did *not*
+                // just get a buffer underrun. Instead we'll wait patiently
+                // for the next buffer to appear and handle it appropriately.
+                return 1;
+            }
+        }
+        if (p->audio_buf) {
+            uint64_t nanos_per_frame = 1000000000 / p->audio_buf->format.sample_rate;
+            uint64_t total_frames = elapsed / nanos_per_frame;
+            // groove_player_dummy_advance can add hours at once, so this is
+            // clamped to the rest of the buffer before it becomes an index
+            int64_t frames_to_kill = (total_frames > p->frames_consumed) ?
+                total_frames - p->frames_consumed : 0;
+            int64_t frames_left = p->audio_buf->frame_count - p->audio_buf_index;
+            if (frames_to_kill > frames_left) {
+                more = 1;
+                frames_to_kill = frames_left;
+            }
+            p->frames_consumed += frames_to_kill;
+            p->audio_buf_index += frames_to_kill;
+            p->play_pos += frames_to_kill / (double) p->audio_buf->format.sample_rate;
+        }
+    }
+    return 0;
+}
+
+// the position of the dummy device according to its clock. the dummy thread
+// only consumes audio when it wakes up at the end of a buffer, so the time
+// since then is added here, up to the end of the current buffer.
+// must be called with play_head_mutex held.
+static double dummy_position(struct GroovePlayerPrivate *p) {
+    if (p->paused || !p->audio_buf || p->play_pos < 0.0)
+        return p->play_pos;
+
+    int sample_rate = p->audio_buf->format.sample_rate;
+    uint64_t nanos_per_frame = 1000000000 / sample_rate;
+    uint64_t total_frames = dummy_elapsed_nanos(p, now_nanos()) / nanos_per_frame;
+    if (total_frames <= p->frames_consumed)
+        return p->play_pos;
+    uint64_t frames = total_frames - p->frames_consumed;
+    uint64_t frames_left = p->audio_buf->frame_count - p->audio_buf_index;
+    if (frames > frames_left)
+        frames = frames_left;
+    return p->play_pos + frames / (double) sample_rate;
+}
+
+// returns the monotonic time at which the dummy device will have consumed
+// the rest of its current buffer, or UINT64_MAX if only
+// groove_player_dummy_advance can move it forward.
+// must be called with play_head_mutex held.
+static uint64_t dummy_next_deadline(struct GroovePlayerPrivate *p, uint64_t now) {
+    if (!p->audio_buf || p->dummy_speed <= 0.0)
+        return UINT64_MAX;
+
+    uint64_t nanos_per_frame = 1000000000 / p->audio_buf->format.sample_rate;
+    uint64_t frames_left = p->audio_buf->frame_count - p->audio_buf_index;
+    uint64_t target_nanos = (p->frames_consumed + frames_left) * nanos_per_frame;
+    if (target_nanos <= p->stepped_nanos)
+        return now;
+    // round up so that we do not wake a hair too early and spin
+    uint64_t wall_nanos = (uint64_t)((target_nanos - p->stepped_nanos) / p->dummy_speed) + 1;
+    uint64_t deadline = p->start_nanos + wall_nanos;
+    return (deadline < now) ? now : deadline;
+}
+
+static void nanos_to_timespec(uint64_t nanos, struct timespec *tms) {
+    tms->tv_sec = nanos / 1000000000;
+    tms->tv_nsec = nanos % 1000000000;
+}
+
+// the sinks of dummy players may wake the thread before it starts and after
+// it stops, so dummy_cond is created once and never destroyed.
+static void dummy_cond_init(void) {
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    dummy_cond_err = pthread_cond_init(&dummy_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+}
+
+// makes the dummy thread look at every player again
+static void dummy_signal(void) {
+    pthread_mutex_lock(&dummy_wait_mutex);
+    dummy_wake_count += 1;
+    pthread_cond_signal(&dummy_cond);
+    pthread_mutex_unlock(&dummy_wait_mutex);
+}
+
+// this thread is started when the first player selects a dummy device
+// instead of a real device, and stops when the last one detaches.
 static void *dummy_thread(void *arg) {
-    struct GroovePlayer *player = arg;
-    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
+    pthread_mutex_lock(&dummy_wait_mutex);
+    while (!dummy_abort_request) {
+        // a wake-up that comes while the players are being looked at makes
+        // the thread look again instead of sleeping
+        uint64_t wake_count = dummy_wake_count;
+        pthread_mutex_unlock(&dummy_wait_mutex);
 
-    while (!p->abort_request) {
-        pthread_mutex_lock(&p->play_head_mutex);
-        if (p->paused) {
-            pthread_cond_wait(&p->pause_cond, &p->play_head_mutex);
+        uint64_t now = now_nanos();
+        uint64_t wake = UINT64_MAX;
+        pthread_mutex_lock(&dummy_list_mutex);
+        struct GroovePlayerPrivate *p;
+        for (p = dummy_list; p; p = p->dummy_next) {
+            pthread_mutex_lock(&p->play_head_mutex);
+            // a starved player is woken by its sink when the next buffer
+            // arrives
+            if (!p->paused && !dummy_consume(p)) {
+                uint64_t deadline = dummy_next_deadline(p, now);
+                if (deadline < wake)
+                    wake = deadline;
+            }
             pthread_mutex_unlock(&p->play_head_mutex);
+        }
+        pthread_mutex_unlock(&dummy_list_mutex);
+
+        pthread_mutex_lock(&dummy_wait_mutex);
+        if (dummy_abort_request || dummy_wake_count != wake_count)
             continue;
+        if (wake == UINT64_MAX) {
+            pthread_cond_wait(&dummy_cond, &dummy_wait_mutex);
+        } else if (wake > now) {
+            struct timespec tms;
+            nanos_to_timespec(wake, &tms);
+            pthread_cond_timedwait(&dummy_cond, &dummy_wait_mutex, &tms);
         }
+    }
+    pthread_mutex_unlock(&dummy_wait_mutex);
+    return NULL;
+}
 
-        uint64_t now = now_nanos();
-        int more = 1;
-        while (more) {
-            more = 0;
-            if (!p->audio_buf || p->audio_buf_index >= p->audio_buf->frame_count) {
-                groove_buffer_unref(p->audio_buf);
-                p->audio_buf_index = 0;
-                p->audio_buf_size = 0;
-                int ret = groove_sink_buffer_get(p->sink, &p->audio_buf, 0);
-                if (ret == GROOVE_BUFFER_END) {
-                    emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
-                    p->play_head = NULL;
-                    p->play_pos = -1.0;
-                } else if (ret == GROOVE_BUFFER_YES) {
-                    if (p->play_head != p->audio_buf->item)
-                        emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
-
-                    p->play_head = p->audio_buf->item;
-                    p->play_pos = p->audio_buf->pos;
-                    p->audio_buf_size = p->audio_buf->size;
-                } else {
-                    // since this is a dummy player whose only job is to keep
-                    // track of time, we're going to pretend that we did *not*
-                    // just get a buffer underrun. Instead we'll wait patiently
-                    // for the next buffer to appear and handle it appropriately.
-                    pthread_mutex_unlock(&p->play_head_mutex);
-                    break;
-                }
-            }
-            if (p->audio_buf) {
-                uint64_t nanos_per_frame = 1000000000 / p->audio_buf->format.sample_rate;
-                uint64_t total_nanos = now - p->start_nanos;
-                uint64_t total_frames = total_nanos / nanos_per_frame;
-                int frames_to_kill = total_frames - p->frames_consumed;
-                int new_index = p->audio_buf_index + frames_to_kill;
-                if (new_index > p->audio_buf->frame_count) {
-                    more = 1;
-                    new_index = p->audio_buf->frame_count;
-                    frames_to_kill = new_index - p->audio_buf_index;
-                }
-                p->frames_consumed += frames_to_kill;
-                p->audio_buf_index = new_index;
-                p->play_pos += frames_to_kill / (double) p->audio_buf->format.sample_rate;
-            }
+// tells the dummy thread that a player's clock changed so that it
+// recomputes when to wake up. does nothing for other players.
+// must not be called with play_head_mutex held.
+static void dummy_wake(struct GroovePlayerPrivate *p) {
+    pthread_mutex_lock(&dummy_list_mutex);
+    int registered = p->dummy_registered;
+    pthread_mutex_unlock(&dummy_list_mutex);
+    if (registered)
+        dummy_signal();
+}
+
+// called by the queue of the sink of a dummy player when a buffer arrives
+static void sink_wake(struct GrooveSink *sink) {
+    dummy_signal();
+}
+
+static int dummy_register(struct GroovePlayerPrivate *p) {
+    pthread_mutex_lock(&dummy_lifecycle_mutex);
+
+    if (!dummy_thread_running) {
+        dummy_abort_request = 0;
+        if (pthread_create(&dummy_thread_id, NULL, dummy_thread, NULL) != 0) {
+            pthread_mutex_unlock(&dummy_lifecycle_mutex);
+            av_log(NULL, AV_LOG_ERROR, "unable to create dummy player thread\n");
+            return -1;
+        }
+        dummy_thread_running = 1;
+    }
+
+    pthread_mutex_lock(&dummy_list_mutex);
+    p->dummy_next = dummy_list;
+    dummy_list = p;
+    p->dummy_registered = 1;
+    pthread_mutex_unlock(&dummy_list_mutex);
+    dummy_signal();
+
+    pthread_mutex_unlock(&dummy_lifecycle_mutex);
+    return 0;
+}
+
+static void dummy_unregister(struct GroovePlayerPrivate *p) {
+    pthread_mutex_lock(&dummy_lifecycle_mutex);
+
+    pthread_mutex_lock(&dummy_list_mutex);
+    struct GroovePlayerPrivate **link = &dummy_list;
+    while (*link && *link != p)
+        link = &(*link)->dummy_next;
+    if (*link)
+        *link = p->dummy_next;
+    p->dummy_next = NULL;
+    p->dummy_registered = 0;
+    int stop = !dummy_list;
+    pthread_mutex_unlock(&dummy_list_mutex);
+
+    pthread_mutex_lock(&dummy_wait_mutex);
+    if (stop)
+        dummy_abort_request = 1;
+    dummy_wake_count += 1;
+    pthread_cond_signal(&dummy_cond);
+    pthread_mutex_unlock(&dummy_wait_mutex);
+
+    if (stop) {
+        pthread_join(dummy_thread_id, NULL);
+        dummy_thread_running = 0;
+    }
+
+    pthread_mutex_unlock(&dummy_lifecycle_mutex);
+}
+
+// this thread is started if the user selects the null device. it consumes
+// buffers as fast as the playlist produces them.
+static void *null_thread(void *arg) {
+    struct GroovePlayerPrivate *p = arg;
+
+    pthread_mutex_lock(&p->play_head_mutex);
+    while (!p->null_abort_request) {
+        if (p->paused) {
+            pthread_cond_wait(&p->null_pause_cond, &p->play_head_mutex);
+            continue;
         }
 
-        // sleep for a little while
-        struct timespec tms;
-        clock_gettime(CLOCK_MONOTONIC, &tms);
-        tms.tv_nsec += 10000000;
-        pthread_cond_timedwait(&p->pause_cond, &p->play_head_mutex, &tms);
+        // unlock the mutex while we wait for the next buffer. Otherwise
+        // there will be a deadlock when sink_flush or sink_purge is called.
         pthread_mutex_unlock(&p->play_head_mutex);
+
+        struct GrooveBuffer *buffer;
+        int ret = groove_sink_buffer_get(p->sink, &buffer, 1);
+        uint64_t now = now_nanos();
+
+        pthread_mutex_lock(&p->play_head_mutex);
+
+        if (ret == GROOVE_BUFFER_END) {
+            emit_throughput_event(p);
+            emit_event(p, GROOVE_EVENT_NOWPLAYING);
+            reset_throughput(p);
+            p->play_head = NULL;
+            p->play_pos = -1.0;
+            p->last_nanos = 0;
+        } else if (ret == GROOVE_BUFFER_YES) {
+            if (p->play_head != buffer->item) {
+                emit_throughput_event(p);
+                emit_event(p, GROOVE_EVENT_NOWPLAYING);
+                reset_throughput(p);
+            }
+
+            double seconds = buffer->frame_count / (double) buffer->format.sample_rate;
+            p->play_head = buffer->item;
+            p->play_pos = buffer->pos + seconds;
+            p->item_frame_count += buffer->frame_count;
+            p->item_audio_seconds += seconds;
+            if (p->last_nanos)
+                p->item_wall_nanos += now - p->last_nanos;
+            p->last_nanos = now;
+
+            groove_buffer_unref(buffer);
+        }
     }
+    pthread_mutex_unlock(&p->play_head_mutex);
+
     return NULL;
 }
 
@@ -177,10 +668,15 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
     struct GroovePlaylist *playlist = sink->playlist;
 
     double bytes_per_sec = sink->bytes_per_sec;
+    int bytes_per_frame = bytes_per_sec / sink->audio_format.sample_rate;
     int paused = !groove_playlist_playing(playlist);
+    uint64_t now = now_nanos();
 
     pthread_mutex_lock(&p->play_head_mutex);
 
+    rotate_chunks(p, now);
+    chunk_begin_span(&p->written_chunk, p->play_head, p->play_pos);
+
     while (len > 0) {
         if (!paused && p->audio_buf_index >= p->audio_buf_size) {
             groove_buffer_unref(p->audio_buf);
@@ -189,24 +685,35 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
 
             int ret = groove_sink_buffer_get(p->sink, &p->audio_buf, 0);
             if (ret == GROOVE_BUFFER_END) {
-                emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
-
+                end_underrun(p);
                 p->play_head = NULL;
                 p->play_pos = -1.0;
+                chunk_begin_span(&p->written_chunk, NULL, -1.0);
             } else if (ret == GROOVE_BUFFER_YES) {
-                if (p->play_head != p->audio_buf->item)
-                    emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
+                end_underrun(p);
+                if (p->play_head != p->audio_buf->item) {
+                    chunk_begin_span(&p->written_chunk, p->audio_buf->item,
+                            p->audio_buf->pos);
+                }
 
                 p->play_head = p->audio_buf->item;
                 p->play_pos = p->audio_buf->pos;
                 p->audio_buf_size = p->audio_buf->size;
-            } else {
-                // errors are treated the same as no buffer ready
-                emit_event(p->eventq, GROOVE_EVENT_BUFFERUNDERRUN);
+            } else if (p->play_head && !p->underrun_active) {
+                // errors are treated the same as no buffer ready.
+                // running dry before the first buffer or after the end of
+                // the playlist is not an underrun.
+                p->underrun_active = 1;
+                p->underrun_count += 1;
             }
         }
         if (paused || !p->audio_buf) {
             // fill with silence
+            if (!paused && p->underrun_active) {
+                uint64_t frames = len / bytes_per_frame;
+                p->underrun_frames += frames;
+                p->underrun_total_frames += frames;
+            }
             memset(stream, 0, len);
             break;
         }
@@ -218,6 +725,8 @@ static void sdl_audio_callback(void *opaque, Uint8 *stream, int len) {
         stream += len1;
         p->audio_buf_index += len1;
         p->play_pos += len1 / bytes_per_sec;
+        p->written_chunk.spans[p->written_chunk.span_count - 1].duration +=
+            len1 / bytes_per_sec;
     }
 
     pthread_mutex_unlock(&p->play_head_mutex);
@@ -228,27 +737,40 @@ static void sink_purge(struct GrooveSink *sink, struct GroovePlaylistItem *item)
 
     pthread_mutex_lock(&p->play_head_mutex);
 
+    purge_events(p, item);
+
+    chunk_forget_item(&p->written_chunk, item);
+    chunk_forget_item(&p->audible_chunk, item);
+    if (p->audible_item == item)
+        p->audible_item = NULL;
+
     if (p->play_head == item) {
+        end_underrun(p);
         p->play_head = NULL;
         p->play_pos = -1.0;
         groove_buffer_unref(p->audio_buf);
         p->audio_buf = NULL;
         p->audio_buf_index = 0;
         p->audio_buf_size = 0;
-        p->start_nanos = now_nanos();
-        p->frames_consumed = 0;
-        emit_event(p->eventq, GROOVE_EVENT_NOWPLAYING);
+        dummy_reset_clock(p);
+        reset_throughput(p);
+        emit_event(p, GROOVE_EVENT_NOWPLAYING);
     }
 
     pthread_mutex_unlock(&p->play_head_mutex);
+
+    dummy_wake(p);
 }
 
 static void sink_pause(struct GrooveSink *sink) {
     struct GroovePlayer *player = sink->userdata;
 
-    // only the dummy device needs to handle pausing
-    if (player->device_index != GROOVE_PLAYER_DUMMY_DEVICE)
+    // only the dummy and null devices need to handle pausing
+    if (player->device_index != GROOVE_PLAYER_DUMMY_DEVICE &&
+        player->device_index != GROOVE_PLAYER_NULL_DEVICE)
+    {
         return;
+    }
 
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
@@ -260,19 +782,24 @@ static void sink_pause(struct GrooveSink *sink) {
 static void sink_play(struct GrooveSink *sink) {
     struct GroovePlayer *player = sink->userdata;
 
-    // only the dummy device needs to handle playing
-    if (player->device_index != GROOVE_PLAYER_DUMMY_DEVICE)
+    // only the dummy and null devices need to handle playing
+    if (player->device_index != GROOVE_PLAYER_DUMMY_DEVICE &&
+        player->device_index != GROOVE_PLAYER_NULL_DEVICE)
+    {
         return;
+    }
 
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
     // mark the position in time that we started playing at.
     pthread_mutex_lock(&p->play_head_mutex);
-    p->start_nanos = now_nanos();
-    p->frames_consumed = 0;
+    dummy_reset_clock(p);
+    p->last_nanos = p->start_nanos;
     p->paused = 0;
-    pthread_cond_signal(&p->pause_cond);
+    pthread_cond_signal(&p->null_pause_cond);
     pthread_mutex_unlock(&p->play_head_mutex);
+
+    dummy_wake(p);
 }
 
 static void sink_flush(struct GrooveSink *sink) {
@@ -280,16 +807,23 @@ static void sink_flush(struct GrooveSink *sink) {
 
     pthread_mutex_lock(&p->play_head_mutex);
 
+    end_underrun(p);
     groove_buffer_unref(p->audio_buf);
     p->audio_buf = NULL;
     p->audio_buf_index = 0;
     p->audio_buf_size = 0;
-    p->start_nanos = now_nanos();
-    p->frames_consumed = 0;
+    dummy_reset_clock(p);
+    reset_throughput(p);
+    p->last_nanos = p->start_nanos;
     p->play_pos = -1.0;
     p->play_head = NULL;
+    chunk_reset(&p->written_chunk);
+    chunk_reset(&p->audible_chunk);
+    p->audible_item = NULL;
 
     pthread_mutex_unlock(&p->play_head_mutex);
+
+    dummy_wake(p);
 }
 
 struct GroovePlayer *groove_player_create(void) {
@@ -329,21 +863,26 @@ struct GroovePlayer *groove_player_create(void) {
     }
     p->play_head_mutex_inited = 1;
 
-    pthread_condattr_init(&p->cond_attr);
-    pthread_condattr_setclock(&p->cond_attr, CLOCK_MONOTONIC);
-    if (pthread_cond_init(&p->pause_cond, &p->cond_attr) != 0) {
+    if (pthread_cond_init(&p->null_pause_cond, NULL) != 0) {
         groove_player_destroy(player);
         av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
         return NULL;
     }
-    p->pause_cond_inited = 1;
+    p->null_pause_cond_inited = 1;
+
+    if (pthread_mutex_init(&p->event_mutex, NULL) != 0) {
+        groove_player_destroy(player);
+        av_log(NULL, AV_LOG_ERROR,"unable to create event mutex: out of memory\n");
+        return NULL;
+    }
+    p->event_mutex_inited = 1;
 
-    p->eventq = groove_queue_create();
-    if (!p->eventq) {
+    if (pthread_cond_init(&p->event_cond, NULL) != 0) {
         groove_player_destroy(player);
-        av_log(NULL, AV_LOG_ERROR,"unable to create event queue: out of memory\n");
+        av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
         return NULL;
     }
+    p->event_cond_inited = 1;
 
     // set some nice defaults
     player->target_audio_format.sample_rate = 44100;
@@ -354,6 +893,7 @@ struct GroovePlayer *groove_player_create(void) {
     player->sink_buffer_size = 8192;
     player->gain = p->sink->gain;
     player->device_index = -1; // default device
+    player->dummy_speed = 1.0;
 
     return player;
 }
@@ -369,11 +909,14 @@ void groove_player_destroy(struct GroovePlayer *player) {
     if (p->play_head_mutex_inited)
         pthread_mutex_destroy(&p->play_head_mutex);
 
-    if (p->pause_cond_inited)
-        pthread_cond_destroy(&p->pause_cond);
+    if (p->null_pause_cond_inited)
+        pthread_cond_destroy(&p->null_pause_cond);
 
-    if (p->eventq)
-        groove_queue_destroy(p->eventq);
+    if (p->event_mutex_inited)
+        pthread_mutex_destroy(&p->event_mutex);
+
+    if (p->event_cond_inited)
+        pthread_cond_destroy(&p->event_cond);
 
     groove_sink_destroy(p->sink);
 
@@ -386,11 +929,29 @@ int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *pla
     p->sink->gain = player->gain;
     p->sink->buffer_size = player->sink_buffer_size;
 
+    groove_sink_set_wake(p->sink, NULL);
+
     if (player->device_index == GROOVE_PLAYER_DUMMY_DEVICE) {
         // dummy device
+        pthread_once(&dummy_cond_once, dummy_cond_init);
+        if (dummy_cond_err != 0) {
+            av_log(NULL, AV_LOG_ERROR, "unable to create mutex condition\n");
+            return -1;
+        }
+        groove_sink_set_wake(p->sink, sink_wake);
         player->actual_audio_format = player->target_audio_format;
         p->sink->audio_format = player->actual_audio_format;
         p->sink->disable_resample = 1;
+        if (player->dummy_speed < 0.0) {
+            av_log(NULL, AV_LOG_ERROR, "invalid dummy device speed\n");
+            return -1;
+        }
+        p->dummy_speed = player->dummy_speed;
+    } else if (player->device_index == GROOVE_PLAYER_NULL_DEVICE) {
+        // null device. resampling is left on so that benchmarks measure the
+        // same pipeline a real device would get.
+        player->actual_audio_format = player->target_audio_format;
+        p->sink->audio_format = player->actual_audio_format;
     } else {
         SDL_AudioSpec wanted_spec, spec;
         wanted_spec.format = groove_fmt_to_sdl_fmt(player->target_audio_format.sample_fmt);
@@ -434,8 +995,21 @@ int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *pla
     }
 
     p->play_pos = -1.0;
-
-    groove_queue_reset(p->eventq);
+    p->audible_item = NULL;
+    chunk_reset(&p->written_chunk);
+    chunk_reset(&p->audible_chunk);
+
+    p->underrun_active = 0;
+    p->underrun_frames = 0;
+    p->underrun_count = 0;
+    p->underrun_total_frames = 0;
+
+    pthread_mutex_lock(&p->event_mutex);
+    p->event_start = 0;
+    p->event_count = 0;
+    memset(&p->last_event, 0, sizeof(p->last_event));
+    p->event_abort_request = 0;
+    pthread_mutex_unlock(&p->event_mutex);
 
     if (player->device_index == GROOVE_PLAYER_DUMMY_DEVICE) {
         if (groove_playlist_playing(playlist))
@@ -443,13 +1017,26 @@ int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *pla
         else
             sink_pause(p->sink);
 
-        // set up thread to keep track of time
-        if (pthread_create(&p->thread_id, NULL, dummy_thread, player) != 0) {
+        // let the shared dummy thread keep track of time
+        if (dummy_register(p) < 0) {
             groove_player_detach(player);
-            av_log(NULL, AV_LOG_ERROR, "unable to create dummy player thread\n");
             return -1;
         }
-        p->thread_inited = 1;
+    } else if (player->device_index == GROOVE_PLAYER_NULL_DEVICE) {
+        reset_throughput(p);
+        p->last_nanos = now_nanos();
+        p->null_abort_request = 0;
+        if (groove_playlist_playing(playlist))
+            sink_play(p->sink);
+        else
+            sink_pause(p->sink);
+
+        if (pthread_create(&p->null_thread_id, NULL, null_thread, p) != 0) {
+            groove_player_detach(player);
+            av_log(NULL, AV_LOG_ERROR, "unable to create null player thread\n");
+            return -1;
+        }
+        p->null_thread_inited = 1;
     } else {
         SDL_PauseAudioDevice(p->device_id, 0);
     }
@@ -459,10 +1046,20 @@ int groove_player_attach(struct GroovePlayer *player, struct GroovePlaylist *pla
 
 int groove_player_detach(struct GroovePlayer *player) {
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
-    p->abort_request = 1;
-    if (p->eventq) {
-        groove_queue_flush(p->eventq);
-        groove_queue_abort(p->eventq);
+    if (p->dummy_registered)
+        dummy_unregister(p);
+    if (p->null_thread_inited) {
+        pthread_mutex_lock(&p->play_head_mutex);
+        p->null_abort_request = 1;
+        pthread_cond_signal(&p->null_pause_cond);
+        pthread_mutex_unlock(&p->play_head_mutex);
+    }
+    if (p->event_mutex_inited) {
+        pthread_mutex_lock(&p->event_mutex);
+        p->event_count = 0;
+        p->event_abort_request = 1;
+        pthread_cond_broadcast(&p->event_cond);
+        pthread_mutex_unlock(&p->event_mutex);
     }
     if (p->sink->playlist) {
         groove_sink_detach(p->sink);
@@ -471,10 +1068,10 @@ int groove_player_detach(struct GroovePlayer *player) {
         SDL_CloseAudioDevice(p->device_id);
         p->device_id = 0;
     }
-    if (p->thread_inited) {
-        pthread_cond_signal(&p->pause_cond);
-        pthread_join(p->thread_id, NULL);
-        p->thread_inited = 0;
+    if (p->null_thread_inited) {
+        // the thread wakes up because detaching the sink aborted its queue
+        pthread_join(p->null_thread_id, NULL);
+        p->null_thread_inited = 0;
     }
 
     player->playlist = NULL;
@@ -498,33 +1095,157 @@ void groove_player_position(struct GroovePlayer *player,
 {
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
 
+    struct GroovePlaylistItem *play_head;
+    double play_pos;
+
     pthread_mutex_lock(&p->play_head_mutex);
 
+    if (player->device_index == GROOVE_PLAYER_DUMMY_DEVICE) {
+        play_head = p->play_head;
+        play_pos = dummy_position(p);
+    } else if (player->device_index == GROOVE_PLAYER_NULL_DEVICE) {
+        play_head = p->play_head;
+        play_pos = p->play_pos;
+    } else {
+        audible_position(p, &play_head, &play_pos);
+    }
+
+    pthread_mutex_unlock(&p->play_head_mutex);
+
     if (item)
-        *item = p->play_head;
+        *item = play_head;
 
     if (seconds)
-        *seconds = p->play_pos;
-
-    pthread_mutex_unlock(&p->play_head_mutex);
+        *seconds = play_pos;
 }
 
 int groove_player_event_get(struct GroovePlayer *player,
         union GroovePlayerEvent *event, int block)
 {
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
-    union GroovePlayerEvent *tmp;
-    int err = groove_queue_get(p->eventq, (void **)&tmp, block);
-    if (err > 0) {
-        *event = *tmp;
-        av_free(tmp);
+    int ret;
+
+    pthread_mutex_lock(&p->event_mutex);
+    for (;;) {
+        if (p->event_abort_request) {
+            ret = -1;
+            break;
+        }
+        if (p->event_count > 0) {
+            p->last_event = p->events[p->event_start];
+            *event = p->last_event.event;
+            p->event_start = (p->event_start + 1) % EVENT_RING_SIZE;
+            p->event_count -= 1;
+            ret = 1;
+            break;
+        }
+        if (!block) {
+            ret = 0;
+            break;
+        }
+        pthread_cond_wait(&p->event_cond, &p->event_mutex);
     }
-    return err;
+    pthread_mutex_unlock(&p->event_mutex);
+
+    return ret;
 }
 
 int groove_player_event_peek(struct GroovePlayer *player, int block) {
     struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
-    return groove_queue_peek(p->eventq, block);
+    int ret;
+
+    pthread_mutex_lock(&p->event_mutex);
+    for (;;) {
+        if (p->event_abort_request) {
+            ret = -1;
+            break;
+        }
+        if (p->event_count > 0) {
+            ret = 1;
+            break;
+        }
+        if (!block) {
+            ret = 0;
+            break;
+        }
+        pthread_cond_wait(&p->event_cond, &p->event_mutex);
+    }
+    pthread_mutex_unlock(&p->event_mutex);
+
+    return ret;
+}
+
+int groove_player_get_throughput(struct GroovePlayer *player,
+        struct GroovePlayerThroughputEvent *throughput)
+{
+    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
+    int ret = -1;
+
+    pthread_mutex_lock(&p->event_mutex);
+    if (p->last_event.event.type == GROOVE_EVENT_THROUGHPUT) {
+        *throughput = p->last_event.throughput;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&p->event_mutex);
+
+    return ret;
+}
+
+int groove_player_get_underrun(struct GroovePlayer *player,
+        struct GroovePlayerUnderrunEvent *underrun)
+{
+    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
+    int ret = -1;
+
+    pthread_mutex_lock(&p->event_mutex);
+    if (p->last_event.event.type == GROOVE_EVENT_BUFFERUNDERRUN) {
+        *underrun = p->last_event.underrun;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&p->event_mutex);
+
+    return ret;
+}
+
+void groove_player_underrun_counters(struct GroovePlayer *player,
+        uint64_t *count, uint64_t *frames, double *seconds)
+{
+    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
+
+    pthread_mutex_lock(&p->play_head_mutex);
+    uint64_t underrun_count = p->underrun_count;
+    uint64_t underrun_frames = p->underrun_total_frames;
+    pthread_mutex_unlock(&p->play_head_mutex);
+
+    if (count)
+        *count = underrun_count;
+    if (frames)
+        *frames = underrun_frames;
+    if (seconds) {
+        int sample_rate = p->sink->audio_format.sample_rate;
+        *seconds = (sample_rate > 0) ? (underrun_frames / (double) sample_rate) : 0.0;
+    }
+}
+
+int groove_player_dummy_advance(struct GroovePlayer *player, double seconds) {
+    struct GroovePlayerPrivate *p = (struct GroovePlayerPrivate *) player;
+
+    if (player->device_index != GROOVE_PLAYER_DUMMY_DEVICE || !p->sink->playlist)
+        return -1;
+    if (seconds < 0.0)
+        return -1;
+
+    pthread_mutex_lock(&p->play_head_mutex);
+    // time does not pass for a paused device
+    if (!p->paused) {
+        p->stepped_nanos += (uint64_t)(seconds * 1000000000.0);
+        dummy_consume(p);
+    }
+    pthread_mutex_unlock(&p->play_head_mutex);
+
+    dummy_wake(p);
+
+    return 0;
 }
 
 int groove_player_set_gain(struct GroovePlayer *player, double gain) {
@@ -18,11 +18,47 @@ extern "C"
 /* use this to make a playlist utilize your speakers */
 
 enum GroovePlayerEventType {
-    /* when the currently playing track changes. */
+    /* when the currently playing track changes. For a real device this is
+     * emitted when the new track reaches the speakers, not when it is
+     * copied into the device buffer.
+     */
     GROOVE_EVENT_NOWPLAYING,
 
-    /* when something tries to read from an empty buffer */
-    GROOVE_EVENT_BUFFERUNDERRUN
+    /* when the device needed audio and the sink had none, so silence was
+     * played instead. emitted once per episode, when the next buffer
+     * arrives. see groove_player_get_underrun.
+     */
+    GROOVE_EVENT_BUFFERUNDERRUN,
+
+    /* only emitted by GROOVE_PLAYER_NULL_DEVICE, when it finishes consuming
+     * a playlist item, just before the GROOVE_EVENT_NOWPLAYING for the next
+     * one. see groove_player_get_throughput.
+     */
+    GROOVE_EVENT_THROUGHPUT
+};
+
+struct GroovePlayerThroughputEvent {
+    /* the item that was consumed. events for an item are removed from the
+     * queue when the item is removed from the playlist.
+     */
+    struct GroovePlaylistItem *item;
+    /* how many sample frames of the item the device consumed */
+    uint64_t frame_count;
+    /* how many seconds of audio that is */
+    double audio_seconds;
+    /* how many seconds of wall clock time the playlist took to produce it,
+     * not counting time spent paused
+     */
+    double wall_seconds;
+    /* audio_seconds / wall_seconds. 2.0 means twice as fast as realtime */
+    double speed;
+};
+
+struct GroovePlayerUnderrunEvent {
+    /* how many seconds of silence were played */
+    double duration;
+    /* how many sample frames of silence were played */
+    uint64_t silence_frames;
 };
 
 union GroovePlayerEvent {
@@ -31,10 +67,15 @@ union GroovePlayerEvent {
 
 #define GROOVE_PLAYER_DEFAULT_DEVICE (-1)
 #define GROOVE_PLAYER_DUMMY_DEVICE   (-2)
+/* consumes buffers as fast as the playlist produces them, for benchmarking.
+ * buffers are converted to target_audio_format as for a real device.
+ */
+#define GROOVE_PLAYER_NULL_DEVICE    (-3)
 
 struct GroovePlayer {
     /* set this to the device you want to open
-     * could also be GROOVE_PLAYER_DEFAULT_DEVICE or GROOVE_PLAYER_DUMMY_DEVICE
+     * could also be GROOVE_PLAYER_DEFAULT_DEVICE, GROOVE_PLAYER_DUMMY_DEVICE
+     * or GROOVE_PLAYER_NULL_DEVICE
      */
     int device_index;
 
@@ -75,6 +116,15 @@ struct GroovePlayer {
      * ideally will be the same as target_audio_format but might not be.
      */
     struct GrooveAudioFormat actual_audio_format;
+
+    /* only used with GROOVE_PLAYER_DUMMY_DEVICE. how many seconds of audio
+     * the dummy device plays per second of wall clock time, so 10.0 plays
+     * an hour of audio in six minutes. set to 0.0 to stop the clock
+     * entirely and advance it only with groove_player_dummy_advance.
+     * read when you call groove_player_attach.
+     * groove_player_create defaults this to 1.0
+     */
+    double dummy_speed;
 };
 
 /* Returns the number of available devices exposed by the current driver or -1
@@ -114,11 +164,19 @@ int groove_player_detach(struct GroovePlayer *player);
  * both the current playlist item and the position in seconds in the playlist
  * item are given. item will be set to NULL if the playlist is empty
  * you may pass NULL for item or seconds
+ * For a real device this accounts for the audio waiting in the device buffer
+ * and is interpolated between audio callbacks using the monotonic clock, so
+ * it is smooth enough to drive lyrics or visualizations.
  */
 void groove_player_position(struct GroovePlayer *player,
         struct GroovePlaylistItem **item, double *seconds);
 
-/* returns < 0 on error, 0 on no event ready, 1 on got event */
+/* Events are kept in a fixed size queue. Consecutive events of the same
+ * type are merged: only one GROOVE_EVENT_NOWPLAYING is kept, and buffer
+ * underruns are added together. If the application does not read events at
+ * all, the oldest ones are eventually dropped.
+ * returns < 0 on error, 0 on no event ready, 1 on got event
+ */
 int groove_player_event_get(struct GroovePlayer *player,
         union GroovePlayerEvent *event, int block);
 /* returns < 0 on error, 0 on no event ready, 1 on event ready
@@ -126,6 +184,37 @@ int groove_player_event_get(struct GroovePlayer *player,
  */
 int groove_player_event_peek(struct GroovePlayer *player, int block);
 
+/* after groove_player_event_get returns a GROOVE_EVENT_THROUGHPUT or
+ * GROOVE_EVENT_BUFFERUNDERRUN event, call these to get what it reports.
+ * the details are not part of union GroovePlayerEvent so that the union
+ * keeps its size.
+ * returns 0 on success, < 0 if the last event returned was of another type
+ */
+int groove_player_get_throughput(struct GroovePlayer *player,
+        struct GroovePlayerThroughputEvent *throughput);
+int groove_player_get_underrun(struct GroovePlayer *player,
+        struct GroovePlayerUnderrunEvent *underrun);
+
+/* get the totals of buffer underruns since the player was attached.
+ * count is the number of underrun episodes, including one in progress.
+ * frames and seconds are how much silence they inserted.
+ * the dummy and null devices never underrun.
+ * you may pass NULL for any of the parameters
+ */
+void groove_player_underrun_counters(struct GroovePlayer *player,
+        uint64_t *count, uint64_t *frames, double *seconds);
+
+/* Only for players attached with GROOVE_PLAYER_DUMMY_DEVICE. Advances the
+ * dummy device's clock by the given number of seconds, in addition to any
+ * time that passes according to dummy_speed. Only the audio for that time
+ * that the sink already has decoded is consumed before this function
+ * returns. The rest is consumed as the playlist decodes it, so until then
+ * events and groove_player_position lag behind the new time.
+ * Has no effect while the playlist is paused.
+ * returns 0 on success, < 0 on error
+ */
+int groove_player_dummy_advance(struct GroovePlayer *player, double seconds);
+
 /* See the gain property of GrooveSink. It is recommended that you leave this
  * at 1.0 and instead adjust the gain of the playlist.
  * returns 0 on success, < 0 on error